@@ -0,0 +1,18 @@
+#version 450 core
+
+in layout(location = 0) vec2 corner;
+in layout(location = 1) vec3 color;
+
+out vec4 frag_color;
+
+void main()
+{
+    // Round, and shaded like a sphere lit from the camera
+    float r2 = dot(corner, corner);
+    if (r2 > 1.0)
+    {
+        discard;
+    }
+
+    frag_color = vec4(color * (0.3 + 0.7 * sqrt(1.0 - r2)), 1.0);
+}
@@ -0,0 +1,48 @@
+#version 450 core
+
+// Camera facing discs, one instance per visible agent and four vertices
+// per instance, drawn as a triangle strip
+
+// Agents are packed to 16 bytes as in packedagent.hpp, 16 bits per field:
+// x | y, z | heading u, heading v | age and energy | species
+layout (std430, binding = 27) readonly buffer agent_buffer {
+    uvec4 agents[];
+};
+
+// Written by agentcull.comp
+layout (std430, binding = 29) readonly buffer visible_buffer {
+    uint visible[];
+};
+
+out layout(location = 0) vec2 corner;
+out layout(location = 1) vec3 color;
+
+uniform layout(location = 0) ivec3 bounds;
+
+// From voxels to the rotated cube
+uniform layout(location = 1) mat4 model;
+uniform layout(location = 2) mat4 view;
+uniform layout(location = 3) mat4 projection;
+
+// Disc diameter in voxels
+uniform layout(location = 4) float size;
+uniform layout(location = 5) vec4 species_colors[8];
+
+void main()
+{
+    uvec4 agent = agents[visible[gl_InstanceID]];
+    vec3 position = vec3(agent.x & 0xFFFFu, agent.x >> 16,
+            agent.y & 0xFFFFu) * (vec3(bounds) / 65536.0);
+    int species = int(agent.w) >> 16;
+
+    corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    color = species_colors[species].rgb;
+
+    // Offset in view space, so the disc faces the camera. The cube is two
+    // units across its longest side.
+    float radius = size / float(max(bounds.x, max(bounds.y, bounds.z)));
+    vec4 view_position = view * model * vec4(position, 1.0);
+    view_position.xy += corner * radius;
+
+    gl_Position = projection * view_position;
+}
@@ -2,31 +2,102 @@
 
 in layout(location = 0) vec3 position;
 
-layout(binding = 0) uniform sampler3D image;
+// Each texel holds the trail of all eight species as half floats
+layout(binding = 0) uniform usampler3D image;
+
+// Mean extinction and brightness of a ray segment, by the densities at
+// its front and back
+layout(binding = 1) uniform sampler2D transfer_table;
 
 uniform layout(location = 2) ivec3 volume_size;
+uniform layout(location = 3) vec4 species_colors[8];
+
+// In the space of the cube, which spans [-1, 1]
+uniform layout(location = 11) vec3 camera_position;
+
+uniform layout(location = 12) float max_density;
+uniform layout(location = 13) float max_step;
+uniform layout(location = 14) float adaptivity;
 
 out vec4 color;
 
+struct Sample
+{
+    float density;
+    vec3 hue;
+};
+
+Sample trail_sample(vec3 point)
+{
+    uvec4 texel = texture(image, point * 0.5 + 0.5);
+    float trail[8] = float[8](
+            unpackHalf2x16(texel.x).x, unpackHalf2x16(texel.x).y,
+            unpackHalf2x16(texel.y).x, unpackHalf2x16(texel.y).y,
+            unpackHalf2x16(texel.z).x, unpackHalf2x16(texel.z).y,
+            unpackHalf2x16(texel.w).x, unpackHalf2x16(texel.w).y);
+
+    Sample result;
+    result.density = 0.0;
+    result.hue = vec3(0.0);
+    for (int i = 0; i < 8; i++)
+    {
+        result.density += trail[i];
+        result.hue += trail[i] * species_colors[i].rgb;
+    }
+
+    result.hue /= max(result.density, 1e-6);
+    return result;
+}
+
+float table_coordinate(float density)
+{
+    float size = float(textureSize(transfer_table, 0).x);
+    float index = clamp(density / max_density, 0.0, 1.0) * (size - 1.0);
+    return (index + 0.5) / size;
+}
+
 void main()
 {
-    vec4 color_sample;
-    float delta = 1.0 / float(volume_size.z);
-    float z = 0.0;
+    // Rays start where they enter the cube and run to where they leave it
+    vec3 direction = normalize(position - camera_position);
+    vec3 signs = mix(vec3(-1.0), vec3(1.0), greaterThanEqual(direction,
+                vec3(0.0)));
+    vec3 exits = (1.0 - position * signs) / max(abs(direction), 1e-6);
+    float ray_length = min(exits.x, min(exits.y, exits.z));
+
+    // Steps are measured in voxels
+    float voxels_per_unit = length(direction * vec3(volume_size) * 0.5);
+    float ray_voxels = ray_length * voxels_per_unit;
+
+    Sample front = trail_sample(position);
+    float travelled = 0.0;
+    float step_length = max_step;
     float alpha_accum = 0.0;
     vec3 color_accum = vec3(0.0);
 
-    for (int i = 0; i < volume_size.z; i++)
+    while (travelled < ray_voxels && alpha_accum < 0.99)
     {
-        color_sample = texture(image, vec3(position.xy, z));
+        step_length = min(step_length, ray_voxels - travelled);
+        travelled += step_length;
+        Sample back = trail_sample(position +
+                direction * (travelled / voxels_per_unit));
+
+        vec2 segment = texture(transfer_table,
+                vec2(table_coordinate(front.density),
+                    table_coordinate(back.density))).xy;
+        float alpha = 1.0 - exp(-segment.x * step_length);
+        vec3 hue = 0.5 * (front.hue + back.hue);
 
-        color_accum += (1.0 - alpha_accum) * color_sample.rgb;
-        alpha_accum += (1.0 - alpha_accum) * color_sample.a;
+        color_accum += (1.0 - alpha_accum) * alpha * segment.y * hue;
+        alpha_accum += (1.0 - alpha_accum) * alpha;
 
-        if (alpha_accum > 1.0)
-            break;
+        // Short steps where the density changes fast, long ones elsewhere
+        float change = abs(back.density - front.density) /
+            (step_length * max_density);
+        step_length = clamp(max_step / (1.0 + adaptivity * max_step *
+                    change), 1.0, max_step);
 
-        z += delta;
+        front = back;
     }
 
     color = vec4(color_accum, 1.0);
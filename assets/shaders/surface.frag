@@ -0,0 +1,17 @@
+#version 450 core
+
+in layout(location = 0) vec3 position;
+
+uniform layout(location = 3) vec4 surface_color;
+
+out vec4 color;
+
+void main()
+{
+    // Flat shaded, the vertices carry no normals
+    vec3 normal = normalize(cross(dFdx(position), dFdy(position)));
+    vec3 light = normalize(vec3(0.3, 0.8, 1.0));
+    float diffuse = abs(dot(normal, light));
+
+    color = vec4(surface_color.rgb * (0.2 + 0.8 * diffuse), surface_color.a);
+}
@@ -0,0 +1,19 @@
+#version 450 core
+
+in layout(location = 0) vec3 position;
+
+out layout(location = 0) vec3 position_out;
+
+uniform layout(location = 0) mat4 model;
+uniform layout(location = 1) mat4 view_projection;
+uniform layout(location = 2) ivec3 volume_size;
+
+void main()
+{
+    // From voxels to the cube the volume is drawn in
+    vec3 cube_position = position / vec3(volume_size) * 2.0 - 1.0;
+    vec4 world_position = model * vec4(cube_position, 1.0);
+
+    gl_Position = view_projection * world_position;
+    position_out = world_position.xyz;
+}
@@ -0,0 +1,155 @@
+#include "agentrenderer.hpp"
+#include <glad/glad.h>
+#include <imgui.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <vector>
+#include "species.hpp"
+
+static const unsigned int bounds_index = 0;
+
+static const unsigned int transform_index = 1;
+static const unsigned int num_agents_index = 2;
+static const unsigned int counted_index = 3;
+static const unsigned int clip_low_index = 4;
+static const unsigned int clip_high_index = 5;
+static const unsigned int fraction_index = 6;
+static const unsigned int capacity_index = 7;
+
+static const unsigned int model_index = 1;
+static const unsigned int view_index = 2;
+static const unsigned int projection_index = 3;
+static const unsigned int size_index = 4;
+static const unsigned int species_colors_index = 5;
+
+// Bindings past those of the simulator
+static const unsigned int agent_binding = 27;
+static const unsigned int count_binding = 28;
+static const unsigned int visible_binding = 29;
+static const unsigned int draw_binding = 30;
+
+AgentRenderer::AgentRenderer()
+    : cull_shader("assets/shaders/agentcull.comp"),
+    render_shader("assets/shaders/agents.vert",
+            "assets/shaders/agents.frag"),
+    visible_capacity(0), show(false), fraction(1.0f), max_visible(1000000),
+    size(0.5f), clip_low(0.0f), clip_high(1.0f)
+{
+    glCreateVertexArrays(1, &this->vao);
+    glCreateBuffers(1, &this->ssbo_visible);
+    glCreateBuffers(1, &this->draw_command);
+    glNamedBufferData(this->draw_command, sizeof(DrawCommand), nullptr,
+            GL_DYNAMIC_COPY);
+}
+
+AgentRenderer::~AgentRenderer()
+{
+    glDeleteVertexArrays(1, &this->vao);
+    glDeleteBuffers(1, &this->ssbo_visible);
+    glDeleteBuffers(1, &this->draw_command);
+}
+
+bool AgentRenderer::ready() const
+{
+    return this->cull_shader.ready() && this->render_shader.ready();
+}
+
+bool AgentRenderer::valid() const
+{
+    return this->cull_shader.valid() && this->render_shader.valid();
+}
+
+void AgentRenderer::update_debug_window()
+{
+    ImGui::Begin("Agents");
+    ImGui::Checkbox("Show", &this->show);
+    ImGui::SliderFloat("Fraction", &this->fraction, 0.0f, 1.0f);
+    ImGui::DragInt("Max Visible", &this->max_visible, 10000.0f, 1,
+            100000000);
+    ImGui::DragFloat("Size", &this->size, 0.01f, 0.05f, 8.0f);
+    ImGui::DragFloat3("Clip Low", &this->clip_low.x, 0.005f, 0.0f, 1.0f);
+    ImGui::DragFloat3("Clip High", &this->clip_high.x, 0.005f, 0.0f, 1.0f);
+    ImGui::End();
+}
+
+bool AgentRenderer::render(const Simulator &simulator,
+        const glm::mat4 &model, const Camera &camera)
+{
+    unsigned int agents;
+    unsigned int count_buffer;
+    int bound;
+    if (!simulator.agent_buffers(agents, count_buffer, bound))
+    {
+        return false;
+    }
+
+    if (this->max_visible > this->visible_capacity)
+    {
+        this->visible_capacity = this->max_visible;
+        glNamedBufferData(this->ssbo_visible,
+                this->visible_capacity * sizeof(unsigned int), nullptr,
+                GL_DYNAMIC_COPY);
+    }
+
+    // Four vertices per disc, instances are counted by the cull pass
+    DrawCommand command = { 4, 0, 0, 0 };
+    glNamedBufferSubData(this->draw_command, 0, sizeof(command), &command);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, agent_binding, agents);
+    if (count_buffer)
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, count_binding,
+                count_buffer);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, visible_binding,
+            this->ssbo_visible);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, draw_binding,
+            this->draw_command);
+
+    // From voxels to the cube the volume is drawn in, and on to clip space
+    glm::ivec3 volume = simulator.trail_size();
+    glm::mat4 to_cube = glm::translate(glm::mat4(1.0f), glm::vec3(-1.0f)) *
+        glm::scale(glm::mat4(1.0f), 2.0f / glm::vec3(volume));
+
+    // The cull dispatch can exceed the group limit along x
+    int groups = std::max(1, (bound + cull_group_size - 1) /
+            cull_group_size);
+    int columns = std::min(groups, 65535);
+
+    this->cull_shader.bind();
+    this->cull_shader.set_ivec3(bounds_index, volume);
+    this->cull_shader.set_mat4(transform_index,
+            camera.matrix() * model * to_cube);
+    this->cull_shader.set_int(num_agents_index, bound);
+    this->cull_shader.set_int(counted_index, count_buffer != 0);
+    this->cull_shader.set_vec3(clip_low_index,
+            this->clip_low * glm::vec3(volume));
+    this->cull_shader.set_vec3(clip_high_index,
+            this->clip_high * glm::vec3(volume));
+    this->cull_shader.set_float(fraction_index, this->fraction);
+    this->cull_shader.set_int(capacity_index, this->visible_capacity);
+    this->cull_shader.set_work_group(glm::uvec3(columns,
+                (groups + columns - 1) / columns, 1));
+    this->cull_shader.dispatch_and_wait();
+
+    std::vector<glm::vec4> colors = simulator.species_colors();
+    colors.resize(Species::max_count, glm::vec4(0.0f));
+
+    this->render_shader.bind();
+    this->render_shader.set_ivec3(bounds_index, volume);
+    this->render_shader.set_mat4(model_index, model * to_cube);
+    this->render_shader.set_mat4(view_index, camera.view());
+    this->render_shader.set_mat4(projection_index, camera.projection());
+    this->render_shader.set_float(size_index, this->size);
+    for (int i = 0; i < Species::max_count; i++)
+    {
+        this->render_shader.set_vec4(species_colors_index + i, colors[i]);
+    }
+
+    glBindVertexArray(this->vao);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->draw_command);
+    glDrawArraysIndirect(GL_TRIANGLE_STRIP, nullptr);
+    glBindVertexArray(0);
+
+    return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <glm/glm.hpp>
+#include "shader.hpp"
+#include "simulator.hpp"
+#include "camera.hpp"
+
+// Draws the agents as camera facing discs straight from the agent buffer of
+// the GPU simulator. A compute pass culls them against the view frustum and
+// the clip box, keeps a random subset, and writes the indices of the rest
+// along with the indirect draw command, so nothing is read back.
+class AgentRenderer
+{
+private:
+    // glDrawArraysIndirect command
+    struct DrawCommand
+    {
+        unsigned int vertex_count;
+        unsigned int instance_count;
+        unsigned int first_vertex;
+        unsigned int base_instance;
+    };
+
+    ComputeShader cull_shader;
+    RenderShader render_shader;
+
+    // Quads are built from the vertex and instance ids, so the vertex array
+    // has no attributes
+    unsigned int vao;
+    unsigned int ssbo_visible;
+    unsigned int draw_command;
+    int visible_capacity;
+
+    const int cull_group_size = 256;
+
+public:
+    bool show;
+
+    // Share of the agents kept, lowered so that at most max_visible are
+    // drawn
+    float fraction;
+    int max_visible;
+
+    // Disc diameter in voxels
+    float size;
+
+    // Only agents within the box are drawn, in fractions of the volume. The
+    // box turns with the cube.
+    glm::vec3 clip_low;
+    glm::vec3 clip_high;
+
+public:
+    AgentRenderer();
+    ~AgentRenderer();
+
+    // The shaders compile in the background like the others
+    bool ready() const;
+    bool valid() const;
+
+    void update_debug_window();
+
+    // Returns false if the agents of the simulator are not on the GPU
+    bool render(const Simulator &simulator, const glm::mat4 &model,
+            const Camera &camera);
+};
@@ -0,0 +1,129 @@
+#include "autotune.hpp"
+#include <glad/glad.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+static const char *config_path = "autotune.cfg";
+
+static std::string gl_string(GLenum name)
+{
+    const GLubyte *value = glGetString(name);
+    return value ? reinterpret_cast<const char *>(value) : "";
+}
+
+WorkGroups Autotune::defaults()
+{
+    WorkGroups groups;
+    groups.agent = 64;
+    groups.diffuse = glm::ivec3(8, 8, 8);
+    return groups;
+}
+
+std::vector<int> Autotune::agent_candidates()
+{
+    return { 32, 64, 128, 256, 512 };
+}
+
+std::vector<glm::ivec3> Autotune::diffuse_candidates()
+{
+    // Wide rows follow the x-major texel order, cubes share the most
+    // neighbours between invocations
+    return {
+        glm::ivec3(4, 4, 4),
+        glm::ivec3(8, 8, 4),
+        glm::ivec3(8, 8, 8),
+        glm::ivec3(16, 4, 4),
+        glm::ivec3(16, 8, 2),
+        glm::ivec3(16, 16, 1),
+        glm::ivec3(32, 4, 2),
+        glm::ivec3(32, 8, 1),
+        glm::ivec3(64, 2, 2),
+    };
+}
+
+std::string Autotune::key(const glm::ivec3 &size, int num_agents)
+{
+    std::ostringstream text;
+    text << gl_string(GL_VENDOR) << "/" << gl_string(GL_RENDERER) << "/"
+        << gl_string(GL_VERSION) << "/" << size.x << "x" << size.y << "x"
+        << size.z << "/" << num_agents;
+
+    // FNV-1a, so the key is one word in the config
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : text.str())
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx",
+            static_cast<unsigned long long>(hash));
+    return key;
+}
+
+bool Autotune::load(const std::string &key, WorkGroups &groups)
+{
+    std::ifstream file(config_path);
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream entry(line);
+
+        std::string entry_key;
+        WorkGroups entry_groups;
+        entry >> entry_key >> entry_groups.agent >> entry_groups.diffuse.x
+            >> entry_groups.diffuse.y >> entry_groups.diffuse.z;
+
+        if (entry && entry_key == key)
+        {
+            groups = entry_groups;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Autotune::save(const std::string &key, const WorkGroups &groups)
+{
+    // One line per key, so other devices and volumes keep their entries
+    std::ostringstream kept;
+    {
+        std::ifstream file(config_path);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (line.compare(0, key.size(), key) != 0)
+            {
+                kept << line << "\n";
+            }
+        }
+    }
+
+    std::ofstream file(config_path);
+    file << kept.str() << key << " " << groups.agent << " "
+        << groups.diffuse.x << " " << groups.diffuse.y << " "
+        << groups.diffuse.z << "\n";
+}
+
+double Autotune::time(const std::function<void()> &dispatch, int repeats)
+{
+    // The first call also builds the program
+    dispatch();
+    glFinish();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; i++)
+    {
+        dispatch();
+    }
+    glFinish();
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double>(end - start).count() / repeats;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Local sizes of the agent and diffuse passes
+struct WorkGroups
+{
+    int agent;
+    glm::ivec3 diffuse;
+};
+
+// Work group sizes are benchmarked once per device, volume and agent count,
+// and the fastest are kept in autotune.cfg
+namespace Autotune
+{
+    WorkGroups defaults();
+
+    std::vector<int> agent_candidates();
+    std::vector<glm::ivec3> diffuse_candidates();
+
+    std::string key(const glm::ivec3 &size, int num_agents);
+
+    bool load(const std::string &key, WorkGroups &groups);
+    void save(const std::string &key, const WorkGroups &groups);
+
+    // Mean seconds per call, after one untimed call
+    double time(const std::function<void()> &dispatch, int repeats);
+};
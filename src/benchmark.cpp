@@ -0,0 +1,134 @@
+#include "benchmark.hpp"
+#include <glad/glad.h>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+// The default of MetricsLog
+static const float metrics_threshold = 0.1f;
+
+static double time_steps(Simulator &simulator, int steps)
+{
+    const float dt = 1.0f / 60.0f;
+
+    // One untimed step, so lazy driver work is not measured
+    simulator.update(dt);
+    glFinish();
+    simulator.reset_benchmark_counters();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; i++)
+    {
+        simulator.update(dt);
+    }
+    glFinish();
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double>(end - start).count();
+}
+
+static void write_header(std::ostream &out, const Simulator &simulator,
+        const std::string &backend, int num_agents, int steps,
+        double seconds)
+{
+    glm::ivec3 size = simulator.trail_size();
+
+    out << "{\n  \"backend\": \"" << backend << "\""
+        << ",\n  \"volume\": [" << size.x << ", " << size.y << ", "
+        << size.z << "]"
+        << ",\n  \"agents\": " << num_agents
+        << ",\n  \"steps\": " << steps
+        << ",\n  \"seconds\": " << seconds
+        << ",\n  \"steps_per_second\": " << steps / seconds;
+    simulator.write_benchmark_fields(out, seconds);
+}
+
+static void write_metric(std::ostream &out, const char *name, double value,
+        double reference)
+{
+    double difference = reference != 0.0 ?
+        (value - reference) / std::fabs(reference) : value - reference;
+
+    out << ",\n    \"" << name << "\": { \"value\": " << value
+        << ", \"reference\": " << reference
+        << ", \"relative_difference\": " << difference << " }";
+}
+
+void Benchmark::run(Simulator &simulator, const std::string &backend,
+        int num_agents, int steps, const std::string &path)
+{
+    double seconds = time_steps(simulator, steps);
+
+    std::ofstream out(path);
+    write_header(out, simulator, backend, num_agents, steps, seconds);
+    out << "\n}\n";
+
+    std::cout << backend << ": " << steps << " steps in " << seconds
+        << " s, written to " << path << "\n";
+}
+
+Benchmark::Measurement Benchmark::measure(Simulator &simulator, int steps)
+{
+    Measurement measurement = Measurement();
+    measurement.seconds = time_steps(simulator, steps);
+    measurement.has_metrics = simulator.compute_metrics(metrics_threshold,
+            measurement.metrics);
+
+    return measurement;
+}
+
+void Benchmark::write_comparison(const Simulator &simulator,
+        const std::string &backend, const std::string &variant,
+        int num_agents, int steps, const Measurement &measurement,
+        const Measurement &reference, const std::string &path)
+{
+    std::ofstream out(path);
+    write_header(out, simulator, backend, num_agents, steps,
+            measurement.seconds);
+
+    out << ",\n  \"variant\": \"" << variant << "\""
+        << ",\n  \"reference_seconds\": " << reference.seconds
+        << ",\n  \"speedup\": " << reference.seconds / measurement.seconds;
+
+    // Runs diverge step by step, so the networks are compared by their
+    // structure rather than voxel by voxel
+    if (measurement.has_metrics && reference.has_metrics)
+    {
+        const Metrics &a = measurement.metrics;
+        const Metrics &b = reference.metrics;
+
+        out << ",\n  \"metrics\": {\n    \"threshold\": "
+            << metrics_threshold;
+        write_metric(out, "trail_mass", a.trail_mass, b.trail_mass);
+        write_metric(out, "occupancy", a.occupancy, b.occupancy);
+        write_metric(out, "components", a.components, b.components);
+        write_metric(out, "largest_component", a.largest_component,
+                b.largest_component);
+
+        // Total variation distance of the agents per occupied voxel
+        double total_a = 0.0;
+        double total_b = 0.0;
+        for (int i = 0; i < Metrics::histogram_bins; i++)
+        {
+            total_a += a.agent_density[i];
+            total_b += b.agent_density[i];
+        }
+
+        double distance = 0.0;
+        for (int i = 0; i < Metrics::histogram_bins && total_a > 0.0 &&
+                total_b > 0.0; i++)
+        {
+            distance += std::fabs(a.agent_density[i] / total_a -
+                    b.agent_density[i] / total_b);
+        }
+
+        out << ",\n    \"agent_density_distance\": " << distance / 2.0
+            << "\n  }";
+    }
+    out << "\n}\n";
+
+    std::cout << backend << " " << variant << ": " << steps << " steps in "
+        << measurement.seconds << " s, reference " << reference.seconds
+        << " s, written to " << path << "\n";
+}
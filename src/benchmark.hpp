@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include "simulator.hpp"
+#include "metrics.hpp"
+
+namespace Benchmark
+{
+    // Wall time of the timed steps and the network they ended with
+    struct Measurement
+    {
+        double seconds;
+        bool has_metrics;
+        Metrics metrics;
+    };
+
+    // Runs a fixed number of steps and writes the timings as JSON
+    void run(Simulator &simulator, const std::string &backend,
+            int num_agents, int steps, const std::string &path);
+
+    // Times the steps after one untimed step, then computes the metrics
+    Measurement measure(Simulator &simulator, int steps);
+
+    // Writes the timings and metrics of a run as JSON next to those of a
+    // reference run from the same start, with their relative differences
+    void write_comparison(const Simulator &simulator,
+            const std::string &backend, const std::string &variant,
+            int num_agents, int steps, const Measurement &measurement,
+            const Measurement &reference, const std::string &path);
+};
@@ -0,0 +1,144 @@
+#include "brush.hpp"
+#include <imgui.h>
+#include <algorithm>
+#include <cmath>
+
+Brush::Brush()
+    : mode(SpawnAgents), radius(5.0f), rate(10000.0f), intensity(1.0f),
+    species(0), dragging(false), last_center(0.0f), spawn_accumulator(0.0f)
+{}
+
+void Brush::update_debug_window(int num_species)
+{
+    const char *modes[] =
+    {
+        "Spawn Agents",
+        "Erase Agents",
+        "Paint Trail",
+        "Paint Food",
+        "Erase Trail",
+    };
+
+    ImGui::Begin("Brush");
+
+    int current = this->mode;
+    if (ImGui::Combo("Mode", &current, modes, 5))
+    {
+        this->mode = static_cast<Mode>(current);
+    }
+
+    ImGui::DragFloat("Radius", &this->radius, 0.5f, 1.0f, 50.0f);
+    if (this->mode == SpawnAgents)
+    {
+        ImGui::DragFloat("Agents per Second", &this->rate, 100.0f, 0.0f,
+                1000000.0f);
+    }
+    if (this->mode == PaintTrail || this->mode == PaintFood)
+    {
+        ImGui::DragFloat("Intensity", &this->intensity, 0.01f, 0.0f, 1.0f);
+    }
+    if (this->mode == SpawnAgents || this->mode == PaintTrail)
+    {
+        ImGui::SliderInt("Species", &this->species, 0, num_species - 1);
+    }
+
+    ImGui::End();
+
+    this->species = std::min(this->species, num_species - 1);
+}
+
+void Brush::drag(Ray ray, const glm::mat4 &model, const glm::ivec3 &volume)
+{
+    glm::mat4 inverse_model = glm::inverse(model);
+    ray.origin = glm::vec3(inverse_model * glm::vec4(ray.origin, 1.0f));
+    ray.direction = glm::vec3(inverse_model * glm::vec4(ray.direction, 0.0f));
+
+    Ray::Intersection hit = ray.cube_intersection(glm::vec3(0.0f), 1.0f);
+    if (!hit.hit)
+    {
+        this->dragging = false;
+        return;
+    }
+
+    glm::vec3 center = (hit.near * 0.5f + 0.5f) * glm::vec3(volume);
+
+    // Stamps half a radius apart fill the path since the last pick, with
+    // the spacing widened when the path is too long for max_stamps
+    int count = 1;
+    if (this->dragging)
+    {
+        float distance = glm::length(center - this->last_center);
+        count = static_cast<int>(std::ceil(distance / (0.5f * this->radius)));
+        count = std::max(1, std::min(count, this->max_stamps));
+    }
+
+    count = std::min(count, this->max_stamps -
+            static_cast<int>(this->stamps.size()));
+    for (int i = 1; i <= count; i++)
+    {
+        float t = static_cast<float>(i) / count;
+        this->stamps.push_back(this->dragging ?
+                this->last_center + (center - this->last_center) * t :
+                center);
+    }
+
+    this->dragging = true;
+    this->last_center = center;
+}
+
+void Brush::release()
+{
+    this->dragging = false;
+}
+
+void Brush::apply(Simulator &simulator, float dt)
+{
+    if (this->stamps.empty())
+    {
+        this->spawn_accumulator = 0.0f;
+        return;
+    }
+
+    int num_stamps = this->stamps.size();
+
+    switch (this->mode)
+    {
+        case SpawnAgents:
+        {
+            this->spawn_accumulator += this->rate * dt;
+            int total = static_cast<int>(this->spawn_accumulator);
+            this->spawn_accumulator -= total;
+
+            for (int i = 0; i < num_stamps; i++)
+            {
+                int count = (total * (i + 1)) / num_stamps -
+                    (total * i) / num_stamps;
+                simulator.spawn(this->stamps[i], this->radius, count,
+                        this->species);
+            }
+            break;
+        }
+        case EraseAgents:
+        {
+            simulator.erase_agents(this->stamps, this->radius);
+            break;
+        }
+        default:
+        {
+            // Food is trail of every species, so it attracts and feeds all
+            // of them
+            TrailEdit edit;
+            edit.centers = this->stamps;
+            edit.radius = this->radius;
+            edit.amount = this->intensity;
+            edit.channels = this->mode == PaintTrail ?
+                1u << this->species : 0xFFu;
+            edit.erase = this->mode == EraseTrail;
+
+            simulator.edit_trail(edit);
+            break;
+        }
+    }
+
+    this->stamps.clear();
+}
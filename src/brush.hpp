@@ -0,0 +1,48 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include "ray.hpp"
+#include "simulator.hpp"
+
+// Edits the simulation where the cursor ray enters the volume. Picks are
+// collected as stamps along the dragged path and applied once per frame, so
+// the cost per frame is bounded however fast the mouse moves.
+class Brush
+{
+public:
+    enum Mode
+    {
+        SpawnAgents,
+        EraseAgents,
+        PaintTrail,
+        PaintFood,
+        EraseTrail,
+    };
+
+private:
+    Mode mode;
+    float radius;
+    float rate;
+    float intensity;
+    int species;
+
+    bool dragging;
+    glm::vec3 last_center;
+    float spawn_accumulator;
+
+    std::vector<glm::vec3> stamps;
+
+    const int max_stamps = 32;
+
+public:
+    Brush();
+
+    void update_debug_window(int num_species);
+
+    // The cube is drawn with model over [-1, 1] and holds a volume of the
+    // given size
+    void drag(Ray ray, const glm::mat4 &model, const glm::ivec3 &volume);
+    void release();
+
+    void apply(Simulator &simulator, float dt);
+};
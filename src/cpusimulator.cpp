@@ -0,0 +1,1339 @@
+#include "cpusimulator.hpp"
+#include <glad/glad.h>
+#include <imgui.h>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "calc.hpp"
+#include "numa.hpp"
+
+static int wrap(int value, int bound)
+{
+    return ((value % bound) + bound) % bound;
+}
+
+const int CpuSimulator::max_sense_size;
+const int CpuSimulator::max_blur_radius;
+const int CpuSimulator::max_neighbours;
+
+// Power of two bounds wrap with a mask
+template <bool Pow2>
+static int wrap_voxel(int value, int bound)
+{
+    return Pow2 ? value & (bound - 1) : wrap(value, bound);
+}
+
+static float approach(float current, float target, float amount)
+{
+    float dist = target - current;
+    float step = std::min(std::abs(dist), amount);
+    return dist < 0.0f ? current - step : current + step;
+}
+
+// Same hash as the agent shader
+static unsigned int hash(unsigned int state)
+{
+    state ^= 2747636419u;
+    state *= 2654435769u;
+    state ^= state >> 16;
+    state *= 2654435769u;
+    state ^= state >> 16;
+    state *= 2654435769u;
+    return state;
+}
+
+static float scale_to_unit(unsigned int value)
+{
+    return value / 4294967295.0f;
+}
+
+// Cosine and sine of the angles k pi / 16, the planes agents turn in.
+// Turning either way in a plane covers the other half of the circle.
+static const float plane_rotations[16][2] =
+{
+    { 1.0f, 0.0f }, { 0.98078528f, 0.19509032f },
+    { 0.92387953f, 0.38268343f }, { 0.83146961f, 0.55557023f },
+    { 0.70710678f, 0.70710678f }, { 0.55557023f, 0.83146961f },
+    { 0.38268343f, 0.92387953f }, { 0.19509032f, 0.98078528f },
+    { 0.0f, 1.0f }, { -0.19509032f, 0.98078528f },
+    { -0.38268343f, 0.92387953f }, { -0.55557023f, 0.83146961f },
+    { -0.70710678f, 0.70710678f }, { -0.83146961f, 0.55557023f },
+    { -0.92387953f, 0.38268343f }, { -0.98078528f, 0.19509032f },
+};
+
+// Unit vector perpendicular to the unit heading in the plane picked by
+// rand, from an orthonormal frame built without trigonometry
+static glm::vec3 plane_direction(const glm::vec3 &heading, unsigned int rand)
+{
+    float sign = heading.z >= 0.0f ? 1.0f : -1.0f;
+    float a = -1.0f / (sign + heading.z);
+    float b = heading.x * heading.y * a;
+    glm::vec3 tangent(1.0f + sign * heading.x * heading.x * a, sign * b,
+            -sign * heading.x);
+    glm::vec3 bitangent(b, sign + heading.y * heading.y * a, -heading.y);
+
+    const float *rotation = plane_rotations[rand >> 28];
+    return tangent * rotation[0] + bitangent * rotation[1];
+}
+
+// Union-find over voxel indices, with no_label for unoccupied voxels
+static const unsigned int no_label = 0xFFFFFFFFu;
+
+static unsigned int find_root(std::vector<unsigned int> &labels,
+        unsigned int x)
+{
+    while (labels[x] != x)
+    {
+        labels[x] = labels[labels[x]];
+        x = labels[x];
+    }
+
+    return x;
+}
+
+static void unite(std::vector<unsigned int> &labels, unsigned int a,
+        unsigned int b)
+{
+    a = find_root(labels, a);
+    b = find_root(labels, b);
+    if (a < b)
+        labels[b] = a;
+    else if (b < a)
+        labels[a] = b;
+}
+
+// Swaps the last agent into the slot
+static void remove_agent(std::vector<PackedAgent> &agents, size_t index)
+{
+    agents[index] = agents.back();
+    agents.pop_back();
+}
+
+static PackedAgent pack(const Distribution::Sample &sample,
+        const glm::vec3 &bounds)
+{
+    PackedAgent::State state;
+    state.position = sample.position;
+    state.heading = PackedAgent::heading_of(sample.theta, sample.phi);
+    state.species = sample.species;
+    state.age = 0.0f;
+    state.energy = 1.0f;
+    return PackedAgent::encode(state, bounds);
+}
+
+CpuSimulator::CpuSimulator(int num_agents, const glm::ivec3 &size,
+        const Distribution &distribution, int num_species)
+    : size(size), num_agents(num_agents), num_nodes(0), step_count(0),
+    pending_diffusion_dt(0.0f), trail_pixels(nullptr),
+    diffused_trail_pixels(nullptr), trail_dirty(true)
+{
+    num_species = std::max(1, std::min(num_species, Species::max_count));
+    this->species = Species::presets(num_species);
+    this->wide = num_species > 4;
+
+    this->pow2_bounds = true;
+    for (int i = 0; i < 3; i++)
+    {
+        this->pow2_bounds = this->pow2_bounds &&
+            (size[i] & (size[i] - 1)) == 0;
+    }
+
+    // Workers are ordered by node, so each node owns a contiguous range of
+    // layers and only the slab borders are shared between nodes
+    std::vector<std::vector<int>> nodes = Numa::node_cpus();
+    this->num_nodes = nodes.size();
+
+    std::vector<int> cpus;
+    for (size_t node = 0; node < nodes.size(); node++)
+    {
+        for (int cpu : nodes[node])
+        {
+            if (static_cast<int>(cpus.size()) == size.z)
+                break;
+
+            Worker worker;
+            worker.cpu = cpu;
+            worker.node = node;
+            worker.bytes = 0.0;
+            this->workers.push_back(worker);
+
+            cpus.push_back(cpu);
+        }
+    }
+
+    int num_workers = this->workers.size();
+
+    this->layer_owner.resize(size.z);
+    for (int i = 0; i < num_workers; i++)
+    {
+        Worker &worker = this->workers[i];
+        worker.z_begin = i * size.z / num_workers;
+        worker.z_end = (i + 1) * size.z / num_workers;
+        worker.outbox.resize(num_workers);
+
+        for (int z = worker.z_begin; z < worker.z_end; z++)
+        {
+            this->layer_owner[z] = i;
+        }
+    }
+
+    // Not touched here, so the pages end up on the node of the worker that
+    // clears them
+    size_t volume_size = static_cast<size_t>(size.x) * size.y * size.z *
+        sizeof(Texel);
+    this->trail_pixels = static_cast<Texel *>(std::malloc(volume_size));
+    this->diffused_trail_pixels =
+        static_cast<Texel *>(std::malloc(volume_size));
+
+    this->num_agents = distribution.count(num_agents);
+    this->pool.reset(new WorkerPool(cpus));
+
+    // Every worker generates an equal share of the agents and sorts them by
+    // owner, then every owner takes in its agents
+    this->pool->run([this, &distribution, num_species](int index)
+            {
+                Worker &worker = this->workers[index];
+                int count = this->workers.size();
+
+                long long total = this->num_agents;
+                int begin = static_cast<int>(index * total / count);
+                int end = static_cast<int>((index + 1) * total / count);
+                for (int i = begin; i < end; i++)
+                {
+                    Distribution::Sample sample = distribution.sample(i,
+                            this->num_agents, num_species, this->size);
+
+                    // Owned by the layer of the packed position, which may
+                    // round into the next one
+                    glm::vec3 bounds(this->size);
+                    PackedAgent agent = pack(sample, bounds);
+                    int pz = std::min(static_cast<int>(
+                                agent.position(bounds).z), this->size.z - 1);
+                    worker.outbox[this->layer_owner[pz]].push_back(agent);
+                }
+            });
+
+    this->pool->run([this](int index)
+            {
+                Worker &worker = this->workers[index];
+
+                size_t begin = this->voxel_index(0, 0, worker.z_begin);
+                size_t end = this->voxel_index(0, 0, worker.z_end);
+                Texel empty = { glm::vec4(0.0f), glm::vec4(0.0f) };
+                std::fill(this->trail_pixels + begin,
+                        this->trail_pixels + end, empty);
+                std::fill(this->diffused_trail_pixels + begin,
+                        this->diffused_trail_pixels + end, empty);
+
+                for (auto &sender : this->workers)
+                {
+                    const AgentStore &arrived = sender.outbox[index];
+                    for (size_t i = 0; i < arrived.size(); i++)
+                    {
+                        worker.agents.push_back(arrived[i]);
+
+                        this->deposit(worker.agents,
+                                worker.agents.size() - 1, 1.0f);
+                    }
+                }
+            });
+
+    this->trail_texture.initialize(size, GL_RGBA32UI);
+}
+
+CpuSimulator::~CpuSimulator()
+{
+    this->multigrid.reset();
+    this->summed_area.reset();
+    this->pool.reset();
+
+    std::free(this->trail_pixels);
+    std::free(this->diffused_trail_pixels);
+}
+
+void CpuSimulator::update(float dt)
+{
+    float step_dt = dt / static_cast<float>(steps_per_frame);
+    for (size_t i = 0; i < steps_per_frame; i++)
+    {
+        step_update(step_dt);
+    }
+
+    this->trail_dirty = true;
+}
+
+void CpuSimulator::step_update(float dt)
+{
+    // Passes are picked once per step, so their loops see the sense size
+    // and blur radius as constants
+    Pass step_agents = this->agent_pass();
+    Pass diffuse = this->diffuse_pass();
+
+    if (this->summed_area_sensing)
+    {
+        if (!this->summed_area)
+        {
+            this->summed_area.reset(new SummedArea(*this->pool));
+        }
+
+        this->summed_area->build(this->trail_pixels, size,
+                glm::clamp(sense_size, 1, SummedArea::max_radius),
+                this->wide ? 8 : 4);
+    }
+
+    if (this->crowding)
+    {
+        build_spatial_hash();
+    }
+
+    this->pool->run([this, dt, step_agents](int worker)
+            {
+                (this->*step_agents)(worker, dt);
+            });
+    this->pool->run([this, dt](int worker) { gather_agents(worker, dt); });
+
+    if (this->implicit_diffusion)
+    {
+        // Deposits collect in the trail until the next diffusion step
+        this->pending_diffusion_dt += dt;
+        if ((this->step_count + 1) % this->diffusion_interval == 0)
+        {
+            diffuse_implicit(this->pending_diffusion_dt);
+            this->pending_diffusion_dt = 0.0f;
+        }
+    }
+    else
+    {
+        this->pool->run([this, dt, diffuse](int worker)
+                {
+                    (this->*diffuse)(worker, dt);
+                });
+
+        std::swap(this->trail_pixels, this->diffused_trail_pixels);
+        this->pending_diffusion_dt = 0.0f;
+    }
+
+    this->step_count++;
+}
+
+template <int Radius, bool Pow2, bool Wide>
+void CpuSimulator::step_agents(int index, float dt)
+{
+    Worker &worker = this->workers[index];
+    AgentStore &agents = worker.agents;
+
+    for (auto &outbox : worker.outbox)
+    {
+        outbox.clear();
+    }
+
+    worker.bytes += agents.size() * agent_step_bytes;
+
+    unsigned int seed = hash(this->step_count ^ hash(index));
+
+    // The trail is only read here, deposits wait for the gather pass so
+    // sensing across slab borders does not race with the neighbours
+    glm::vec3 bounds(size);
+    size_t i = 0;
+    while (i < agents.size())
+    {
+        PackedAgent::State agent = agents[i].decode(bounds);
+        const Species &s = this->species[agent.species];
+        const glm::vec3 &heading = agent.heading;
+
+        // Side probes in a random plane through the heading, as on the GPU,
+        // rotated by the precomputed sense spacing
+        unsigned int rand = hash(static_cast<unsigned int>(i) ^ seed);
+        glm::vec3 plane = plane_direction(heading, rand);
+        glm::vec3 forward = heading * s.rotation.x;
+        glm::vec3 side = plane * s.rotation.y;
+
+        float sense_forward = this->sense<Radius, Pow2, Wide>(
+                agent.position, heading, s);
+        float sense_right = this->sense<Radius, Pow2, Wide>(
+                agent.position, forward + side, s);
+        float sense_left = this->sense<Radius, Pow2, Wide>(
+                agent.position, forward - side, s);
+
+        float turn = 0.0f;
+        if (sense_forward > sense_right && sense_forward > sense_left)
+        {
+            turn = 0.0f;
+        }
+        else if (sense_forward < sense_right && sense_forward < sense_left)
+        {
+            turn = scale_to_unit(hash(rand)) < 0.5f ? -1.0f : 1.0f;
+        }
+        else if (sense_left < sense_right)
+        {
+            turn = 1.0f;
+        }
+        else if (sense_right < sense_left)
+        {
+            turn = -1.0f;
+        }
+
+        // Renormalized every step, so rounding does not build up
+        if (turn != 0.0f)
+        {
+            agent.heading = glm::normalize(heading * s.rotation.z +
+                    plane * (s.rotation.w * turn));
+        }
+
+        if (this->crowding)
+        {
+            this->crowd(agent.position, agent.heading);
+        }
+
+        if (!this->obstacle_field.empty())
+        {
+            this->avoid_obstacles(agent.position, agent.heading,
+                    s.move_speed * dt);
+        }
+
+        agent.position += agent.heading * (s.move_speed * dt);
+
+        // Rounded stochastically, so steps shorter than the fixed point
+        // resolution still move the agent on average. Energy is regained
+        // from the own trail at the rounded position.
+        float offset = scale_to_unit(hash(hash(rand)));
+        glm::vec3 position = PackedAgent::encode(agent, bounds, offset)
+            .position(bounds);
+        int px = std::min(static_cast<int>(position.x), size.x - 1);
+        int py = std::min(static_cast<int>(position.y), size.y - 1);
+        int pz = std::min(static_cast<int>(position.z), size.z - 1);
+        const Texel &food = this->trail_pixels[this->voxel_index(px, py, pz)];
+        int k = agent.species;
+        float own_trail = k < 4 ? food.low[k] : food.high[k - 4];
+
+        agent.age += dt;
+        agent.energy = glm::clamp(agent.energy +
+                (own_trail - starvation) * dt, 0.0f, 1.0f);
+
+        if ((lifetime > 0.0f && agent.age > lifetime) ||
+                (starvation > 0.0f && agent.energy <= 0.0f))
+        {
+            remove_agent(agents, i);
+            continue;
+        }
+
+        agents[i] = PackedAgent::encode(agent, bounds, offset);
+
+        // Agents that leave the slab deposit once they reach their new
+        // owner, so no two workers write the same voxel
+        int owner = this->layer_owner[pz];
+        if (owner != index)
+        {
+            worker.outbox[owner].push_back(agents[i]);
+            remove_agent(agents, i);
+            continue;
+        }
+
+        i++;
+    }
+}
+
+void CpuSimulator::gather_agents(int index, float dt)
+{
+    Worker &worker = this->workers[index];
+
+    for (size_t i = 0; i < worker.agents.size(); i++)
+    {
+        this->deposit(worker.agents, i, dt);
+    }
+
+    for (auto &sender : this->workers)
+    {
+        const AgentStore &arrived = sender.outbox[index];
+        for (size_t i = 0; i < arrived.size(); i++)
+        {
+            worker.agents.push_back(arrived[i]);
+            this->deposit(worker.agents, worker.agents.size() - 1, dt);
+        }
+    }
+}
+
+void CpuSimulator::build_spatial_hash()
+{
+    size_t cells = static_cast<size_t>(size.x) * size.y * size.z;
+    this->cell_starts.resize(cells + 1);
+
+    // Workers own increasing layers, so their agents follow one another
+    std::vector<size_t> offsets(this->workers.size() + 1, 0);
+    for (size_t i = 0; i < this->workers.size(); i++)
+    {
+        offsets[i + 1] = offsets[i] + this->workers[i].agents.size();
+    }
+    this->neighbours.resize(offsets.back());
+    this->cell_starts[cells] = offsets.back();
+
+    this->pool->run([this, &offsets](int index)
+            {
+                Worker &worker = this->workers[index];
+                AgentStore &agents = worker.agents;
+                AgentStore &sorted = worker.sorted_agents;
+                size_t begin = this->voxel_index(0, 0, worker.z_begin);
+                size_t end = this->voxel_index(0, 0, worker.z_end);
+
+                std::vector<size_t> &agent_cells = worker.agent_cells;
+                std::vector<unsigned int> &cursors = worker.cell_cursors;
+                agent_cells.resize(agents.size());
+                cursors.assign(end - begin, 0u);
+                for (size_t i = 0; i < agents.size(); i++)
+                {
+                    glm::ivec3 voxel = this->voxel_of(agents[i]);
+                    agent_cells[i] = this->voxel_index(voxel.x, voxel.y,
+                            voxel.z);
+                    cursors[agent_cells[i] - begin]++;
+                }
+
+                unsigned int start = offsets[index];
+                for (size_t cell = begin; cell < end; cell++)
+                {
+                    unsigned int count = cursors[cell - begin];
+                    this->cell_starts[cell] = start;
+                    cursors[cell - begin] = start;
+                    start += count;
+                }
+
+                sorted.resize(agents.size());
+                for (size_t i = 0; i < agents.size(); i++)
+                {
+                    unsigned int slot = cursors[agent_cells[i] - begin]++;
+                    sorted[slot - offsets[index]] = agents[i];
+
+                    PackedAgent::State agent = agents[i].decode(
+                            glm::vec3(size));
+                    Neighbour &neighbour = this->neighbours[slot];
+                    neighbour.position = agent.position;
+                    neighbour.direction = agent.heading;
+                }
+
+                std::swap(agents, sorted);
+            });
+}
+
+void CpuSimulator::crowd(const glm::vec3 &position,
+        glm::vec3 &heading) const
+{
+    glm::vec3 bounds(size);
+    glm::vec3 half = bounds * 0.5f;
+    glm::vec3 push(0.0f);
+    glm::vec3 mean_heading(0.0f);
+    int visited = 0;
+    int close = 0;
+
+    // The radius is at most half a voxel, so the cells within it span at
+    // most two per axis. Cells next to each other in x are next to each
+    // other in the grid, so both are read as one range unless x wraps.
+    glm::ivec3 low(glm::floor(position - interaction_radius));
+    glm::ivec3 high = glm::min(low + 1,
+            glm::ivec3(glm::ceil(position + interaction_radius)) - 1);
+    int x_low = wrap(low.x, size.x);
+    int x_high = wrap(high.x, size.x);
+    bool x_contiguous = x_high >= x_low;
+
+    for (int cz = low.z; cz <= high.z; cz++)
+    {
+        for (int cy = low.y; cy <= high.y; cy++)
+        {
+            size_t row = this->voxel_index(0, wrap(cy, size.y),
+                    wrap(cz, size.z));
+            for (int part = 0; part < (x_contiguous ? 1 : 2); part++)
+            {
+                size_t first = row + (part == 0 ? x_low : x_high);
+                size_t last = row + (x_contiguous || part == 1 ? x_high :
+                        x_low);
+                unsigned int start = this->cell_starts[first];
+                unsigned int end = std::min(this->cell_starts[last + 1],
+                        start + (max_neighbours - visited));
+                visited += end - start;
+
+                for (unsigned int k = start; k < end; k++)
+                {
+                    // The grid holds the agent itself at distance zero
+                    const Neighbour &neighbour = this->neighbours[k];
+                    glm::vec3 d = position - neighbour.position;
+                    d.x += d.x > half.x ? -bounds.x :
+                        d.x < -half.x ? bounds.x : 0.0f;
+                    d.y += d.y > half.y ? -bounds.y :
+                        d.y < -half.y ? bounds.y : 0.0f;
+                    d.z += d.z > half.z ? -bounds.z :
+                        d.z < -half.z ? bounds.z : 0.0f;
+
+                    float distance = std::sqrt(glm::dot(d, d));
+                    if (distance > 0.0f && distance < interaction_radius)
+                    {
+                        push += d / distance *
+                            (1.0f - distance / interaction_radius);
+                        mean_heading += neighbour.direction;
+                        close++;
+                    }
+                }
+            }
+        }
+    }
+
+    if (close == 0)
+    {
+        return;
+    }
+
+    glm::vec3 steered = heading + repulsion * push +
+        alignment * mean_heading / static_cast<float>(close);
+    if (glm::dot(steered, steered) > 1e-12f)
+    {
+        heading = glm::normalize(steered);
+    }
+}
+
+// A single read of the distance field per step. Agents inside an obstacle
+// head straight out, and agents that could reach one within the step lose
+// the part of their heading towards it, so they slide along its surface.
+void CpuSimulator::avoid_obstacles(const glm::vec3 &position,
+        glm::vec3 &heading, float step) const
+{
+    int x = std::min(static_cast<int>(position.x), size.x - 1);
+    int y = std::min(static_cast<int>(position.y), size.y - 1);
+    int z = std::min(static_cast<int>(position.z), size.z - 1);
+    const glm::vec4 &field = this->obstacle_field[this->voxel_index(x, y, z)];
+    glm::vec3 away(field.y, field.z, field.w);
+
+    if (field.x <= 0.0f)
+    {
+        heading = away;
+        return;
+    }
+
+    float towards = -glm::dot(heading, away);
+    if (towards <= 0.0f || field.x > step + obstacle_margin)
+    {
+        return;
+    }
+
+    glm::vec3 slid = heading + away * towards;
+    heading = glm::dot(slid, slid) > 1e-12f ? glm::normalize(slid) : away;
+}
+
+template <int Radius, bool Pow2, bool Wide>
+CpuSimulator::Texel CpuSimulator::box_sum(int x, int y, int z) const
+{
+    if (Radius == 0)
+    {
+        return this->summed_area->box_sum(x, y, z);
+    }
+
+    Texel sum = { glm::vec4(0.0f), glm::vec4(0.0f) };
+    for (int oz = -Radius; oz <= Radius; oz++)
+    {
+        int sz = wrap_voxel<Pow2>(z + oz, size.z);
+        for (int oy = -Radius; oy <= Radius; oy++)
+        {
+            int sy = wrap_voxel<Pow2>(y + oy, size.y);
+            for (int ox = -Radius; ox <= Radius; ox++)
+            {
+                int sx = wrap_voxel<Pow2>(x + ox, size.x);
+                const Texel &texel =
+                    this->trail_pixels[this->voxel_index(sx, sy, sz)];
+                sum.low += texel.low;
+                if (Wide)
+                {
+                    sum.high += texel.high;
+                }
+            }
+        }
+    }
+
+    return sum;
+}
+
+// Sum over the free voxels of the box, so no trail diffuses through the
+// obstacles
+template <int Radius, bool Pow2, bool Wide>
+CpuSimulator::Texel CpuSimulator::free_box_sum(int x, int y, int z,
+        int &count) const
+{
+    Texel sum = { glm::vec4(0.0f), glm::vec4(0.0f) };
+    count = 0;
+    for (int oz = -Radius; oz <= Radius; oz++)
+    {
+        int sz = wrap_voxel<Pow2>(z + oz, size.z);
+        for (int oy = -Radius; oy <= Radius; oy++)
+        {
+            int sy = wrap_voxel<Pow2>(y + oy, size.y);
+            for (int ox = -Radius; ox <= Radius; ox++)
+            {
+                int sx = wrap_voxel<Pow2>(x + ox, size.x);
+                size_t i = this->voxel_index(sx, sy, sz);
+                if (this->obstacle_mask[i])
+                {
+                    continue;
+                }
+
+                const Texel &texel = this->trail_pixels[i];
+                sum.low += texel.low;
+                if (Wide)
+                {
+                    sum.high += texel.high;
+                }
+                count++;
+            }
+        }
+    }
+
+    return sum;
+}
+
+template <int Radius, bool Pow2, bool Wide>
+void CpuSimulator::diffuse(int index, float dt)
+{
+    Worker &worker = this->workers[index];
+
+    float weight = 1.0f / std::pow(Radius * 2 + 1, 3);
+    float mix_amount = std::min(1.0f, diffuse_speed * dt);
+    bool masked = !this->obstacle_mask.empty();
+
+    worker.bytes += static_cast<double>(size.x) * size.y *
+        (worker.z_end - worker.z_begin) * voxel_step_bytes;
+
+    for (int z = worker.z_begin; z < worker.z_end; z++)
+    {
+        for (int y = 0; y < size.y; y++)
+        {
+            for (int x = 0; x < size.x; x++)
+            {
+                size_t i = this->voxel_index(x, y, z);
+                Texel &diffused = this->diffused_trail_pixels[i];
+
+                // Solid voxels hold no trail, and free ones average over
+                // the free voxels around them
+                Texel sum;
+                float box_weight = weight;
+                if (masked)
+                {
+                    if (this->obstacle_mask[i])
+                    {
+                        diffused.low = glm::vec4(0.0f);
+                        diffused.high = glm::vec4(0.0f);
+                        continue;
+                    }
+
+                    int count;
+                    sum = this->free_box_sum<Radius, Pow2, Wide>(x, y, z,
+                            count);
+                    box_weight = 1.0f / count;
+                }
+                else
+                {
+                    sum = this->box_sum<Radius, Pow2, Wide>(x, y, z);
+                }
+
+                const Texel &current = this->trail_pixels[i];
+                glm::vec4 low = current.low +
+                    (sum.low * box_weight - current.low) * mix_amount;
+                glm::vec4 high = current.high +
+                    (sum.high * box_weight - current.high) * mix_amount;
+
+                // Unused species channels are cleared as on the GPU
+                diffused.low = glm::max(glm::vec4(0.0f),
+                        low - decay_speed * dt);
+                diffused.high = Wide ? glm::max(glm::vec4(0.0f),
+                        high - decay_speed * dt) : glm::vec4(0.0f);
+            }
+        }
+    }
+}
+
+void CpuSimulator::diffuse_implicit(float dt)
+{
+    if (!this->multigrid)
+    {
+        this->multigrid.reset(new Multigrid(*this->pool));
+    }
+
+    float coefficient = Multigrid::coefficient(diffuse_speed, blur_radius,
+            dt);
+    this->multigrid->solve(this->trail_pixels, size, coefficient,
+            multigrid_cycles);
+
+    // The solver does not see the obstacles, so they absorb the trail that
+    // diffuses into them
+    this->pool->run([this, dt](int index)
+            {
+                Worker &worker = this->workers[index];
+                bool masked = !this->obstacle_mask.empty();
+                size_t begin = this->voxel_index(0, 0, worker.z_begin);
+                size_t end = this->voxel_index(0, 0, worker.z_end);
+                for (size_t i = begin; i < end; i++)
+                {
+                    Texel &texel = this->trail_pixels[i];
+                    if (masked && this->obstacle_mask[i])
+                    {
+                        texel.low = glm::vec4(0.0f);
+                        texel.high = glm::vec4(0.0f);
+                        continue;
+                    }
+
+                    texel.low = glm::max(glm::vec4(0.0f),
+                            texel.low - decay_speed * dt);
+                    texel.high = this->wide ? glm::max(glm::vec4(0.0f),
+                            texel.high - decay_speed * dt) : glm::vec4(0.0f);
+                }
+            });
+}
+
+template <int Radius, bool Pow2, bool Wide>
+float CpuSimulator::sense(const glm::vec3 &position,
+        const glm::vec3 &direction, const Species &s) const
+{
+    glm::vec3 center = position + direction *
+        static_cast<float>(s.sense_distance);
+    int cx = std::floor(center.x);
+    int cy = std::floor(center.y);
+    int cz = std::floor(center.z);
+
+    Texel sum = this->box_sum<Radius, Pow2, Wide>(cx, cy, cz);
+
+    return glm::dot(sum.low, s.attraction_low) +
+        (Wide ? glm::dot(sum.high, s.attraction_high) : 0.0f);
+}
+
+template <bool Pow2, bool Wide>
+CpuSimulator::Pass CpuSimulator::agent_pass(int radius)
+{
+    switch (radius)
+    {
+        case 0: return &CpuSimulator::step_agents<0, Pow2, Wide>;
+        case 1: return &CpuSimulator::step_agents<1, Pow2, Wide>;
+        case 2: return &CpuSimulator::step_agents<2, Pow2, Wide>;
+        default: return &CpuSimulator::step_agents<3, Pow2, Wide>;
+    }
+}
+
+template <bool Pow2, bool Wide>
+CpuSimulator::Pass CpuSimulator::diffuse_pass(int radius)
+{
+    switch (radius)
+    {
+        case 1: return &CpuSimulator::diffuse<1, Pow2, Wide>;
+        case 2: return &CpuSimulator::diffuse<2, Pow2, Wide>;
+        case 3: return &CpuSimulator::diffuse<3, Pow2, Wide>;
+        case 4: return &CpuSimulator::diffuse<4, Pow2, Wide>;
+        default: return &CpuSimulator::diffuse<5, Pow2, Wide>;
+    }
+}
+
+CpuSimulator::Pass CpuSimulator::agent_pass() const
+{
+    int radius = this->summed_area_sensing ? 0 :
+        glm::clamp(sense_size, 1, max_sense_size);
+    if (this->pow2_bounds)
+    {
+        return this->wide ? agent_pass<true, true>(radius) :
+            agent_pass<true, false>(radius);
+    }
+
+    return this->wide ? agent_pass<false, true>(radius) :
+        agent_pass<false, false>(radius);
+}
+
+CpuSimulator::Pass CpuSimulator::diffuse_pass() const
+{
+    int radius = glm::clamp(blur_radius, 1, max_blur_radius);
+    if (this->pow2_bounds)
+    {
+        return this->wide ? diffuse_pass<true, true>(radius) :
+            diffuse_pass<true, false>(radius);
+    }
+
+    return this->wide ? diffuse_pass<false, true>(radius) :
+        diffuse_pass<false, false>(radius);
+}
+
+void CpuSimulator::deposit(const AgentStore &agents, size_t index, float dt)
+{
+    glm::ivec3 voxel = this->voxel_of(agents[index]);
+    Texel &trail = this->trail_pixels[this->voxel_index(voxel.x, voxel.y,
+            voxel.z)];
+    int s = agents[index].species();
+    float &channel = s < 4 ? trail.low[s] : trail.high[s - 4];
+
+    channel = approach(channel, 1.0f, this->species[s].trail_weight * dt);
+}
+
+glm::ivec3 CpuSimulator::voxel_of(const PackedAgent &agent) const
+{
+    return glm::min(glm::ivec3(agent.position(glm::vec3(size))), size - 1);
+}
+
+size_t CpuSimulator::voxel_index(int x, int y, int z) const
+{
+    return x + size.x * (y + static_cast<size_t>(size.y) * z);
+}
+
+glm::uvec4 CpuSimulator::pack_texel(const Texel &texel) const
+{
+    return glm::uvec4(
+            glm::packHalf2x16(glm::vec2(texel.low.x, texel.low.y)),
+            glm::packHalf2x16(glm::vec2(texel.low.z, texel.low.w)),
+            glm::packHalf2x16(glm::vec2(texel.high.x, texel.high.y)),
+            glm::packHalf2x16(glm::vec2(texel.high.z, texel.high.w)));
+}
+
+const Texture3D *CpuSimulator::trail() const
+{
+    if (this->trail_dirty)
+    {
+        size_t count = static_cast<size_t>(size.x) * size.y * size.z;
+        this->upload_pixels.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            this->upload_pixels[i] = this->pack_texel(this->trail_pixels[i]);
+        }
+
+        this->trail_texture.set_data(this->upload_pixels.data());
+        this->trail_dirty = false;
+    }
+    else
+    {
+        for (const TrailEdit::Box &box : this->dirty_boxes)
+        {
+            this->upload_pixels.clear();
+            for (int z = box.origin.z; z < box.origin.z + box.size.z; z++)
+            {
+                for (int y = box.origin.y; y < box.origin.y + box.size.y; y++)
+                {
+                    for (int x = box.origin.x; x < box.origin.x + box.size.x;
+                            x++)
+                    {
+                        this->upload_pixels.push_back(this->pack_texel(
+                                    this->trail_pixels[
+                                    this->voxel_index(x, y, z)]));
+                    }
+                }
+            }
+
+            this->trail_texture.set_sub_data(this->upload_pixels.data(),
+                    box.origin.x, box.origin.y, box.origin.z,
+                    box.size.x, box.size.y, box.size.z);
+        }
+    }
+
+    this->dirty_boxes.clear();
+
+    return &this->trail_texture;
+}
+
+glm::ivec3 CpuSimulator::trail_size() const
+{
+    return this->size;
+}
+
+std::vector<glm::vec4> CpuSimulator::species_colors() const
+{
+    std::vector<glm::vec4> colors;
+    for (const Species &s : this->species)
+    {
+        colors.push_back(s.color);
+    }
+
+    return colors;
+}
+
+void CpuSimulator::spawn(const glm::vec3 &center, float radius, int count,
+        int species_id)
+{
+    // Workers are idle between steps, so new agents go straight to the
+    // owner of their layer
+    species_id = glm::clamp(species_id, 0,
+            static_cast<int>(this->species.size()) - 1);
+
+    for (int i = 0; i < count; i++)
+    {
+        float theta = Calc::frand() * 2.0f * glm::pi<float>();
+        float phi = std::acos(1.0f - 2.0f * Calc::frand());
+        float r = radius * std::cbrt(Calc::frand());
+
+        // Packing wraps the position into the volume
+        float sin_phi = std::sin(phi);
+        Distribution::Sample sample;
+        sample.position = center + glm::vec3(sin_phi * std::cos(theta),
+                sin_phi * std::sin(theta), std::cos(phi)) * r;
+        sample.theta = theta;
+        sample.phi = phi;
+        sample.species = species_id;
+
+        PackedAgent agent = pack(sample, glm::vec3(size));
+        int pz = this->voxel_of(agent).z;
+        this->workers[this->layer_owner[pz]].agents.push_back(agent);
+    }
+}
+
+void CpuSimulator::erase_agents(const std::vector<glm::vec3> &centers,
+        float radius)
+{
+    for (Worker &worker : this->workers)
+    {
+        AgentStore &agents = worker.agents;
+
+        size_t i = 0;
+        while (i < agents.size())
+        {
+            glm::vec3 position = agents[i].position(glm::vec3(size));
+
+            bool inside = false;
+            for (const glm::vec3 &center : centers)
+            {
+                glm::vec3 delta = glm::abs(position - center);
+                delta = glm::min(delta, glm::vec3(size) - delta);
+                inside = inside || glm::length(delta) < radius;
+            }
+
+            if (inside)
+            {
+                remove_agent(agents, i);
+                continue;
+            }
+
+            i++;
+        }
+    }
+}
+
+bool CpuSimulator::save_checkpoint(const std::string &path) const
+{
+    std::vector<Distribution::Sample> samples;
+    for (const Worker &worker : this->workers)
+    {
+        const AgentStore &agents = worker.agents;
+        for (size_t i = 0; i < agents.size(); i++)
+        {
+            PackedAgent::State agent = agents[i].decode(glm::vec3(size));
+            Distribution::Sample sample;
+            sample.position = agent.position;
+            PackedAgent::angles_of(agent.heading, sample.theta,
+                    sample.phi);
+            sample.species = agent.species;
+            samples.push_back(sample);
+        }
+    }
+
+    return Distribution::save_checkpoint(path, samples);
+}
+
+bool CpuSimulator::compute_metrics(float threshold, Metrics &metrics)
+{
+    size_t voxels = voxel_index(0, 0, size.z);
+    std::vector<unsigned int> labels(voxels);
+    std::vector<unsigned int> counts(voxels, 0);
+
+    struct Partial
+    {
+        double mass;
+        double occupied;
+        unsigned int histogram[Metrics::histogram_bins];
+    };
+    std::vector<Partial> partials(this->workers.size(), Partial());
+
+    // Workers reduce their own layers and join the components within them.
+    // Unions only link voxels of the same slab, so no two workers touch the
+    // same labels.
+    this->pool->run([this, threshold, &labels, &counts, &partials](int index)
+            {
+                const Worker &worker = this->workers[index];
+                Partial &partial = partials[index];
+
+                size_t begin = this->voxel_index(0, 0, worker.z_begin);
+                size_t end = this->voxel_index(0, 0, worker.z_end);
+                for (size_t i = begin; i < end; i++)
+                {
+                    const Texel &texel = this->trail_pixels[i];
+                    glm::vec4 pairs = texel.low + texel.high;
+                    float total = pairs.x + pairs.y + pairs.z + pairs.w;
+
+                    bool occupied = total > threshold;
+                    labels[i] = occupied ? static_cast<unsigned int>(i) :
+                        no_label;
+                    partial.mass += total;
+                    partial.occupied += occupied ? 1.0 : 0.0;
+                }
+
+                for (int z = worker.z_begin; z < worker.z_end; z++)
+                {
+                    for (int y = 0; y < this->size.y; y++)
+                    {
+                        for (int x = 0; x < this->size.x; x++)
+                        {
+                            size_t i = this->voxel_index(x, y, z);
+                            if (labels[i] == no_label)
+                            {
+                                continue;
+                            }
+
+                            size_t right = this->voxel_index(
+                                    (x + 1) % this->size.x, y, z);
+                            size_t up = this->voxel_index(x,
+                                    (y + 1) % this->size.y, z);
+                            if (labels[right] != no_label)
+                                unite(labels, i, right);
+                            if (labels[up] != no_label)
+                                unite(labels, i, up);
+
+                            if (z + 1 < worker.z_end)
+                            {
+                                size_t front = this->voxel_index(x, y, z + 1);
+                                if (labels[front] != no_label)
+                                    unite(labels, i, front);
+                            }
+                        }
+                    }
+                }
+
+                const AgentStore &agents = worker.agents;
+                for (size_t i = 0; i < agents.size(); i++)
+                {
+                    glm::ivec3 voxel = this->voxel_of(agents[i]);
+                    int z = glm::clamp(voxel.z, worker.z_begin,
+                            worker.z_end - 1);
+                    counts[this->voxel_index(voxel.x, voxel.y, z)]++;
+                }
+
+                for (size_t i = begin; i < end; i++)
+                {
+                    if (counts[i] > 0)
+                    {
+                        int bin = std::min<unsigned int>(counts[i],
+                                Metrics::histogram_bins) - 1;
+                        partial.histogram[bin]++;
+                    }
+                }
+            });
+
+    double occupied = 0.0;
+    metrics.trail_mass = 0.0;
+    for (const Partial &partial : partials)
+    {
+        metrics.trail_mass += partial.mass;
+        occupied += partial.occupied;
+        for (int i = 0; i < Metrics::histogram_bins; i++)
+        {
+            metrics.agent_density[i] += partial.histogram[i];
+        }
+    }
+
+    // Slabs are joined across their borders, including the wrap from the
+    // last layer to the first, and the roots are counted
+    for (const Worker &worker : this->workers)
+    {
+        int z = worker.z_end - 1;
+        int next = worker.z_end % size.z;
+        for (int y = 0; y < size.y; y++)
+        {
+            for (int x = 0; x < size.x; x++)
+            {
+                size_t i = voxel_index(x, y, z);
+                size_t front = voxel_index(x, y, next);
+                if (labels[i] != no_label && labels[front] != no_label)
+                {
+                    unite(labels, i, front);
+                }
+            }
+        }
+    }
+
+    std::fill(counts.begin(), counts.end(), 0);
+    int components = 0;
+    unsigned int largest = 0;
+    for (size_t i = 0; i < voxels; i++)
+    {
+        if (labels[i] == no_label)
+        {
+            continue;
+        }
+
+        unsigned int root = find_root(labels, i);
+        largest = std::max(largest, ++counts[root]);
+        components += root == i ? 1 : 0;
+    }
+
+    metrics.occupancy = static_cast<float>(occupied / voxels);
+    metrics.components = components;
+    metrics.largest_component = occupied > 0.0 ?
+        static_cast<float>(largest / occupied) : 0.0f;
+
+    return true;
+}
+
+bool CpuSimulator::occupancy_mask(float threshold,
+        std::vector<unsigned char> &mask)
+{
+    mask.resize(voxel_index(0, 0, size.z));
+
+    this->pool->run([this, threshold, &mask](int index)
+            {
+                const Worker &worker = this->workers[index];
+                size_t begin = this->voxel_index(0, 0, worker.z_begin);
+                size_t end = this->voxel_index(0, 0, worker.z_end);
+                for (size_t i = begin; i < end; i++)
+                {
+                    const Texel &texel = this->trail_pixels[i];
+                    glm::vec4 pairs = texel.low + texel.high;
+                    mask[i] = pairs.x + pairs.y + pairs.z + pairs.w >
+                        threshold;
+                }
+            });
+
+    return true;
+}
+
+// Summing on the workers costs less than finding the changed bricks
+bool CpuSimulator::trail_density(std::vector<float> &density, float)
+{
+    density.resize(voxel_index(0, 0, size.z));
+
+    this->pool->run([this, &density](int index)
+            {
+                const Worker &worker = this->workers[index];
+                size_t begin = this->voxel_index(0, 0, worker.z_begin);
+                size_t end = this->voxel_index(0, 0, worker.z_end);
+                for (size_t i = begin; i < end; i++)
+                {
+                    const Texel &texel = this->trail_pixels[i];
+                    glm::vec4 pairs = texel.low + texel.high;
+                    density[i] = pairs.x + pairs.y + pairs.z + pairs.w;
+                }
+            });
+
+    return true;
+}
+
+bool CpuSimulator::set_obstacles(const Obstacles &obstacles)
+{
+    if (obstacles.empty() || obstacles.size != size)
+    {
+        return false;
+    }
+
+    this->obstacle_field = obstacles.field;
+    this->obstacle_mask = obstacles.mask;
+    return true;
+}
+
+void CpuSimulator::edit_trail(const TrailEdit &edit)
+{
+    std::vector<TrailEdit::Box> boxes = edit.dirty_boxes(size);
+
+    for (const TrailEdit::Box &box : boxes)
+    {
+        for (int z = box.origin.z; z < box.origin.z + box.size.z; z++)
+        {
+            for (int y = box.origin.y; y < box.origin.y + box.size.y; y++)
+            {
+                for (int x = box.origin.x; x < box.origin.x + box.size.x; x++)
+                {
+                    float weight = edit.weight(glm::ivec3(x, y, z), size);
+                    if (weight <= 0.0f)
+                    {
+                        continue;
+                    }
+
+                    Texel &texel = this->trail_pixels[
+                        this->voxel_index(x, y, z)];
+                    for (int k = 0; k < 8; k++)
+                    {
+                        if (edit.channels & (1u << k))
+                        {
+                            float &channel = k < 4 ?
+                                texel.low[k] : texel.high[k - 4];
+                            channel = edit.apply(channel, weight);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    this->dirty_boxes.insert(this->dirty_boxes.end(), boxes.begin(),
+            boxes.end());
+}
+
+void CpuSimulator::update_debug_window()
+{
+    ImGui::Begin("Parameters");
+
+    Species::update_debug_window(this->species, 100);
+    if (ImGui::Checkbox("Summed Area Sensing", &summed_area_sensing) &&
+            !summed_area_sensing)
+    {
+        sense_size = std::min(sense_size, max_sense_size);
+    }
+    ImGui::DragInt("Sense Size", &sense_size, 1, 1, summed_area_sensing ?
+            SummedArea::max_radius : max_sense_size);
+
+    ImGui::Checkbox("Crowding", &crowding);
+    if (crowding)
+    {
+        ImGui::DragFloat("Repulsion", &repulsion, 0.05f, 0.0f, 10.0f);
+        ImGui::DragFloat("Alignment", &alignment, 0.05f, 0.0f, 10.0f);
+        ImGui::DragFloat("Interaction Radius", &interaction_radius, 0.01f,
+                0.05f, 0.5f);
+    }
+
+    ImGui::DragFloat("Diffuse Speed", &diffuse_speed, 0.05f, 0.0f, 10.0f);
+    ImGui::DragFloat("Decay Speed", &decay_speed, 0.05f, 0.0f, 10.0f);
+    ImGui::DragInt("Blur Radius", &blur_radius, 1, 1, max_blur_radius);
+
+    ImGui::Checkbox("Implicit Diffusion", &implicit_diffusion);
+    if (implicit_diffusion)
+    {
+        ImGui::DragInt("Diffusion Interval", &diffusion_interval, 1, 1, 100);
+        ImGui::DragInt("Multigrid Cycles", &multigrid_cycles, 1, 1, 8);
+        diffusion_interval = std::max(1, diffusion_interval);
+    }
+
+    ImGui::DragFloat("Lifetime", &lifetime, 1.0f, 0.0f, 1000.0f);
+    ImGui::DragFloat("Starvation", &starvation, 0.01f, 0.0f, 10.0f);
+
+    ImGui::Text("%d workers on %d nodes",
+            static_cast<int>(this->workers.size()), this->num_nodes);
+
+    ImGui::End();
+}
+
+void CpuSimulator::reset_benchmark_counters()
+{
+    for (auto &worker : this->workers)
+    {
+        worker.bytes = 0.0;
+    }
+}
+
+void CpuSimulator::write_benchmark_fields(std::ostream &out,
+        double seconds) const
+{
+    out << ",\n  \"workers\": " << this->workers.size();
+    out << ",\n  \"nodes\": [";
+
+    for (int node = 0; node < this->num_nodes; node++)
+    {
+        int count = 0;
+        double bytes = 0.0;
+        for (const auto &worker : this->workers)
+        {
+            if (worker.node == node)
+            {
+                count++;
+                bytes += worker.bytes;
+            }
+        }
+
+        out << (node ? ",\n" : "\n") << "    { \"node\": " << node
+            << ", \"workers\": " << count
+            << ", \"bytes\": " << bytes
+            << ", \"gigabytes_per_second\": " << bytes / seconds / 1e9
+            << " }";
+    }
+
+    out << "\n  ]";
+}
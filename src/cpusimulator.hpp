@@ -0,0 +1,219 @@
+#pragma once
+#include <glm/gtc/matrix_transform.hpp>
+#include <vector>
+#include <memory>
+#include "simulator.hpp"
+#include "distribution.hpp"
+#include "species.hpp"
+#include "texture.hpp"
+#include "workerpool.hpp"
+#include "multigrid.hpp"
+#include "summedarea.hpp"
+#include "packedagent.hpp"
+#include "obstacles.hpp"
+
+// CPU port of SlimeSimulator. The volume is split into z slabs, one per
+// worker thread, with the workers pinned and grouped by NUMA node.
+class CpuSimulator : public Simulator
+{
+private:
+    // Packed like the GPU agents, so the agent pass streams 16 bytes per
+    // agent and decodes them in registers
+    typedef std::vector<PackedAgent> AgentStore;
+
+    // A worker owns the layers [z_begin, z_end) and the agents in them. It
+    // is the first to touch its layers and agents, so they are placed on the
+    // node it is pinned to.
+    struct Worker
+    {
+        int cpu;
+        int node;
+        int z_begin;
+        int z_end;
+
+        AgentStore agents;
+        std::vector<AgentStore> outbox;
+
+        // Cell of each agent, the next free slot of each cell in the
+        // layers, and the agents in cell order, while the uniform grid is
+        // built
+        std::vector<size_t> agent_cells;
+        std::vector<unsigned int> cell_cursors;
+        AgentStore sorted_agents;
+
+        double bytes;
+    };
+
+    // Trail of all species, species 0-3 in low and 4-7 in high
+    typedef Multigrid::Texel Texel;
+
+    // An agent in the uniform grid, as it was at the start of the step
+    struct Neighbour
+    {
+        glm::vec3 position;
+        glm::vec3 direction;
+    };
+
+    // A pass specialised on its filter radius, on whether every bound is a
+    // power of two, and on whether there are more than four species. Agent
+    // passes of radius 0 sense through the summed area table.
+    typedef void (CpuSimulator::*Pass)(int, float);
+
+private:
+    glm::ivec3 size;
+    int num_agents;
+    int num_nodes;
+    unsigned int step_count;
+
+    std::vector<Species> species;
+
+    bool pow2_bounds;
+    bool wide;
+
+    std::vector<Worker> workers;
+    std::vector<int> layer_owner;
+    std::unique_ptr<WorkerPool> pool;
+
+    // Created when implicit diffusion is first used
+    std::unique_ptr<Multigrid> multigrid;
+    float pending_diffusion_dt;
+
+    // Created when summed area sensing is first used
+    std::unique_ptr<SummedArea> summed_area;
+
+    // Uniform grid of the agents with one cell per voxel, rebuilt every
+    // step with crowding. The agents of a cell are the neighbours
+    // [cell_starts[cell], cell_starts[cell + 1]). Each worker sorts its own
+    // agents, which all lie in its layers, so no atomics are needed, and
+    // keeps them in cell order so the grid is read close to in order.
+    std::vector<unsigned int> cell_starts;
+    std::vector<Neighbour> neighbours;
+
+    // Distance to the nearest obstacle with the direction away from it,
+    // and whether the voxel is solid, per voxel. Both are empty without
+    // obstacles.
+    std::vector<glm::vec4> obstacle_field;
+    std::vector<unsigned char> obstacle_mask;
+
+    Texel *trail_pixels;
+    Texel *diffused_trail_pixels;
+
+    // The trail is packed to half floats like the GPU trail on upload
+    // Brush edits between steps only upload the boxes they touched
+    Texture3D trail_texture;
+    mutable std::vector<glm::uvec4> upload_pixels;
+    mutable bool trail_dirty;
+    mutable std::vector<TrailEdit::Box> dirty_boxes;
+
+    // Bytes streamed per agent and voxel update, used for the bandwidth
+    // estimate in the benchmark report. Sensing mostly hits the cache and
+    // is not counted.
+    const double agent_step_bytes = 2 * 16 + 2 * 32;
+    const double voxel_step_bytes = 2 * 32;
+
+    const size_t steps_per_frame = 1;
+
+    static const int max_sense_size = 3;
+    static const int max_blur_radius = 5;
+
+    int sense_size = 1;
+
+    // Rebuilds a summed area table of the trail every step, so sensing
+    // costs the same for any sense size up to SummedArea::max_radius
+    bool summed_area_sensing = false;
+
+    // Agents closer than interaction_radius voxels, at most half, repel
+    // each other and align their headings
+    bool crowding = false;
+    float repulsion = 1.0f;
+    float alignment = 0.5f;
+    float interaction_radius = 0.5f;
+
+    // Neighbours visited per agent, which bounds the cost in dense colonies
+    static const int max_neighbours = 16;
+
+    // Agents closer to an obstacle than their step and this margin slide
+    // along it. The field is read at the voxel center, which is up to half
+    // a voxel diagonal away.
+    const float obstacle_margin = 1.0f;
+
+    float lifetime = 0.0f;
+    float starvation = 0.0f;
+
+    float diffuse_speed = 3.0f;
+    float decay_speed = 0.1f;
+    int blur_radius = 1;
+
+    // Implicit diffusion is stable for any step, so it runs once every
+    // diffusion_interval agent steps over their combined time
+    bool implicit_diffusion = false;
+    int diffusion_interval = 10;
+    int multigrid_cycles = 2;
+
+public:
+    CpuSimulator(int num_agents, const glm::ivec3 &size,
+            const Distribution &distribution, int num_species = 1);
+    ~CpuSimulator();
+
+    void update(float dt) override;
+
+    const Texture3D *trail() const override;
+    glm::ivec3 trail_size() const override;
+    std::vector<glm::vec4> species_colors() const override;
+
+    void spawn(const glm::vec3 &center, float radius, int count,
+            int species_id) override;
+    void erase_agents(const std::vector<glm::vec3> &centers, float radius)
+        override;
+
+    void edit_trail(const TrailEdit &edit) override;
+
+    bool save_checkpoint(const std::string &path) const override;
+
+    bool compute_metrics(float threshold, Metrics &metrics) override;
+    bool occupancy_mask(float threshold,
+            std::vector<unsigned char> &mask) override;
+    bool trail_density(std::vector<float> &density, float tolerance)
+        override;
+
+    bool set_obstacles(const Obstacles &obstacles) override;
+
+    void update_debug_window() override;
+
+    void reset_benchmark_counters() override;
+    void write_benchmark_fields(std::ostream &out,
+            double seconds) const override;
+
+private:
+    void step_update(float dt);
+
+    template <int Radius, bool Pow2, bool Wide>
+    void step_agents(int worker, float dt);
+    void gather_agents(int worker, float dt);
+    void build_spatial_hash();
+    void crowd(const glm::vec3 &position, glm::vec3 &heading) const;
+    void avoid_obstacles(const glm::vec3 &position, glm::vec3 &heading,
+            float step) const;
+    template <int Radius, bool Pow2, bool Wide>
+    void diffuse(int worker, float dt);
+    void diffuse_implicit(float dt);
+
+    template <bool Pow2, bool Wide>
+    static Pass agent_pass(int radius);
+    template <bool Pow2, bool Wide>
+    static Pass diffuse_pass(int radius);
+    Pass agent_pass() const;
+    Pass diffuse_pass() const;
+
+    template <int Radius, bool Pow2, bool Wide>
+    Texel box_sum(int x, int y, int z) const;
+    template <int Radius, bool Pow2, bool Wide>
+    Texel free_box_sum(int x, int y, int z, int &count) const;
+    template <int Radius, bool Pow2, bool Wide>
+    float sense(const glm::vec3 &position, const glm::vec3 &direction,
+            const Species &s) const;
+    void deposit(const AgentStore &agents, size_t index, float dt);
+    glm::ivec3 voxel_of(const PackedAgent &agent) const;
+    size_t voxel_index(int x, int y, int z) const;
+    glm::uvec4 pack_texel(const Texel &texel) const;
+};
@@ -0,0 +1,231 @@
+#include "distribution.hpp"
+#include <stb_image.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+static const char checkpoint_magic[8] =
+{
+    'P', 'H', 'Y', 'S', 'A', 'G', 'N', 'T',
+};
+
+// Same hash as the shaders
+static unsigned int hash(unsigned int state)
+{
+    state ^= 2747636419u;
+    state *= 2654435769u;
+    state ^= state >> 16;
+    state *= 2654435769u;
+    state ^= state >> 16;
+    state *= 2654435769u;
+    return state;
+}
+
+static float scale_to_unit(unsigned int value)
+{
+    return value / 4294967295.0f;
+}
+
+static glm::vec3 direction(float theta, float phi)
+{
+    return glm::vec3(std::sin(phi) * std::cos(theta),
+            std::sin(phi) * std::sin(theta), std::cos(phi));
+}
+
+Distribution::Distribution()
+    : kind(Sphere), seed(1), image_size(0)
+{}
+
+bool Distribution::parse(const std::string &spec, unsigned int seed,
+        Distribution &result)
+{
+    result = Distribution();
+    result.seed = seed;
+
+    std::string name = spec.substr(0, spec.find(':'));
+    if (name.size() < spec.size())
+    {
+        result.path = spec.substr(name.size() + 1);
+    }
+
+    if (name == "sphere")
+        result.kind = Sphere;
+    else if (name == "shell")
+        result.kind = Shell;
+    else if (name == "uniform")
+        result.kind = Uniform;
+    else if (name == "image" && !result.path.empty())
+        result.kind = Image;
+    else if (name == "checkpoint" && !result.path.empty())
+        result.kind = Checkpoint;
+    else
+        return false;
+
+    return true;
+}
+
+void Distribution::load()
+{
+    if (this->kind == Image)
+    {
+        int width, height, channels;
+        unsigned char *pixels = stbi_load(this->path.c_str(),
+                &width, &height, &channels, 1);
+
+        double total = 0.0;
+        if (pixels)
+        {
+            this->image_size = glm::ivec2(width, height);
+            this->cdf.resize(static_cast<size_t>(width) * height);
+
+            // Rows are stored top down, the volume has y up
+            for (int y = 0; y < height; y++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    total += pixels[x + (height - 1 - y) * width];
+                    this->cdf[x + y * width] = total;
+                }
+            }
+
+            stbi_image_free(pixels);
+        }
+
+        if (total <= 0.0)
+        {
+            std::cout << "Could not load spawn image " << this->path
+                << ", using a sphere\n";
+            this->kind = Sphere;
+            this->cdf.clear();
+            return;
+        }
+
+        for (float &value : this->cdf)
+        {
+            value = static_cast<float>(value / total);
+        }
+    }
+    else if (this->kind == Checkpoint)
+    {
+        std::ifstream file(this->path, std::ios::binary);
+
+        char magic[8];
+        uint64_t count = 0;
+        file.read(magic, sizeof(magic));
+        file.read(reinterpret_cast<char *>(&count), sizeof(count));
+
+        if (file && memcmp(magic, checkpoint_magic, sizeof(magic)) == 0)
+        {
+            this->checkpoint.resize(count);
+            file.read(reinterpret_cast<char *>(this->checkpoint.data()),
+                    count * sizeof(Sample));
+        }
+
+        if (!file || this->checkpoint.empty())
+        {
+            std::cout << "Could not load checkpoint " << this->path
+                << ", using a sphere\n";
+            this->kind = Sphere;
+            this->checkpoint.clear();
+        }
+    }
+}
+
+int Distribution::count(int requested) const
+{
+    return this->kind == Checkpoint ?
+        static_cast<int>(this->checkpoint.size()) : requested;
+}
+
+Distribution::Sample Distribution::sample(unsigned int index, int num_agents,
+        int num_species, const glm::ivec3 &size) const
+{
+    Sample result;
+
+    if (this->kind == Checkpoint)
+    {
+        result = this->checkpoint[index % this->checkpoint.size()];
+        result.species = glm::clamp(result.species, 0, num_species - 1);
+        return result;
+    }
+
+    // Species in contiguous blocks, so the agents start sorted by species
+    result.species = static_cast<int>(index *
+            static_cast<unsigned int>(num_species) /
+            static_cast<unsigned int>(num_agents));
+
+    unsigned int state = hash(this->seed ^ hash(index));
+    float u[6];
+    for (int i = 0; i < 6; i++)
+    {
+        state = hash(state);
+        u[i] = scale_to_unit(state);
+    }
+
+    float maxrad = std::min(size.x, std::min(size.y, size.z)) / 2.0f;
+    glm::vec3 center = glm::vec3(size) / 2.0f;
+    glm::vec3 volume = glm::vec3(size);
+
+    switch (this->kind)
+    {
+        case Sphere:
+        case Shell:
+        {
+            // Headed towards the center
+            float theta = u[0] * 2.0f * glm::pi<float>();
+            float phi = u[1] * 2.0f * glm::pi<float>();
+            float r = this->kind == Sphere ?
+                u[2] * maxrad : (0.9f + 0.1f * u[2]) * maxrad;
+
+            result.position = center + direction(theta, phi) * r;
+            result.theta = theta + glm::pi<float>();
+            result.phi = phi + glm::pi<float>();
+            break;
+        }
+        case Uniform:
+        {
+            result.position = glm::vec3(u[0], u[1], u[2]) * volume;
+            result.theta = u[3] * 2.0f * glm::pi<float>();
+            result.phi = std::acos(1.0f - 2.0f * u[4]);
+            break;
+        }
+        default:
+        {
+            size_t pixel = std::lower_bound(this->cdf.begin(),
+                    this->cdf.end(), u[0]) - this->cdf.begin();
+            pixel = std::min(pixel, this->cdf.size() - 1);
+
+            int px = pixel % this->image_size.x;
+            int py = pixel / this->image_size.x;
+
+            result.position = glm::vec3(
+                    (px + u[1]) / this->image_size.x * volume.x,
+                    (py + u[2]) / this->image_size.y * volume.y,
+                    u[3] * volume.z);
+            result.theta = u[4] * 2.0f * glm::pi<float>();
+            result.phi = std::acos(1.0f - 2.0f * u[5]);
+            break;
+        }
+    }
+
+    result.position -= volume * glm::floor(result.position / volume);
+
+    return result;
+}
+
+bool Distribution::save_checkpoint(const std::string &path,
+        const std::vector<Sample> &samples)
+{
+    std::ofstream file(path, std::ios::binary);
+
+    uint64_t count = samples.size();
+    file.write(checkpoint_magic, sizeof(checkpoint_magic));
+    file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    file.write(reinterpret_cast<const char *>(samples.data()),
+            count * sizeof(Sample));
+
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+// Where the initial agents are placed. Agent i only depends on the seed and
+// on i, so agents can be generated in parallel, in any order, on the CPU or
+// in init.comp, which mirrors sample().
+class Distribution
+{
+public:
+    enum Kind
+    {
+        Sphere,
+        Shell,
+        Uniform,
+        Image,
+        Checkpoint,
+    };
+
+    struct Sample
+    {
+        glm::vec3 position;
+        float theta;
+        float phi;
+        int species;
+    };
+
+    Kind kind;
+    unsigned int seed;
+    std::string path;
+
+    // Image: cumulative pixel weights in row order, normalized to end at 1.
+    // Agents are placed in x and y by the image, uniformly in z.
+    std::vector<float> cdf;
+    glm::ivec2 image_size;
+
+    std::vector<Sample> checkpoint;
+
+public:
+    Distribution();
+
+    // One of sphere, shell, uniform, image:<path> or checkpoint:<path>
+    static bool parse(const std::string &spec, unsigned int seed,
+            Distribution &result);
+
+    // Reads the image or checkpoint. Falls back to a sphere on failure.
+    void load();
+
+    // Checkpoints fix the number of agents
+    int count(int requested) const;
+
+    Sample sample(unsigned int index, int num_agents, int num_species,
+            const glm::ivec3 &size) const;
+
+    static bool save_checkpoint(const std::string &path,
+            const std::vector<Sample> &samples);
+};
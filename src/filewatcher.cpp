@@ -0,0 +1,67 @@
+#include "filewatcher.hpp"
+#include <algorithm>
+#include <iostream>
+
+#if defined(__linux__)
+#    include <sys/inotify.h>
+#    include <unistd.h>
+#endif
+
+FileWatcher::FileWatcher(const std::string &directory)
+    : directory(directory), fd(-1)
+{
+#if defined(__linux__)
+    this->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    // Editors either write in place or rename a new file over the old one
+    if (this->fd < 0 || inotify_add_watch(this->fd, directory.c_str(),
+                IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        std::cout << "Could not watch " << directory << "\n";
+    }
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+#if defined(__linux__)
+    if (this->fd >= 0)
+    {
+        close(this->fd);
+    }
+#endif
+}
+
+std::vector<std::string> FileWatcher::poll()
+{
+    std::vector<std::string> paths;
+
+#if defined(__linux__)
+    alignas(inotify_event) char buffer[4096];
+
+    ssize_t length;
+    while (this->fd >= 0 &&
+            (length = read(this->fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (ssize_t offset = 0; offset < length; )
+        {
+            const inotify_event *event =
+                reinterpret_cast<const inotify_event *>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+
+            if (event->len == 0)
+            {
+                continue;
+            }
+
+            std::string path = this->directory + "/" + event->name;
+            if (std::find(paths.begin(), paths.end(), path) == paths.end())
+            {
+                paths.push_back(path);
+            }
+        }
+    }
+#endif
+
+    return paths;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Reports the files in a directory that were written or replaced since the
+// last poll, using inotify. Other platforms never report changes.
+class FileWatcher
+{
+private:
+    std::string directory;
+    int fd;
+
+public:
+    FileWatcher(const std::string &directory);
+    ~FileWatcher();
+
+    // Paths of the changed files, as the directory joined with the name
+    std::vector<std::string> poll();
+};
@@ -0,0 +1,434 @@
+#include "isosurface.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include "numa.hpp"
+
+// Corners of a brick along each axis, its cells and the border before
+static const int corners = Isosurface::brick_size + 1;
+
+// Cube corners are indexed by x + 2 y + 4 z. Edge e runs along axis e / 4
+// from the corner whose other two coordinates are the bits of e % 4.
+static int edge_start(int edge)
+{
+    int axis = edge / 4;
+    int u = (axis + 1) % 3;
+    int v = (axis + 2) % 3;
+    return ((edge & 1) << u) | (((edge >> 1) & 1) << v);
+}
+
+static int edge_between(int a, int b)
+{
+    int axis = (a ^ b) == 1 ? 0 : (a ^ b) == 2 ? 1 : 2;
+    int start = std::min(a, b);
+    int u = (axis + 1) % 3;
+    int v = (axis + 2) % 3;
+    return axis * 4 + ((start >> u) & 1) + 2 * ((start >> v) & 1);
+}
+
+// Whether both edges lie on one face of the cube
+static bool share_face(int a, int b)
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (a / 4 != axis && b / 4 != axis &&
+                (edge_start(a) >> axis & 1) == (edge_start(b) >> axis & 1))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Whether the diagonals of a fan from start all run through the cube
+static bool fan_inside(const std::vector<int> &polygon, int start)
+{
+    int n = polygon.size();
+    for (int i = 2; i < n - 1; i++)
+    {
+        if (share_face(polygon[start], polygon[(start + i) % n]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static glm::ivec3 corner_offset(int corner)
+{
+    return glm::ivec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1);
+}
+
+// Edges of the triangles of every corner configuration, three per triangle.
+// The table is traced from the faces of the cube: on every face, crossings
+// are joined so inside corners that only touch diagonally stay apart,
+// which neighbouring cubes agree on, so the surface has no holes. Joined
+// around the cube, the face segments form polygons that are fanned into
+// triangles facing away from the inside. The fan starts where none of its
+// diagonals lie on a face, which would overlap the neighbouring cube.
+struct TriangleTable
+{
+    std::vector<int> edges[256];
+};
+
+static TriangleTable build_triangle_table()
+{
+    TriangleTable table;
+    for (int config = 1; config < 255; config++)
+    {
+        // Every crossed edge is entered on one face and left on the other,
+        // so following them walks the polygons
+        int next[12];
+        std::fill(next, next + 12, -1);
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            int u = (axis + 1) % 3;
+            int v = (axis + 2) % 3;
+            for (int side = 0; side < 2; side++)
+            {
+                // The same turn around every face, seen from outside
+                int cycle[4] = {0, 1 << u, (1 << u) | (1 << v), 1 << v};
+                for (int &corner : cycle)
+                {
+                    corner |= side << axis;
+                }
+                if (side == 0)
+                {
+                    std::swap(cycle[1], cycle[3]);
+                }
+
+                for (int i = 0; i < 4; i++)
+                {
+                    int a = cycle[i];
+                    int b = cycle[(i + 1) % 4];
+                    if ((config >> a & 1) || !(config >> b & 1))
+                    {
+                        continue;
+                    }
+
+                    // Entered at a to b, left at the first crossing out
+                    for (int j = i + 1; j < i + 4; j++)
+                    {
+                        int c = cycle[j % 4];
+                        int d = cycle[(j + 1) % 4];
+                        if ((config >> c & 1) && !(config >> d & 1))
+                        {
+                            next[edge_between(a, b)] = edge_between(c, d);
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        bool visited[12] = {};
+        for (int edge = 0; edge < 12; edge++)
+        {
+            if (next[edge] < 0 || visited[edge])
+            {
+                continue;
+            }
+
+            std::vector<int> polygon;
+            for (int e = edge; !visited[e]; e = next[e])
+            {
+                visited[e] = true;
+                polygon.push_back(e);
+            }
+
+            int n = polygon.size();
+            int start = 0;
+            while (start + 1 < n && !fan_inside(polygon, start))
+            {
+                start++;
+            }
+
+            for (int i = 1; i + 1 < n; i++)
+            {
+                table.edges[config].push_back(polygon[start]);
+                table.edges[config].push_back(polygon[(start + i) % n]);
+                table.edges[config].push_back(polygon[(start + i + 1) % n]);
+            }
+        }
+    }
+
+    // The turn of the faces decides the winding. Check it on the corner
+    // alone inside, whose triangle should face away from it.
+    glm::vec3 points[3];
+    for (int i = 0; i < 3; i++)
+    {
+        int edge = table.edges[1][i];
+        points[i] = glm::vec3(corner_offset(edge_start(edge))) +
+            0.5f * glm::vec3(corner_offset(1 << (edge / 4)));
+    }
+
+    glm::vec3 normal = glm::cross(points[1] - points[0],
+            points[2] - points[0]);
+    if (glm::dot(normal, glm::vec3(1.0f)) < 0.0f)
+    {
+        for (std::vector<int> &edges : table.edges)
+        {
+            for (size_t i = 0; i < edges.size(); i += 3)
+            {
+                std::swap(edges[i + 1], edges[i + 2]);
+            }
+        }
+    }
+
+    return table;
+}
+
+static const TriangleTable &triangle_table()
+{
+    static const TriangleTable table = build_triangle_table();
+    return table;
+}
+
+static int sample_index(int x, int y, int z)
+{
+    return x + corners * (y + corners * z);
+}
+
+Isosurface::Isosurface()
+    : size(0), bricks_size(0), extracted_level(0.0f), tolerance(0.02f)
+{
+    std::vector<int> cpus;
+    for (const std::vector<int> &node : Numa::node_cpus())
+    {
+        cpus.insert(cpus.end(), node.begin(), node.end());
+    }
+
+    this->pool.reset(new WorkerPool(cpus));
+}
+
+int Isosurface::extract(const std::vector<float> &density,
+        const glm::ivec3 &size, float level)
+{
+    bool all = size != this->size || level != this->extracted_level;
+    if (size != this->size)
+    {
+        set_size(size);
+    }
+    this->extracted_level = level;
+
+    int num_bricks = this->bricks.size();
+    int num_workers = this->pool->size();
+    std::vector<int> extracted(num_workers, 0);
+
+    this->pool->run([this, &density, level, all, num_bricks, num_workers,
+            &extracted](int index)
+            {
+                std::vector<float> samples;
+                std::vector<int> edge_vertices;
+                for (int i = index; i < num_bricks; i += num_workers)
+                {
+                    glm::ivec3 brick(i % this->bricks_size.x,
+                            (i / this->bricks_size.x) % this->bricks_size.y,
+                            i / (this->bricks_size.x * this->bricks_size.y));
+                    if (!sample(density, brick, samples) && !all)
+                    {
+                        continue;
+                    }
+
+                    this->bricks[i].samples.swap(samples);
+                    march(this->bricks[i], brick * brick_size, level,
+                            edge_vertices);
+                    extracted[index]++;
+                }
+            });
+
+    int total = 0;
+    for (int count : extracted)
+    {
+        total += count;
+    }
+
+    return total;
+}
+
+void Isosurface::gather(std::vector<Mesh::Vertex> &vertices,
+        std::vector<unsigned int> &indices) const
+{
+    size_t num_vertices = 0;
+    size_t num_indices = 0;
+    for (const Brick &brick : this->bricks)
+    {
+        num_vertices += brick.vertices.size();
+        num_indices += brick.indices.size();
+    }
+
+    vertices.clear();
+    indices.clear();
+    vertices.reserve(num_vertices);
+    indices.reserve(num_indices);
+
+    for (const Brick &brick : this->bricks)
+    {
+        unsigned int offset = vertices.size();
+        vertices.insert(vertices.end(), brick.vertices.begin(),
+                brick.vertices.end());
+        for (unsigned int index : brick.indices)
+        {
+            indices.push_back(offset + index);
+        }
+    }
+}
+
+bool Isosurface::write_obj(const std::string &path) const
+{
+    std::vector<Mesh::Vertex> vertices;
+    std::vector<unsigned int> indices;
+    gather(vertices, indices);
+
+    std::ofstream out(path);
+    for (const Mesh::Vertex &vertex : vertices)
+    {
+        const glm::vec3 &p = vertex.position;
+        out << "v " << p.x << " " << p.y << " " << p.z << "\n";
+    }
+
+    // Indices start at one
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        out << "f " << indices[i] + 1 << " " << indices[i + 1] + 1 << " "
+            << indices[i + 2] + 1 << "\n";
+    }
+
+    return static_cast<bool>(out);
+}
+
+bool Isosurface::write_ply(const std::string &path) const
+{
+    std::vector<Mesh::Vertex> vertices;
+    std::vector<unsigned int> indices;
+    gather(vertices, indices);
+
+    std::ofstream out(path, std::ios::binary);
+    out << "ply\nformat binary_little_endian 1.0\n"
+        << "element vertex " << vertices.size() << "\n"
+        << "property float x\nproperty float y\nproperty float z\n"
+        << "element face " << indices.size() / 3 << "\n"
+        << "property list uchar uint vertex_indices\nend_header\n";
+
+    for (const Mesh::Vertex &vertex : vertices)
+    {
+        out.write(reinterpret_cast<const char *>(&vertex.position),
+                sizeof(glm::vec3));
+    }
+
+    const unsigned char count = 3;
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        out.write(reinterpret_cast<const char *>(&count), 1);
+        out.write(reinterpret_cast<const char *>(&indices[i]),
+                3 * sizeof(unsigned int));
+    }
+
+    return static_cast<bool>(out);
+}
+
+void Isosurface::set_size(const glm::ivec3 &size)
+{
+    // Cells run from the border before the first voxel to the one after
+    // the last, one more than the voxels
+    this->size = size;
+    this->bricks_size = (size + brick_size) / brick_size;
+    this->bricks.assign(static_cast<size_t>(this->bricks_size.x) *
+            this->bricks_size.y * this->bricks_size.z, Brick());
+}
+
+bool Isosurface::sample(const std::vector<float> &density,
+        const glm::ivec3 &brick, std::vector<float> &samples) const
+{
+    const Brick &previous = this->bricks[brick.x + this->bricks_size.x *
+        (brick.y + this->bricks_size.y * brick.z)];
+    bool changed = previous.samples.empty();
+
+    samples.resize(corners * corners * corners);
+    glm::ivec3 first = brick * brick_size - 1;
+    for (int z = 0; z < corners; z++)
+    {
+        for (int y = 0; y < corners; y++)
+        {
+            for (int x = 0; x < corners; x++)
+            {
+                glm::ivec3 voxel = first + glm::ivec3(x, y, z);
+                bool inside = voxel.x >= 0 && voxel.y >= 0 &&
+                    voxel.z >= 0 && voxel.x < this->size.x &&
+                    voxel.y < this->size.y && voxel.z < this->size.z;
+
+                int index = sample_index(x, y, z);
+                samples[index] = inside ? density[voxel.x + this->size.x *
+                    (voxel.y + static_cast<size_t>(this->size.y) * voxel.z)] :
+                    0.0f;
+
+                changed = changed || std::abs(samples[index] -
+                        previous.samples[index]) > this->tolerance;
+            }
+        }
+    }
+
+    return changed;
+}
+
+void Isosurface::march(Brick &brick, const glm::ivec3 &origin, float level,
+        std::vector<int> &edge_vertices) const
+{
+    const TriangleTable &table = triangle_table();
+
+    brick.vertices.clear();
+    brick.indices.clear();
+
+    // Vertex on the edge along each axis from every corner, or -1
+    edge_vertices.assign(3 * corners * corners * corners, -1);
+
+    glm::ivec3 cells = glm::min(glm::ivec3(brick_size),
+            this->size + 1 - origin);
+    for (int z = 0; z < cells.z; z++)
+    {
+        for (int y = 0; y < cells.y; y++)
+        {
+            for (int x = 0; x < cells.x; x++)
+            {
+                int config = 0;
+                for (int corner = 0; corner < 8; corner++)
+                {
+                    int index = sample_index(x + (corner & 1),
+                            y + ((corner >> 1) & 1), z + (corner >> 2));
+                    config |= (brick.samples[index] > level) << corner;
+                }
+
+                for (int edge : table.edges[config])
+                {
+                    int axis = edge / 4;
+                    glm::ivec3 start = corner_offset(edge_start(edge));
+                    int a = sample_index(x + start.x, y + start.y,
+                            z + start.z);
+                    int &vertex = edge_vertices[3 * a + axis];
+                    if (vertex < 0)
+                    {
+                        // Corners sit at voxel centers, and the first one
+                        // at the border before the brick
+                        int b = a + (axis == 0 ? 1 : axis == 1 ?
+                                corners : corners * corners);
+                        float t = (level - brick.samples[a]) /
+                            (brick.samples[b] - brick.samples[a]);
+
+                        glm::vec3 position = glm::vec3(origin - 1 + start +
+                                glm::ivec3(x, y, z)) + 0.5f;
+                        position[axis] += t;
+
+                        vertex = brick.vertices.size();
+                        brick.vertices.push_back(
+                                {position, glm::vec2(0.0f)});
+                    }
+
+                    brick.indices.push_back(vertex);
+                }
+            }
+        }
+    }
+}
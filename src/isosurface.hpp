@@ -0,0 +1,69 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+#include "mesh.hpp"
+#include "trailedit.hpp"
+#include "workerpool.hpp"
+
+// Triangle mesh of the trail density at an iso level, for preview and
+// export. Marching cubes runs per brick of the volume on a worker pool, and
+// bricks whose density has not changed since they were last extracted keep
+// their triangles. The density is zero outside the volume, so surfaces are
+// closed at the borders. Positions are in voxels.
+class Isosurface
+{
+public:
+    static const int brick_size = TrailEdit::brick_size;
+
+private:
+    struct Brick
+    {
+        // Density at the corners of the cells, which reach one voxel into
+        // the brick before
+        std::vector<float> samples;
+
+        // Vertices on the edges shared by cells of the brick are shared,
+        // those on the brick borders are not
+        std::vector<Mesh::Vertex> vertices;
+        std::vector<unsigned int> indices;
+    };
+
+    glm::ivec3 size;
+    glm::ivec3 bricks_size;
+    float extracted_level;
+    std::vector<Brick> bricks;
+
+    std::unique_ptr<WorkerPool> pool;
+
+public:
+    // Bricks are extracted again once any sample changed more than this
+    float tolerance;
+
+public:
+    Isosurface();
+
+    // Extracts the bricks that changed and returns how many did. The
+    // density is one float per voxel, in x, then y, then z order.
+    int extract(const std::vector<float> &density, const glm::ivec3 &size,
+            float level);
+
+    // Joins the bricks into one indexed mesh
+    void gather(std::vector<Mesh::Vertex> &vertices,
+            std::vector<unsigned int> &indices) const;
+
+    bool write_obj(const std::string &path) const;
+    bool write_ply(const std::string &path) const;
+
+private:
+    void set_size(const glm::ivec3 &size);
+
+    // Reads the samples of a brick and reports whether they differ from
+    // those it was extracted from
+    bool sample(const std::vector<float> &density, const glm::ivec3 &brick,
+            std::vector<float> &samples) const;
+
+    void march(Brick &brick, const glm::ivec3 &origin, float level,
+            std::vector<int> &edge_vertices) const;
+};
@@ -1,23 +1,130 @@
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <imgui.h>
 #include "graphics.hpp"
 #include "shader.hpp"
 #include "slimesimulator.hpp"
+#include "cpusimulator.hpp"
+#include "benchmark.hpp"
 #include "calc.hpp"
 #include "timer.hpp"
 #include "mesh.hpp"
 #include "camera.hpp"
+#include "brush.hpp"
+#include "distribution.hpp"
+#include "obstacles.hpp"
+#include "filewatcher.hpp"
+#include "sweep.hpp"
+#include "metrics.hpp"
+#include "skeleton.hpp"
+#include "isosurface.hpp"
+#include "agentrenderer.hpp"
+#include "transferfunction.hpp"
+#include "transport.hpp"
 
-int main()
+#ifndef _WIN32
+#    include <unistd.h>
+#    include <sys/wait.h>
+#endif
+
+int main(int argc, char **argv)
 {
+    int num_ranks = 1;
+    int benchmark_steps = 0;
+    int num_species = 1;
+    bool use_cpu = false;
+    std::string init_spec = "sphere";
+    std::string obstacles_spec;
+    unsigned int seed = 1;
+    std::string sweep_path;
+    int metrics_interval = 0;
+    int coarse_diffusion = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--cpu")
+        {
+            use_cpu = true;
+        }
+        else if (arg == "--ranks" && i + 1 < argc)
+        {
+            num_ranks = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--species" && i + 1 < argc)
+        {
+            num_species = std::atoi(argv[++i]);
+        }
+        else if (arg == "--init" && i + 1 < argc)
+        {
+            init_spec = argv[++i];
+        }
+        else if (arg == "--obstacles" && i + 1 < argc)
+        {
+            obstacles_spec = argv[++i];
+        }
+        else if (arg == "--seed" && i + 1 < argc)
+        {
+            seed = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--benchmark" && i + 1 < argc)
+        {
+            benchmark_steps = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--sweep" && i + 1 < argc)
+        {
+            sweep_path = argv[++i];
+        }
+        else if (arg == "--metrics" && i + 1 < argc)
+        {
+            metrics_interval = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--coarse-diffusion" && i + 1 < argc)
+        {
+            coarse_diffusion = std::max(1, std::atoi(argv[++i]));
+        }
+    }
+
+    if (use_cpu || !sweep_path.empty())
+    {
+        num_ranks = 1;
+    }
+
+    // Ranks are forked before any GLFW or GL state exists. Every rank
+    // simulates a 100 layer slab of the volume, only rank 0 is shown.
+    int rank = 0;
+    std::string session;
+#ifndef _WIN32
+    session = std::to_string(getpid());
+    for (int i = 1; i < num_ranks; i++)
+    {
+        if (fork() == 0)
+        {
+            rank = i;
+            break;
+        }
+    }
+#else
+    num_ranks = 1;
+#endif
+
     if (!glfwInit())
     {
         std::cout << "Could not initialize GLFW\n";
         return EXIT_FAILURE;
     }
 
+    if (rank > 0 || benchmark_steps || !sweep_path.empty())
+    {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    }
+
     GLFWwindow *window = glfwCreateWindow(960, 540,
             "Slime Simulator", NULL, NULL);
     if (!window)
@@ -32,13 +139,215 @@ int main()
 
     Graphics::initialize(window);
 
+    glm::ivec3 volume_size(100, 100, 100 * num_ranks);
+
+    Distribution distribution;
+    if (!Distribution::parse(init_spec, seed, distribution))
+    {
+        std::cout << "Unknown distribution " << init_spec
+            << ", using a sphere\n";
+    }
+    distribution.load();
+
+    int num_agents = distribution.count(1000000 * num_ranks);
+
+    if (!sweep_path.empty())
+    {
+        // Small instances, all advanced by the same dispatches
+        std::vector<Sweep::Parameters> parameters;
+        bool swept = false;
+        if (Sweep::load_parameters(sweep_path, parameters))
+        {
+            Sweep sweep(glm::ivec3(64), 100000, parameters, distribution);
+            swept = sweep.valid();
+            if (swept)
+            {
+                sweep.run(benchmark_steps ? benchmark_steps : 1000,
+                        "sweep.csv");
+            }
+            else
+            {
+                std::cout << "Could not build the sweep shaders\n";
+            }
+        }
+        else
+        {
+            std::cout << "Could not read sweep parameters from "
+                << sweep_path << "\n";
+        }
+
+        Graphics::shutdown();
+        glfwTerminate();
+
+        return swept ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Programs compile on driver threads meanwhile, warm starts load them
+    // from the binary cache instead
     RenderShader render_shader("assets/shaders/render.vert",
             "assets/shaders/render.frag");
-    assert(render_shader.valid());
+    RenderShader surface_shader("assets/shaders/surface.vert",
+            "assets/shaders/surface.frag");
+    AgentRenderer agent_renderer;
+    if (!use_cpu)
+    {
+        SlimeSimulator::preload_shaders(volume_size, num_agents,
+                num_species);
+    }
+
+    if (rank == 0 && !benchmark_steps)
+    {
+        while (!(render_shader.ready() && surface_shader.ready() &&
+                    agent_renderer.ready() && Shader::preloaded_ready()) &&
+                !glfwWindowShouldClose(window))
+        {
+            Graphics::begin_frame();
+            ImGui::Begin("Loading");
+            ImGui::Text("Compiling shaders...");
+            ImGui::End();
+            Graphics::end_frame();
 
-    glm::ivec3 volume_size(100, 100, 100);
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+        }
+    }
 
-    SlimeSimulator simulator(1000000, volume_size);
+    // Every program is checked, so all failed builds print their logs
+    bool shaders_built = render_shader.valid();
+    shaders_built = surface_shader.valid() && shaders_built;
+    shaders_built = agent_renderer.valid() && shaders_built;
+    if (!shaders_built)
+    {
+        std::cout << "Could not build the shaders\n";
+        Graphics::shutdown();
+        glfwTerminate();
+        return EXIT_FAILURE;
+    }
+
+    std::unique_ptr<SocketTransport> transport;
+    if (num_ranks > 1)
+    {
+        transport.reset(new SocketTransport(rank, num_ranks, session));
+        if (!transport->valid())
+        {
+            std::cout << "Could not connect rank " << rank << "\n";
+            glfwTerminate();
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Made again from the same start for reference runs
+    std::unique_ptr<Simulator> simulator;
+    SlimeSimulator *gpu_simulator = nullptr;
+    auto create_simulator = [&]()
+    {
+        simulator.reset();
+        if (use_cpu)
+        {
+            simulator.reset(new CpuSimulator(num_agents, volume_size,
+                        distribution, num_species));
+        }
+        else
+        {
+            gpu_simulator = new SlimeSimulator(num_agents, volume_size,
+                    distribution, transport.get(), num_species);
+            simulator.reset(gpu_simulator);
+        }
+    };
+    create_simulator();
+
+    if (gpu_simulator && !gpu_simulator->valid())
+    {
+        std::cout << "Could not create the GPU simulator\n";
+        simulator.reset();
+        transport.reset();
+        Graphics::shutdown();
+        glfwTerminate();
+        return EXIT_FAILURE;
+    }
+
+    if (rank > 0)
+    {
+        // Steps are driven by rank 0 until it closes its connection
+        while (gpu_simulator->follow());
+
+        simulator.reset();
+        transport.reset();
+        Graphics::shutdown();
+        glfwTerminate();
+
+        return EXIT_SUCCESS;
+    }
+
+    // Voxelized again whenever the volume is resized
+    auto apply_obstacles = [&]()
+    {
+        if (obstacles_spec.empty())
+        {
+            return;
+        }
+
+        Obstacles obstacles;
+        if (!Obstacles::parse(obstacles_spec, obstacles))
+        {
+            std::cout << "Unknown obstacles " << obstacles_spec << "\n";
+        }
+        else if (obstacles.load(volume_size) &&
+                !simulator->set_obstacles(obstacles))
+        {
+            std::cout << "Obstacles need a single process holding the "
+                "whole volume\n";
+        }
+    };
+    apply_obstacles();
+
+    if (coarse_diffusion > 1 &&
+            !simulator->set_coarse_diffusion(coarse_diffusion))
+    {
+        std::cout << "Coarse diffusion needs a factor of 2 or 4 that "
+            "divides the volume, the GPU simulator in a single process and "
+            "no obstacles\n";
+        coarse_diffusion = 1;
+    }
+
+    if (benchmark_steps)
+    {
+        if (coarse_diffusion > 1)
+        {
+            // Compared with diffusion at full resolution, run first from
+            // the same start. Obstacles rule out coarse diffusion, so there
+            // are none to apply again.
+            simulator->set_coarse_diffusion(1);
+            Benchmark::Measurement reference = Benchmark::measure(
+                    *simulator, benchmark_steps);
+
+            create_simulator();
+            simulator->set_coarse_diffusion(coarse_diffusion);
+            Benchmark::Measurement measurement = Benchmark::measure(
+                    *simulator, benchmark_steps);
+
+            Benchmark::write_comparison(*simulator, "gpu",
+                    "coarse_diffusion_" + std::to_string(coarse_diffusion),
+                    num_agents, benchmark_steps, measurement, reference,
+                    "benchmark.json");
+        }
+        else
+        {
+            Benchmark::run(*simulator, use_cpu ? "cpu" : "gpu", num_agents,
+                    benchmark_steps, "benchmark.json");
+        }
+
+        simulator.reset();
+        transport.reset();
+        Graphics::shutdown();
+        glfwTerminate();
+
+#ifndef _WIN32
+        while (wait(NULL) > 0);
+#endif
+
+        return EXIT_SUCCESS;
+    }
 
     Graphics::set_aspect(1920, 1080);
 
@@ -51,11 +360,65 @@ int main()
     Mesh cube = Mesh::cube(glm::vec3(0.0f), 2.0f);
     glm::mat4 cube_rotation = glm::mat4(1.0f);
 
+    // Applied from the Domain window, so scaling runs keep the process
+    glm::ivec3 requested_size = volume_size;
+    int requested_agents = num_agents;
+
     bool run_simulation = false;
     bool space_down = false;
 
     const float rotation_speed = 1.0f;
 
+    // Applied where the cursor ray enters the volume while the left mouse
+    // button is held
+    Brush brush;
+
+    // Baked into the pre-integrated table read by render.frag
+    TransferFunction transfer_function;
+
+    // Shaders edited in the source tree are rebuilt in the background and
+    // swapped in once they link, keeping the simulation running
+    FileWatcher shader_watcher(Shader::source_path("assets/shaders"));
+
+    // Computed on the simulator, only the results are read back
+    MetricsLog metrics_log("metrics.csv", metrics_interval);
+
+    // Created on the first export, so its threads only exist when used
+    std::unique_ptr<Skeleton> skeleton;
+    const std::string graph_path = "network.graphml";
+
+    // Extracted every frame while shown, but only where the trail changed
+    std::unique_ptr<Isosurface> isosurface;
+    std::unique_ptr<Mesh> surface_mesh;
+    bool show_surface = false;
+    float surface_level = 0.5f;
+    float surface_tolerance = 0.02f;
+    int extracted_bricks = 0;
+    std::vector<Mesh::Vertex> surface_vertices;
+    std::vector<unsigned int> surface_indices;
+    std::vector<float> density;
+
+    auto extract_surface = [&]()
+    {
+        if (!simulator->trail_density(density, surface_tolerance))
+        {
+            return false;
+        }
+
+        if (!isosurface)
+        {
+            isosurface.reset(new Isosurface());
+        }
+
+        isosurface->tolerance = surface_tolerance;
+        extracted_bricks = isosurface->extract(density,
+                simulator->trail_size(), surface_level);
+        return true;
+    };
+
+    // Restored with --init checkpoint:<path>
+    const std::string checkpoint_path = "checkpoint.agents";
+
     while (!glfwWindowShouldClose(window))
     {
         float dt = frame_timer.delta();
@@ -77,24 +440,226 @@ int main()
 
         space_down = new_space_down;
 
+        Shader::reload_files(shader_watcher.poll());
+        Shader::update_reloads();
+
         Graphics::begin_frame();
-        simulator.update_debug_window();
+        simulator->update_debug_window();
+
+        std::vector<std::string> shader_errors = Shader::build_errors();
+        if (!shader_errors.empty())
+        {
+            ImGui::Begin("Shader Errors");
+            for (const std::string &error : shader_errors)
+            {
+                ImGui::TextWrapped("%s", error.c_str());
+            }
+            ImGui::End();
+        }
+
+        brush.update_debug_window(simulator->species_colors().size());
+        metrics_log.update_debug_window();
+        transfer_function.update_debug_window();
+        agent_renderer.update_debug_window();
+
+        ImGui::Begin("Checkpoint");
+        if (ImGui::Button("Save Agents"))
+        {
+            std::cout << (simulator->save_checkpoint(checkpoint_path) ?
+                    "Saved agents to " : "Could not save agents to ")
+                << checkpoint_path << "\n";
+        }
+        ImGui::End();
+
+        ImGui::Begin("Network");
+        if (ImGui::Button("Export Graph"))
+        {
+            auto start = std::chrono::steady_clock::now();
+
+            std::vector<unsigned char> mask;
+            if (simulator->occupancy_mask(metrics_log.threshold, mask))
+            {
+                if (!skeleton)
+                {
+                    skeleton.reset(new Skeleton());
+                }
+
+                glm::ivec3 size = simulator->trail_size();
+                std::vector<unsigned char> thinned = mask;
+                skeleton->thin(thinned, size);
+                Skeleton::Graph graph = skeleton->extract_graph(thinned,
+                        mask, size);
+
+                double seconds = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start).count();
+                std::cout << (graph.write_graphml(graph_path) ?
+                        "Exported " : "Could not export ")
+                    << graph.nodes.size() << " nodes and "
+                    << graph.edges.size() << " edges to " << graph_path
+                    << " in " << seconds << " s\n";
+            }
+            else
+            {
+                std::cout << "The trail is not available for export\n";
+            }
+        }
+        ImGui::End();
+
+        ImGui::Begin("Domain");
+        ImGui::DragInt3("Volume Size", &requested_size.x, 1.0f, 8, 2048);
+        ImGui::DragInt("Agents", &requested_agents, 1000.0f, 0, 100000000);
+        if (ImGui::Button("Halve"))
+        {
+            requested_agents /= 2;
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Double"))
+        {
+            requested_agents = std::min(2 * requested_agents, 100000000);
+        }
+        if (ImGui::Button("Apply"))
+        {
+            requested_size = glm::max(requested_size, glm::ivec3(8));
+            requested_agents = std::max(requested_agents, 0);
+            if (simulator->resize(requested_agents, requested_size))
+            {
+                volume_size = requested_size;
+                apply_obstacles();
+            }
+            else
+            {
+                std::cout << "Could not resize to " << requested_size.x
+                    << "x" << requested_size.y << "x" << requested_size.z
+                    << " with " << requested_agents << " agents\n";
+                requested_size = volume_size;
+            }
+        }
+        ImGui::End();
+
+        ImGui::Begin("Isosurface");
+        ImGui::Checkbox("Show", &show_surface);
+        ImGui::DragFloat("Level", &surface_level, 0.01f, 0.0f, 8.0f);
+        ImGui::DragFloat("Tolerance", &surface_tolerance, 0.001f, 0.0f,
+                1.0f);
+        if (show_surface && surface_mesh)
+        {
+            ImGui::Text("%zu vertices, %zu triangles, %d bricks extracted",
+                    surface_vertices.size(), surface_indices.size() / 3,
+                    extracted_bricks);
+        }
+
+        bool export_obj = ImGui::Button("Export OBJ");
+        ImGui::SameLine();
+        bool export_ply = ImGui::Button("Export PLY");
+        if (export_obj || export_ply)
+        {
+            std::string path = export_obj ? "isosurface.obj" :
+                "isosurface.ply";
+            if (extract_surface())
+            {
+                bool written = export_obj ? isosurface->write_obj(path) :
+                    isosurface->write_ply(path);
+                std::cout << (written ? "Exported isosurface to " :
+                        "Could not export isosurface to ") << path << "\n";
+            }
+            else
+            {
+                std::cout << "The trail is not available for export\n";
+            }
+        }
+        ImGui::End();
+
+        bool brush_down = glfwGetMouseButton(window,
+                GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS &&
+            !ImGui::GetIO().WantCaptureMouse;
+        if (brush_down)
+        {
+            brush.drag(camera.ray_from_cursor(), cube_rotation, volume_size);
+        }
+        else
+        {
+            brush.release();
+        }
+
+        brush.apply(*simulator, dt);
 
 
         if (run_simulation)
         {
-            simulator.update(dt);
+            simulator->update(dt);
+            metrics_log.step(*simulator);
         }
 
-        render_shader.bind();
-        render_shader.set_mat4("model", cube_rotation);
-        render_shader.set_mat4("view_projection", camera.matrix());
-        render_shader.set_ivec3("volume_size", volume_size);
+        if (show_surface && !extract_surface())
+        {
+            std::cout << "The trail is not available for the isosurface\n";
+            show_surface = false;
+        }
 
-        glBindTextureUnit(0, simulator.trail()->get_id());
+        if (show_surface)
+        {
+            if (!surface_mesh)
+            {
+                isosurface->gather(surface_vertices, surface_indices);
+                surface_mesh.reset(new Mesh(surface_vertices,
+                            surface_indices));
+            }
+            else if (extracted_bricks > 0)
+            {
+                isosurface->gather(surface_vertices, surface_indices);
+                surface_mesh->update(surface_vertices, surface_indices);
+            }
 
-        // quad.render();
-        cube.render();
+            surface_shader.bind();
+            surface_shader.set_mat4("model", cube_rotation);
+            surface_shader.set_mat4("view_projection", camera.matrix());
+            surface_shader.set_ivec3("volume_size",
+                    simulator->trail_size());
+            surface_shader.set_vec4("surface_color",
+                    glm::vec4(0.9f, 0.8f, 0.4f, 1.0f));
+            surface_mesh->render();
+        }
+
+        if (agent_renderer.show &&
+                !agent_renderer.render(*simulator, cube_rotation, camera))
+        {
+            std::cout << "The agents are not available for drawing\n";
+            agent_renderer.show = false;
+        }
+
+        if (!show_surface && !agent_renderer.show)
+        {
+            render_shader.bind();
+            render_shader.set_mat4("model", cube_rotation);
+            render_shader.set_mat4("view_projection", camera.matrix());
+            // Out-of-core volumes are drawn from a smaller preview
+            render_shader.set_ivec3("volume_size",
+                    simulator->trail()->get_size());
+            render_shader.set_vec3("camera_position",
+                    glm::vec3(glm::inverse(cube_rotation) *
+                        glm::vec4(camera.get_position(), 1.0f)));
+            render_shader.set_float("max_density",
+                    transfer_function.max_density);
+            render_shader.set_float("max_step", transfer_function.max_step);
+            render_shader.set_float("adaptivity",
+                    transfer_function.adaptivity);
+
+            std::vector<glm::vec4> colors = simulator->species_colors();
+            for (int i = 0; i < Species::max_count; i++)
+            {
+                std::string name = "species_colors[" + std::to_string(i) +
+                    "]";
+                render_shader.set_vec4(name,
+                        i < static_cast<int>(colors.size()) ?
+                        colors[i] : glm::vec4(0.0f));
+            }
+
+            glBindTextureUnit(0, simulator->trail()->get_id());
+            transfer_function.bind_to_unit(1);
+
+            // quad.render();
+            cube.render();
+        }
 
         Graphics::end_frame();
 
@@ -107,5 +672,10 @@ int main()
     Graphics::shutdown();
     glfwTerminate();
 
+#ifndef _WIN32
+    transport.reset();
+    while (wait(NULL) > 0);
+#endif
+
     return EXIT_SUCCESS;
 }
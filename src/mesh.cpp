@@ -3,38 +3,113 @@
 #include <glad/glad.h>
 
 Mesh::Mesh(const std::vector<Vertex> &vertices)
+    : ebo(0), num_indices(0)
 {
     this->num_vertices = vertices.size();
 
-    glCreateVertexArrays(1, &this->vao);
-    glCreateBuffers(1, &this->vbo);
+    create_vertex_array();
     glNamedBufferData(this->vbo, sizeof(Vertex) * this->num_vertices,
             vertices.data(), GL_STATIC_COPY);
+}
 
-    glVertexArrayVertexBuffer(this->vao, 0, this->vbo, 0, sizeof(Vertex));
-
-    glEnableVertexArrayAttrib(this->vao, 0);
-    glEnableVertexArrayAttrib(this->vao, 1);
-
-    glVertexArrayAttribFormat(this->vao, 0, 3, GL_FLOAT, GL_FALSE,
-            offsetof(Vertex, position));
-    glVertexArrayAttribFormat(this->vao, 1, 2, GL_FLOAT, GL_FALSE,
-            offsetof(Vertex, uv));
+Mesh::Mesh(const std::vector<Vertex> &vertices,
+        const std::vector<unsigned int> &indices)
+    : ebo(0), num_indices(0)
+{
+    this->num_vertices = 0;
 
-    glVertexArrayAttribBinding(this->vao, 0, 0);
-    glVertexArrayAttribBinding(this->vao, 1, 0);
+    create_vertex_array();
+    update(vertices, indices);
 }
 
 Mesh::~Mesh()
 {
+   glDeleteBuffers(1, &this->ebo);
    glDeleteBuffers(1, &this->vbo);
    glDeleteVertexArrays(1, &this->vao);
 }
 
+Mesh::Mesh(Mesh &&other)
+    : vao(other.vao), vbo(other.vbo), num_vertices(other.num_vertices),
+    ebo(other.ebo), num_indices(other.num_indices)
+{
+    // Deleting zero names is ignored
+    other.vao = 0;
+    other.vbo = 0;
+    other.ebo = 0;
+}
+
+Mesh &Mesh::operator=(Mesh &&other)
+{
+    if (this != &other)
+    {
+        glDeleteBuffers(1, &this->ebo);
+        glDeleteBuffers(1, &this->vbo);
+        glDeleteVertexArrays(1, &this->vao);
+
+        this->vao = other.vao;
+        this->vbo = other.vbo;
+        this->num_vertices = other.num_vertices;
+        this->ebo = other.ebo;
+        this->num_indices = other.num_indices;
+
+        other.vao = 0;
+        other.vbo = 0;
+        other.ebo = 0;
+    }
+
+    return *this;
+}
+
+void Mesh::update(const std::vector<Vertex> &vertices,
+        const std::vector<unsigned int> &indices)
+{
+    if (!this->ebo)
+    {
+        glCreateBuffers(1, &this->ebo);
+        glVertexArrayElementBuffer(this->vao, this->ebo);
+    }
+
+    this->num_vertices = vertices.size();
+    this->num_indices = indices.size();
+
+    glNamedBufferData(this->vbo, sizeof(Vertex) * this->num_vertices,
+            vertices.data(), GL_DYNAMIC_DRAW);
+    glNamedBufferData(this->ebo, sizeof(unsigned int) * this->num_indices,
+            indices.data(), GL_DYNAMIC_DRAW);
+}
+
 void Mesh::render() const
 {
     glBindVertexArray(this->vao);
-    glDrawArrays(GL_TRIANGLES, 0, this->num_vertices);
+    if (this->ebo)
+    {
+        glDrawElements(GL_TRIANGLES, this->num_indices, GL_UNSIGNED_INT,
+                nullptr);
+    }
+    else
+    {
+        glDrawArrays(GL_TRIANGLES, 0, this->num_vertices);
+    }
+}
+
+void Mesh::create_vertex_array()
+{
+    glCreateVertexArrays(1, &this->vao);
+    glCreateBuffers(1, &this->vbo);
+
+    glVertexArrayVertexBuffer(this->vao, 0, this->vbo, 0, sizeof(Vertex));
+
+    glEnableVertexArrayAttrib(this->vao, 0);
+    glEnableVertexArrayAttrib(this->vao, 1);
+
+    glVertexArrayAttribFormat(this->vao, 0, 3, GL_FLOAT, GL_FALSE,
+            offsetof(Vertex, position));
+    glVertexArrayAttribFormat(this->vao, 1, 2, GL_FLOAT, GL_FALSE,
+            offsetof(Vertex, uv));
+
+    glVertexArrayAttribBinding(this->vao, 0, 0);
+    glVertexArrayAttribBinding(this->vao, 1, 0);
 }
 
 Mesh Mesh::quad(const glm::vec3 &position, const glm::vec2 &size)
@@ -2,6 +2,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <vector>
 
+// Owns its buffers, so it can be moved but not copied
 class Mesh
 {
 public:
@@ -16,12 +17,31 @@ private:
     unsigned int vbo;
     size_t num_vertices;
 
+    // Only created for indexed meshes, which are drawn with glDrawElements
+    unsigned int ebo;
+    size_t num_indices;
+
 public:
     Mesh(const std::vector<Vertex> &vertices);
+    Mesh(const std::vector<Vertex> &vertices,
+            const std::vector<unsigned int> &indices);
     ~Mesh();
 
+    Mesh(Mesh &&other);
+    Mesh &operator=(Mesh &&other);
+    Mesh(const Mesh &) = delete;
+    Mesh &operator=(const Mesh &) = delete;
+
+    // Replaces the contents, for meshes that are extracted again while
+    // shown. The mesh becomes indexed.
+    void update(const std::vector<Vertex> &vertices,
+            const std::vector<unsigned int> &indices);
+
     void render() const;
 
     static Mesh quad(const glm::vec3 &position, const glm::vec2 &size);
     static Mesh cube(const glm::vec3 &position, float size);
+
+private:
+    void create_vertex_array();
 };
@@ -0,0 +1,108 @@
+#include "metrics.hpp"
+#include <imgui.h>
+#include <algorithm>
+#include <iostream>
+#include "simulator.hpp"
+
+MetricsLog::MetricsLog(const std::string &path, int interval)
+    : path(path), steps(0), supported(true), enabled(interval > 0),
+    interval(interval > 0 ? interval : 60), threshold(0.1f)
+{}
+
+void MetricsLog::step(Simulator &simulator)
+{
+    this->steps++;
+    if (!this->enabled || !this->supported ||
+            this->steps % this->interval != 0)
+    {
+        return;
+    }
+
+    Metrics metrics = Metrics();
+    metrics.step = this->steps;
+    if (!simulator.compute_metrics(this->threshold, metrics))
+    {
+        std::cout << "Metrics are not supported by this simulator\n";
+        this->supported = false;
+        return;
+    }
+
+    record(metrics);
+}
+
+void MetricsLog::record(const Metrics &metrics)
+{
+    if (!this->out.is_open())
+    {
+        this->out.open(this->path);
+        this->out << "step,trail_mass,occupancy,components,"
+            << "largest_component";
+        for (int i = 0; i < Metrics::histogram_bins; i++)
+        {
+            this->out << ",agents_" << i + 1;
+        }
+        this->out << "\n";
+    }
+
+    this->out << metrics.step << "," << metrics.trail_mass << ","
+        << metrics.occupancy << "," << metrics.components << ","
+        << metrics.largest_component;
+    for (int i = 0; i < Metrics::histogram_bins; i++)
+    {
+        this->out << "," << metrics.agent_density[i];
+    }
+    this->out << std::endl;
+
+    if (this->history.size() == this->max_history)
+    {
+        this->history.erase(this->history.begin());
+    }
+    this->history.push_back(metrics);
+}
+
+void MetricsLog::update_debug_window()
+{
+    ImGui::Begin("Metrics");
+
+    ImGui::Checkbox("Record", &this->enabled);
+    ImGui::DragInt("Interval", &this->interval, 1, 1, 10000);
+    ImGui::DragFloat("Threshold", &this->threshold, 0.01f, 0.0f, 8.0f);
+
+    if (!this->supported)
+    {
+        ImGui::Text("Not supported by this simulator");
+    }
+
+    if (!this->history.empty())
+    {
+        int count = this->history.size();
+        std::vector<float> mass(count);
+        std::vector<float> occupancy(count);
+        std::vector<float> components(count);
+        for (int i = 0; i < count; i++)
+        {
+            mass[i] = static_cast<float>(this->history[i].trail_mass);
+            occupancy[i] = this->history[i].occupancy;
+            components[i] = static_cast<float>(this->history[i].components);
+        }
+
+        const Metrics &last = this->history.back();
+        float density[Metrics::histogram_bins];
+        for (int i = 0; i < Metrics::histogram_bins; i++)
+        {
+            density[i] = static_cast<float>(last.agent_density[i]);
+        }
+
+        ImGui::Text("Step %d, %d components, largest %.1f%%", last.step,
+                last.components, 100.0f * last.largest_component);
+        ImGui::PlotLines("Trail Mass", mass.data(), count);
+        ImGui::PlotLines("Occupancy", occupancy.data(), count);
+        ImGui::PlotLines("Components", components.data(), count);
+        ImGui::PlotHistogram("Agents per Voxel", density,
+                Metrics::histogram_bins);
+    }
+
+    ImGui::End();
+
+    this->interval = std::max(1, this->interval);
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <fstream>
+#include <string>
+#include <vector>
+
+class Simulator;
+
+// Structure of the trail network. Voxels whose trail, summed over all
+// species, is above a threshold are occupied, and components are
+// six-connected groups of occupied voxels.
+struct Metrics
+{
+    static const int histogram_bins = 16;
+
+    int step;
+    double trail_mass;
+    float occupancy;
+    int components;
+
+    // Fraction of the occupied voxels in the largest component
+    float largest_component;
+
+    // Bin i counts the voxels with i + 1 agents, the last bin also those
+    // with more
+    unsigned int agent_density[histogram_bins];
+};
+
+// Computes the metrics every interval steps, streams them to a CSV file and
+// plots the recent history
+class MetricsLog
+{
+private:
+    std::string path;
+    std::ofstream out;
+
+    std::vector<Metrics> history;
+    int steps;
+    bool supported;
+
+    const size_t max_history = 600;
+
+public:
+    bool enabled;
+    int interval;
+    float threshold;
+
+public:
+    MetricsLog(const std::string &path, int interval);
+
+    // Counts a step of the simulator, and records the metrics when due
+    void step(Simulator &simulator);
+
+    void update_debug_window();
+
+private:
+    void record(const Metrics &metrics);
+};
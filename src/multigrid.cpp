@@ -0,0 +1,253 @@
+#include "multigrid.hpp"
+#include <algorithm>
+
+// Weight of the Jacobi update, damped so it smooths the high frequencies
+static const float omega = 0.8f;
+
+Multigrid::Multigrid(WorkerPool &pool)
+    : pool(pool), size(0)
+{}
+
+std::vector<Multigrid::Level> Multigrid::hierarchy(const glm::ivec3 &size)
+{
+    std::vector<Level> levels;
+    Level level = {size, 0};
+    levels.push_back(level);
+
+    // The coarsest level keeps at least four voxels per axis
+    while (level.size.x % 2 == 0 && level.size.y % 2 == 0 &&
+            level.size.z % 2 == 0 &&
+            std::min(level.size.x, std::min(level.size.y, level.size.z)) >= 8)
+    {
+        level.offset += static_cast<size_t>(level.size.x) * level.size.y *
+            level.size.z;
+        level.size /= 2;
+        levels.push_back(level);
+    }
+
+    return levels;
+}
+
+float Multigrid::coefficient(float diffuse_speed, int blur_radius, float dt)
+{
+    return diffuse_speed * dt * blur_radius * (blur_radius + 1) / 6.0f;
+}
+
+void Multigrid::solve(Texel *texels, const glm::ivec3 &size,
+        float coefficient, int cycles)
+{
+    if (size != this->size)
+    {
+        this->size = size;
+        this->levels = hierarchy(size);
+
+        const Level &last = this->levels.back();
+        size_t total = last.offset + static_cast<size_t>(last.size.x) *
+            last.size.y * last.size.z;
+        this->solution.assign(total, Texel());
+        this->rhs.assign(total, Texel());
+        this->smoothed.assign(total, Texel());
+    }
+
+    // The trail before the step is both the right hand side and the guess
+    size_t voxels = static_cast<size_t>(size.x) * size.y * size.z;
+    std::copy(texels, texels + voxels, this->rhs.begin());
+    std::copy(texels, texels + voxels, this->solution.begin());
+
+    for (int i = 0; i < cycles; i++)
+    {
+        cycle(0, coefficient);
+    }
+
+    std::copy(this->solution.begin(), this->solution.begin() + voxels,
+            texels);
+}
+
+void Multigrid::cycle(int level, float coefficient)
+{
+    if (level + 1 == static_cast<int>(this->levels.size()))
+    {
+        for (int i = 0; i < coarse_smoothing; i++)
+        {
+            smooth(level, coefficient);
+        }
+        return;
+    }
+
+    for (int i = 0; i < pre_smoothing; i++)
+    {
+        smooth(level, coefficient);
+    }
+
+    // The grid spacing doubles, so the coefficient in voxels of the coarse
+    // level is a quarter
+    restrict_residual(level, coefficient);
+    cycle(level + 1, coefficient / 4.0f);
+    prolongate(level);
+
+    for (int i = 0; i < post_smoothing; i++)
+    {
+        smooth(level, coefficient);
+    }
+}
+
+void Multigrid::parallel_layers(int depth,
+        const std::function<void(int, int)> &task)
+{
+    int workers = this->pool.size();
+    this->pool.run([depth, workers, &task](int index)
+            {
+                int z_begin = depth * index / workers;
+                int z_end = depth * (index + 1) / workers;
+                if (z_begin < z_end)
+                {
+                    task(z_begin, z_end);
+                }
+            });
+}
+
+void Multigrid::smooth(int level, float coefficient)
+{
+    const Level &l = this->levels[level];
+    float weight = omega / (1.0f + 6.0f * coefficient);
+
+    parallel_layers(l.size.z, [this, level, &l, coefficient, weight](
+                int z_begin, int z_end)
+            {
+                for (int z = z_begin; z < z_end; z++)
+                {
+                    for (int y = 0; y < l.size.y; y++)
+                    {
+                        for (int x = 0; x < l.size.x; x++)
+                        {
+                            glm::ivec3 voxel(x, y, z);
+                            size_t i = index(level, voxel);
+                            Texel r = residual(level, voxel, coefficient);
+
+                            Texel &result = this->smoothed[i];
+                            result.low = this->solution[i].low +
+                                weight * r.low;
+                            result.high = this->solution[i].high +
+                                weight * r.high;
+                        }
+                    }
+                }
+            });
+
+    // Only this level's range is current in smoothed, so it is copied
+    // back rather than swapped
+    size_t voxels = static_cast<size_t>(l.size.x) * l.size.y * l.size.z;
+    std::copy(this->smoothed.begin() + l.offset,
+            this->smoothed.begin() + l.offset + voxels,
+            this->solution.begin() + l.offset);
+}
+
+void Multigrid::restrict_residual(int level, float coefficient)
+{
+    const Level &coarse = this->levels[level + 1];
+
+    parallel_layers(coarse.size.z, [this, level, &coarse, coefficient](
+                int z_begin, int z_end)
+            {
+                for (int z = z_begin; z < z_end; z++)
+                {
+                    for (int y = 0; y < coarse.size.y; y++)
+                    {
+                        for (int x = 0; x < coarse.size.x; x++)
+                        {
+                            glm::ivec3 voxel(x, y, z);
+                            Texel sum = Texel();
+                            for (int child = 0; child < 8; child++)
+                            {
+                                glm::ivec3 offset(child & 1,
+                                        (child >> 1) & 1, child >> 2);
+                                Texel r = residual(level,
+                                        2 * voxel + offset, coefficient);
+                                sum.low += r.low;
+                                sum.high += r.high;
+                            }
+
+                            size_t i = index(level + 1, voxel);
+                            this->rhs[i].low = sum.low / 8.0f;
+                            this->rhs[i].high = sum.high / 8.0f;
+                            this->solution[i] = Texel();
+                        }
+                    }
+                }
+            });
+}
+
+void Multigrid::prolongate(int level)
+{
+    const Level &fine = this->levels[level];
+
+    parallel_layers(fine.size.z, [this, level, &fine](int z_begin,
+                int z_end)
+            {
+                for (int z = z_begin; z < z_end; z++)
+                {
+                    for (int y = 0; y < fine.size.y; y++)
+                    {
+                        for (int x = 0; x < fine.size.x; x++)
+                        {
+                            // The fine voxel lies a quarter from its
+                            // parent's center towards the neighbour on its
+                            // side
+                            glm::ivec3 voxel(x, y, z);
+                            glm::ivec3 parent = voxel / 2;
+                            glm::ivec3 side = (voxel % 2) * 2 - 1;
+
+                            Texel &result = this->solution[index(level,
+                                    voxel)];
+                            for (int corner = 0; corner < 8; corner++)
+                            {
+                                glm::ivec3 bits(corner & 1,
+                                        (corner >> 1) & 1, corner >> 2);
+                                float weight =
+                                    (bits.x ? 0.25f : 0.75f) *
+                                    (bits.y ? 0.25f : 0.75f) *
+                                    (bits.z ? 0.25f : 0.75f);
+                                const Texel &correction = this->solution[
+                                    index(level + 1, parent + bits * side)];
+                                result.low += weight * correction.low;
+                                result.high += weight * correction.high;
+                            }
+                        }
+                    }
+                }
+            });
+}
+
+Multigrid::Texel Multigrid::residual(int level, const glm::ivec3 &voxel,
+        float coefficient) const
+{
+    size_t i = index(level, voxel);
+    Texel sum = Texel();
+    for (int axis = 0; axis < 3; axis++)
+    {
+        for (int side = -1; side <= 1; side += 2)
+        {
+            glm::ivec3 neighbour = voxel;
+            neighbour[axis] += side;
+            const Texel &value = this->solution[index(level, neighbour)];
+            sum.low += value.low;
+            sum.high += value.high;
+        }
+    }
+
+    float diagonal = 1.0f + 6.0f * coefficient;
+    Texel result;
+    result.low = this->rhs[i].low - diagonal * this->solution[i].low +
+        coefficient * sum.low;
+    result.high = this->rhs[i].high - diagonal * this->solution[i].high +
+        coefficient * sum.high;
+    return result;
+}
+
+size_t Multigrid::index(int level, const glm::ivec3 &voxel) const
+{
+    const Level &l = this->levels[level];
+    glm::ivec3 wrapped = (voxel % l.size + l.size) % l.size;
+    return l.offset + wrapped.x + static_cast<size_t>(l.size.x) *
+        (wrapped.y + static_cast<size_t>(l.size.y) * wrapped.z);
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include "workerpool.hpp"
+
+// Implicit diffusion of the trail. A backward Euler step of the blur solves
+// (1 - c laplacian) x = b on the periodic volume, which is stable for any
+// step length. The solver runs V-cycles of weighted Jacobi smoothing, full
+// weighting restriction and trilinear prolongation, on a hierarchy that
+// halves the volume while every bound stays even.
+class Multigrid
+{
+public:
+    // Trail of all species, species 0-3 in low and 4-7 in high
+    struct Texel
+    {
+        glm::vec4 low;
+        glm::vec4 high;
+    };
+
+    // Levels are stored one after the other, offset counts voxels
+    struct Level
+    {
+        glm::ivec3 size;
+        size_t offset;
+    };
+
+    static const int pre_smoothing = 2;
+    static const int post_smoothing = 2;
+    static const int coarse_smoothing = 16;
+
+private:
+    WorkerPool &pool;
+
+    glm::ivec3 size;
+    std::vector<Level> levels;
+    std::vector<Texel> solution;
+    std::vector<Texel> rhs;
+    std::vector<Texel> smoothed;
+
+public:
+    Multigrid(WorkerPool &pool);
+
+    static std::vector<Level> hierarchy(const glm::ivec3 &size);
+
+    // Laplacian coefficient of a step. The box blur of a radius mixes in
+    // its neighbours with a spread of r (r + 1) / 3 voxels squared per
+    // axis, which at diffuse_speed per second is this diffusion.
+    static float coefficient(float diffuse_speed, int blur_radius, float dt);
+
+    // Replaces the texels with the solution of a step with coefficient
+    void solve(Texel *texels, const glm::ivec3 &size, float coefficient,
+            int cycles);
+
+private:
+    void cycle(int level, float coefficient);
+
+    // Runs task on the z range of every worker
+    void parallel_layers(int depth,
+            const std::function<void(int, int)> &task);
+
+    void smooth(int level, float coefficient);
+    void restrict_residual(int level, float coefficient);
+    void prolongate(int level);
+
+    Texel residual(int level, const glm::ivec3 &voxel,
+            float coefficient) const;
+    size_t index(int level, const glm::ivec3 &voxel) const;
+};
@@ -0,0 +1,106 @@
+#include "numa.hpp"
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <algorithm>
+
+#if defined(__linux__)
+#    include <pthread.h>
+#    include <sched.h>
+#endif
+
+// Parses lists like "0-3,8-11"
+static std::vector<int> parse_cpu_list(const std::string &list)
+{
+    std::vector<int> cpus;
+    std::stringstream stream(list);
+    std::string range;
+
+    while (std::getline(stream, range, ','))
+    {
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ?
+            first : std::stoi(range.substr(dash + 1));
+
+        for (int cpu = first; cpu <= last; cpu++)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+
+    return cpus;
+}
+
+// Whether the process may run on the cpu, as limited by taskset or cgroups
+static bool cpu_allowed(int cpu)
+{
+#if defined(__linux__)
+    static cpu_set_t allowed;
+    static bool known = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    return !known || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed));
+#else
+    (void)cpu;
+    return true;
+#endif
+}
+
+std::vector<std::vector<int>> Numa::node_cpus()
+{
+    std::vector<std::vector<int>> nodes;
+
+    for (int node = 0; ; node++)
+    {
+        std::ifstream input("/sys/devices/system/node/node" +
+                std::to_string(node) + "/cpulist");
+        if (!input)
+            break;
+
+        std::string list;
+        std::getline(input, list);
+        if (list.empty())
+            continue;
+
+        std::vector<int> cpus = parse_cpu_list(list);
+        cpus.erase(std::remove_if(cpus.begin(), cpus.end(),
+                    [](int cpu) { return !cpu_allowed(cpu); }),
+                cpus.end());
+
+        // Nodes the process may not run on get no workers
+        if (!cpus.empty())
+            nodes.push_back(cpus);
+    }
+
+    if (nodes.empty())
+    {
+        int count = std::max(1u, std::thread::hardware_concurrency());
+
+        nodes.emplace_back();
+        for (int cpu = 0; cpu < count; cpu++)
+        {
+            if (cpu_allowed(cpu))
+                nodes.back().push_back(cpu);
+        }
+
+        if (nodes.back().empty())
+            nodes.back().push_back(0);
+    }
+
+    return nodes;
+}
+
+bool Numa::pin_current_thread(int cpu)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
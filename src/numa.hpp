@@ -0,0 +1,10 @@
+#pragma once
+#include <vector>
+
+// NUMA topology as read from sysfs. Without it, all cpus are on one node.
+namespace Numa
+{
+    std::vector<std::vector<int>> node_cpus();
+
+    bool pin_current_thread(int cpu);
+};
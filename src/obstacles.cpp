@@ -0,0 +1,484 @@
+#include "obstacles.hpp"
+#include <stb_image.h>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include "numa.hpp"
+
+// Runs task on the range of [0, depth) of every worker
+static void parallel_range(WorkerPool &pool, int depth,
+        const std::function<void(int, int)> &task)
+{
+    int workers = pool.size();
+    pool.run([depth, workers, &task](int index)
+            {
+                int begin = depth * index / workers;
+                int end = depth * (index + 1) / workers;
+                if (begin < end)
+                {
+                    task(begin, end);
+                }
+            });
+}
+
+// Offset from b to a along the shortest path around the volume
+static glm::ivec3 wrapped_offset(const glm::ivec3 &a, const glm::ivec3 &b,
+        const glm::ivec3 &size)
+{
+    glm::ivec3 d = a - b;
+    for (int i = 0; i < 3; i++)
+    {
+        if (2 * d[i] > size[i])
+        {
+            d[i] -= size[i];
+        }
+        else if (2 * d[i] < -size[i])
+        {
+            d[i] += size[i];
+        }
+    }
+
+    return d;
+}
+
+static std::string slice_path(const std::string &pattern, int index)
+{
+    char path[4096];
+    std::snprintf(path, sizeof(path), pattern.c_str(), index);
+    return path;
+}
+
+// Twice the signed area of the triangle a, b, p in the xy plane
+static float edge(const glm::vec3 &a, const glm::vec3 &b, const glm::vec2 &p)
+{
+    return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+}
+
+// Height of the triangle above p in the xy plane, if p lies within it
+static bool column_hit(const glm::vec3 &a, const glm::vec3 &b,
+        const glm::vec3 &c, const glm::vec2 &p, float &z)
+{
+    float wa = edge(b, c, p);
+    float wb = edge(c, a, p);
+    float wc = edge(a, b, p);
+    bool inside = (wa > 0.0f && wb > 0.0f && wc > 0.0f) ||
+        (wa < 0.0f && wb < 0.0f && wc < 0.0f);
+    if (!inside)
+    {
+        return false;
+    }
+
+    z = (wa * a.z + wb * b.z + wc * c.z) / (wa + wb + wc);
+    return true;
+}
+
+Obstacles::Obstacles()
+    : kind(None), size(0)
+{}
+
+bool Obstacles::parse(const std::string &spec, Obstacles &result)
+{
+    result = Obstacles();
+
+    std::string name = spec.substr(0, spec.find(':'));
+    if (name.size() < spec.size())
+    {
+        result.path = spec.substr(name.size() + 1);
+    }
+
+    if (name == "none")
+        result.kind = None;
+    else if (name == "image" && !result.path.empty())
+        result.kind = Image;
+    else if (name == "slices" && !result.path.empty())
+        result.kind = Slices;
+    else if (name == "mesh" && !result.path.empty())
+        result.kind = TriangleMesh;
+    else
+        return false;
+
+    return true;
+}
+
+bool Obstacles::load(const glm::ivec3 &size)
+{
+    if (this->kind == None)
+    {
+        return false;
+    }
+
+    this->size = size;
+    this->mask.assign(static_cast<size_t>(size.x) * size.y * size.z, 0);
+
+    std::vector<int> cpus;
+    for (const std::vector<int> &node : Numa::node_cpus())
+    {
+        cpus.insert(cpus.end(), node.begin(), node.end());
+    }
+    WorkerPool pool(cpus);
+
+    bool loaded = false;
+    switch (this->kind)
+    {
+        case Image: loaded = this->load_image(this->path, 0, size.z); break;
+        case Slices: loaded = this->load_slices(); break;
+        default: loaded = this->load_mesh(pool); break;
+    }
+
+    size_t solid = std::count(this->mask.begin(), this->mask.end(), 1);
+    if (!loaded)
+    {
+        std::cout << "Could not load obstacles from " << this->path << "\n";
+    }
+    else if (solid == 0 || solid == this->mask.size())
+    {
+        std::cout << "Obstacles from " << this->path
+            << (solid ? " fill" : " leave") << " the volume, ignoring them\n";
+    }
+
+    if (!loaded || solid == 0 || solid == this->mask.size())
+    {
+        this->kind = None;
+        this->mask.clear();
+        return false;
+    }
+
+    this->build_field(pool);
+    return true;
+}
+
+bool Obstacles::empty() const
+{
+    return this->field.empty();
+}
+
+bool Obstacles::load_image(const std::string &path, int z_begin, int z_end)
+{
+    int width, height, channels;
+    unsigned char *pixels = stbi_load(path.c_str(), &width, &height,
+            &channels, 1);
+    if (!pixels)
+    {
+        return false;
+    }
+
+    // Bright pixels are solid. Rows are stored top down, the volume has y
+    // up.
+    for (int y = 0; y < this->size.y; y++)
+    {
+        int py = height - 1 - y * height / this->size.y;
+        for (int x = 0; x < this->size.x; x++)
+        {
+            int px = x * width / this->size.x;
+            unsigned char solid = pixels[px + py * width] >= 128;
+            for (int z = z_begin; z < z_end; z++)
+            {
+                this->mask[this->voxel_index(x, y, z)] = solid;
+            }
+        }
+    }
+
+    stbi_image_free(pixels);
+    return true;
+}
+
+bool Obstacles::load_slices()
+{
+    int count = 0;
+    int width, height, channels;
+    while (stbi_info(slice_path(this->path, count).c_str(), &width, &height,
+                &channels))
+    {
+        count++;
+    }
+
+    if (count == 0)
+    {
+        return false;
+    }
+
+    // The slices are spread evenly over the layers
+    int z = 0;
+    while (z < this->size.z)
+    {
+        int slice = static_cast<int>(static_cast<long long>(z) * count /
+                this->size.z);
+        int end = z + 1;
+        while (end < this->size.z && static_cast<long long>(end) * count /
+                this->size.z == slice)
+        {
+            end++;
+        }
+
+        if (!this->load_image(slice_path(this->path, slice), z, end))
+        {
+            return false;
+        }
+
+        z = end;
+    }
+
+    return true;
+}
+
+bool Obstacles::load_mesh(WorkerPool &pool)
+{
+    std::ifstream file(this->path);
+    if (!file)
+    {
+        return false;
+    }
+
+    // Vertices and faces of a Wavefront OBJ file, with the faces split into
+    // fans of triangles
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::ivec3> triangles;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream in(line);
+        std::string type;
+        in >> type;
+        if (type == "v")
+        {
+            glm::vec3 vertex(0.0f);
+            in >> vertex.x >> vertex.y >> vertex.z;
+            vertices.push_back(vertex);
+        }
+        else if (type == "f")
+        {
+            std::vector<int> face;
+            std::string corner;
+            while (in >> corner)
+            {
+                int index = std::atoi(corner.c_str());
+                index = index < 0 ?
+                    static_cast<int>(vertices.size()) + index : index - 1;
+                if (index < 0 || index >= static_cast<int>(vertices.size()))
+                {
+                    return false;
+                }
+                face.push_back(index);
+            }
+
+            for (size_t k = 2; k < face.size(); k++)
+            {
+                triangles.push_back(glm::ivec3(face[0], face[k - 1],
+                            face[k]));
+            }
+        }
+    }
+
+    if (triangles.empty())
+    {
+        return false;
+    }
+
+    // Scaled to fit the volume, centered and keeping its proportions
+    glm::vec3 low = vertices[0];
+    glm::vec3 high = vertices[0];
+    for (const glm::vec3 &vertex : vertices)
+    {
+        low = glm::min(low, vertex);
+        high = glm::max(high, vertex);
+    }
+
+    glm::vec3 extent = high - low;
+    float scale = 0.0f;
+    for (int i = 0; i < 3; i++)
+    {
+        if (extent[i] > 0.0f)
+        {
+            float fit = this->size[i] / extent[i];
+            scale = scale > 0.0f ? std::min(scale, fit) : fit;
+        }
+    }
+
+    glm::vec3 center = (low + high) / 2.0f;
+    for (glm::vec3 &vertex : vertices)
+    {
+        vertex = (vertex - center) * scale + glm::vec3(this->size) / 2.0f;
+    }
+
+    // Every column of voxels along z is filled between pairs of the
+    // surface crossings above it, so the mesh must be closed. Columns are
+    // sampled slightly off the voxel centers, so they miss the edges of
+    // meshes that were made in voxel coordinates. Each worker owns a range
+    // of rows and bins the triangles over them.
+    parallel_range(pool, this->size.y, [this, &vertices, &triangles](
+                int y_begin, int y_end)
+            {
+                std::vector<std::vector<float>> hits(
+                        static_cast<size_t>(this->size.x) * (y_end - y_begin));
+
+                for (const glm::ivec3 &triangle : triangles)
+                {
+                    const glm::vec3 &a = vertices[triangle.x];
+                    const glm::vec3 &b = vertices[triangle.y];
+                    const glm::vec3 &c = vertices[triangle.z];
+                    glm::vec3 low = glm::min(a, glm::min(b, c));
+                    glm::vec3 high = glm::max(a, glm::max(b, c));
+
+                    int x0 = std::max(0, static_cast<int>(low.x - 1.0f));
+                    int x1 = std::min(this->size.x - 1,
+                            static_cast<int>(high.x + 1.0f));
+                    int y0 = std::max(y_begin, static_cast<int>(low.y - 1.0f));
+                    int y1 = std::min(y_end - 1,
+                            static_cast<int>(high.y + 1.0f));
+                    for (int y = y0; y <= y1; y++)
+                    {
+                        for (int x = x0; x <= x1; x++)
+                        {
+                            float z;
+                            glm::vec2 p(x + 0.5001237f, y + 0.4998761f);
+                            if (column_hit(a, b, c, p, z))
+                            {
+                                hits[x + static_cast<size_t>(this->size.x) *
+                                    (y - y_begin)].push_back(z);
+                            }
+                        }
+                    }
+                }
+
+                for (int y = y_begin; y < y_end; y++)
+                {
+                    for (int x = 0; x < this->size.x; x++)
+                    {
+                        std::vector<float> &column = hits[x +
+                            static_cast<size_t>(this->size.x) * (y - y_begin)];
+                        std::sort(column.begin(), column.end());
+
+                        for (size_t k = 0; k + 1 < column.size(); k += 2)
+                        {
+                            int z0 = std::max(0, static_cast<int>(
+                                        std::ceil(column[k] - 0.5f)));
+                            int z1 = std::min(this->size.z, static_cast<int>(
+                                        std::ceil(column[k + 1] - 0.5f)));
+                            for (int z = z0; z < z1; z++)
+                            {
+                                this->mask[this->voxel_index(x, y, z)] = 1;
+                            }
+                        }
+                    }
+                }
+            });
+
+    return true;
+}
+
+std::vector<int> Obstacles::jump_flood(WorkerPool &pool, bool solid) const
+{
+    size_t voxels = this->mask.size();
+    std::vector<int> nearest(voxels);
+    std::vector<int> next(voxels);
+    for (size_t i = 0; i < voxels; i++)
+    {
+        nearest[i] = (this->mask[i] != 0) == solid ? static_cast<int>(i) : -1;
+    }
+
+    // Nothing is further than half the volume around the wrap. The steps
+    // halve down to one voxel, and a last step of one fixes most of the
+    // voxels that picked a seed that is not the nearest.
+    int longest = std::max(this->size.x, std::max(this->size.y, this->size.z));
+    std::vector<int> steps;
+    for (int step = 1; step < (longest + 1) / 2; step *= 2)
+    {
+        steps.insert(steps.begin(), step);
+    }
+    steps.push_back(1);
+
+    for (int step : steps)
+    {
+        parallel_range(pool, this->size.z, [this, &nearest, &next, step](
+                    int z_begin, int z_end)
+                {
+                    size_t begin = this->voxel_index(0, 0, z_begin);
+                    size_t end = this->voxel_index(0, 0, z_end);
+                    for (size_t i = begin; i < end; i++)
+                    {
+                        glm::ivec3 p = this->voxel_position(i);
+                        int best = -1;
+                        int best_distance = INT_MAX;
+
+                        for (int cell = 0; cell < 27; cell++)
+                        {
+                            glm::ivec3 offset(cell % 3 - 1,
+                                    (cell / 3) % 3 - 1, cell / 9 - 1);
+                            glm::ivec3 q = p + offset * step;
+                            q = (q % this->size + this->size) % this->size;
+
+                            int seed = nearest[this->voxel_index(q.x, q.y,
+                                    q.z)];
+                            if (seed < 0)
+                            {
+                                continue;
+                            }
+
+                            glm::ivec3 d = wrapped_offset(p,
+                                    this->voxel_position(seed), this->size);
+                            int distance = d.x * d.x + d.y * d.y + d.z * d.z;
+                            if (distance < best_distance)
+                            {
+                                best = seed;
+                                best_distance = distance;
+                            }
+                        }
+
+                        next[i] = best;
+                    }
+                });
+
+        std::swap(nearest, next);
+    }
+
+    return nearest;
+}
+
+void Obstacles::build_field(WorkerPool &pool)
+{
+    std::vector<int> nearest_solid = this->jump_flood(pool, true);
+    std::vector<int> nearest_free = this->jump_flood(pool, false);
+
+    // Distances between voxel centers, less the half voxel to the surface
+    // between them
+    this->field.resize(this->mask.size());
+    parallel_range(pool, this->size.z, [this, &nearest_solid, &nearest_free](
+                int z_begin, int z_end)
+            {
+                size_t begin = this->voxel_index(0, 0, z_begin);
+                size_t end = this->voxel_index(0, 0, z_end);
+                for (size_t i = begin; i < end; i++)
+                {
+                    bool inside = this->mask[i] != 0;
+                    int other = inside ? nearest_free[i] : nearest_solid[i];
+
+                    glm::vec3 d(wrapped_offset(this->voxel_position(i),
+                                this->voxel_position(other), this->size));
+                    float length = glm::length(d);
+                    glm::vec3 away = (inside ? -d : d) / length;
+                    float distance = length - 0.5f;
+
+                    this->field[i] = glm::vec4(inside ? -distance : distance,
+                            away);
+                }
+            });
+}
+
+size_t Obstacles::voxel_index(int x, int y, int z) const
+{
+    return x + static_cast<size_t>(this->size.x) *
+        (y + static_cast<size_t>(this->size.y) * z);
+}
+
+glm::ivec3 Obstacles::voxel_position(size_t index) const
+{
+    size_t layer = static_cast<size_t>(this->size.x) * this->size.y;
+    return glm::ivec3(index % this->size.x,
+            (index % layer) / this->size.x, index / layer);
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include "workerpool.hpp"
+
+// Solid voxels that agents steer around and the trail does not diffuse
+// into. The mask is voxelized from an image extruded along z, a stack of
+// slice images or a closed triangle mesh, and converted once to a signed
+// distance field by jump flooding. The volume wraps like the simulation.
+class Obstacles
+{
+public:
+    enum Kind
+    {
+        None,
+        Image,
+        Slices,
+        TriangleMesh,
+    };
+
+    Kind kind;
+    std::string path;
+
+    glm::ivec3 size;
+
+    // One byte per voxel, in x, then y, then z order, set in solid voxels
+    std::vector<unsigned char> mask;
+
+    // Per voxel in the same order, the distance to the nearest obstacle
+    // surface in voxels, negative inside, followed by the unit direction
+    // away from it
+    std::vector<glm::vec4> field;
+
+public:
+    Obstacles();
+
+    // One of none, image:<path>, slices:<pattern> or mesh:<path>. Slice
+    // patterns hold a printf integer for the slice number, counted from 0.
+    static bool parse(const std::string &spec, Obstacles &result);
+
+    // Voxelizes the source for the volume and builds the distance field.
+    // Returns false and leaves no obstacles if the source could not be read,
+    // or if it fills the volume or leaves it empty.
+    bool load(const glm::ivec3 &size);
+
+    bool empty() const;
+
+private:
+    bool load_image(const std::string &path, int z_begin, int z_end);
+    bool load_slices();
+    bool load_mesh(WorkerPool &pool);
+
+    // Nearest voxel with the mask equal to solid for every voxel, or -1
+    std::vector<int> jump_flood(WorkerPool &pool, bool solid) const;
+    void build_field(WorkerPool &pool);
+
+    size_t voxel_index(int x, int y, int z) const;
+    glm::ivec3 voxel_position(size_t index) const;
+};
@@ -0,0 +1,114 @@
+#include "packedagent.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+static const float age_scale = 16.0f;
+
+const float PackedAgent::max_age = 65535.0f / age_scale;
+
+// Fixed point in units of 1 / 65536, wrapping around
+static unsigned int wrap_bits(float value, float offset)
+{
+    return static_cast<unsigned int>(static_cast<int64_t>(
+                std::floor(value * 65536.0f + offset))) & 0xFFFFu;
+}
+
+// Fixed point in units of 1 / scale, saturating at 16 bits
+static unsigned int clamp_bits(float value, float scale, float offset)
+{
+    float bits = std::floor(std::max(value, 0.0f) * scale + offset);
+    return static_cast<unsigned int>(std::min(bits, 65535.0f));
+}
+
+static float sign_not_zero(float value)
+{
+    return value >= 0.0f ? 1.0f : -1.0f;
+}
+
+// The heading projected onto the octahedron, with the lower half folded
+// over the upper, in [-1, 1]
+static glm::vec2 octahedral(const glm::vec3 &heading)
+{
+    glm::vec3 d = heading / (std::abs(heading.x) + std::abs(heading.y) +
+            std::abs(heading.z));
+    if (d.z >= 0.0f)
+    {
+        return glm::vec2(d.x, d.y);
+    }
+
+    return glm::vec2((1.0f - std::abs(d.y)) * sign_not_zero(d.x),
+            (1.0f - std::abs(d.x)) * sign_not_zero(d.y));
+}
+
+static glm::vec3 unit_vector(float u, float v)
+{
+    glm::vec3 d(u, v, 1.0f - std::abs(u) - std::abs(v));
+    if (d.z < 0.0f)
+    {
+        d.x = (1.0f - std::abs(v)) * sign_not_zero(u);
+        d.y = (1.0f - std::abs(u)) * sign_not_zero(v);
+    }
+
+    return glm::normalize(d);
+}
+
+PackedAgent PackedAgent::encode(const State &state, const glm::vec3 &bounds,
+        float offset)
+{
+    glm::vec3 p = state.position / bounds;
+    glm::vec2 heading = octahedral(state.heading) * 0.5f + 0.5f;
+
+    PackedAgent agent;
+    agent.bits.x = wrap_bits(p.x, offset) | (wrap_bits(p.y, offset) << 16);
+    agent.bits.y = wrap_bits(p.z, offset) |
+        (clamp_bits(heading.x, 65535.0f, offset) << 16);
+    agent.bits.z = clamp_bits(heading.y, 65535.0f, offset) |
+        (clamp_bits(state.age, age_scale, offset) << 16);
+    agent.bits.w = clamp_bits(std::min(state.energy, 1.0f), 65535.0f,
+            offset) | (static_cast<unsigned int>(state.species) << 16);
+    return agent;
+}
+
+PackedAgent::State PackedAgent::decode(const glm::vec3 &bounds) const
+{
+    State state;
+    state.position = position(bounds);
+    state.heading = unit_vector(
+            (this->bits.y >> 16) / 65535.0f * 2.0f - 1.0f,
+            (this->bits.z & 0xFFFFu) / 65535.0f * 2.0f - 1.0f);
+    state.species = species();
+    state.age = (this->bits.z >> 16) / age_scale;
+    state.energy = (this->bits.w & 0xFFFFu) / 65535.0f;
+    return state;
+}
+
+glm::vec3 PackedAgent::heading_of(float theta, float phi)
+{
+    float sin_phi = std::sin(phi);
+    return glm::vec3(sin_phi * std::cos(theta), sin_phi * std::sin(theta),
+            std::cos(phi));
+}
+
+void PackedAgent::angles_of(const glm::vec3 &heading, float &theta,
+        float &phi)
+{
+    theta = std::atan2(heading.y, heading.x);
+    phi = std::acos(std::min(std::max(heading.z, -1.0f), 1.0f));
+}
+
+glm::vec3 PackedAgent::position(const glm::vec3 &bounds) const
+{
+    return glm::vec3(this->bits.x & 0xFFFFu, this->bits.x >> 16,
+            this->bits.y & 0xFFFFu) * (bounds / 65536.0f);
+}
+
+int PackedAgent::species() const
+{
+    return static_cast<int16_t>(this->bits.w >> 16);
+}
+
+void PackedAgent::kill()
+{
+    this->bits.w |= 0xFFFF0000u;
+}
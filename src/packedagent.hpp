@@ -0,0 +1,42 @@
+#pragma once
+#include <glm/glm.hpp>
+
+// Agent state packed to 16 bytes, the layout of the GPU agent buffers and
+// of the CPU agent stores. Every field takes 16 bits: x | y, z | heading u,
+// heading v | age and energy | species. Positions are fixed point
+// fractions of the volume, so they wrap for free. The heading is a unit
+// vector in octahedral coordinates u, v, so it decodes without
+// trigonometry. Age counts sixteenths of a second and saturates at
+// max_age, energy is a fraction of one, and species is signed, -1 for dead
+// agents.
+struct PackedAgent
+{
+    struct State
+    {
+        glm::vec3 position;
+        glm::vec3 heading;
+        int species;
+        float age;
+        float energy;
+    };
+
+    static const float max_age;
+
+    glm::uvec4 bits;
+
+    // Fields are rounded down after adding offset, so 0.5 rounds to the
+    // nearest and a random offset in [0, 1) rounds stochastically, which
+    // keeps movements and ages smaller than a step from being lost
+    static PackedAgent encode(const State &state, const glm::vec3 &bounds,
+            float offset = 0.5f);
+    State decode(const glm::vec3 &bounds) const;
+
+    // Between headings and the spherical angles of samples and checkpoints
+    static glm::vec3 heading_of(float theta, float phi);
+    static void angles_of(const glm::vec3 &heading, float &theta,
+            float &phi);
+
+    glm::vec3 position(const glm::vec3 &bounds) const;
+    int species() const;
+    void kill();
+};
@@ -1,97 +1,467 @@
 #include "shader.hpp"
 #include <glad/glad.h>
 #include <iostream>
+#include <fstream>
+#include <map>
+#include <algorithm>
+#include <cstdint>
 #include <stdio.h>
 #include <glm/gtc/type_ptr.hpp>
 #include "file.hpp"
 
-static unsigned int compile_shader(const std::string &path, unsigned int type)
+#ifdef _WIN32
+#    include <direct.h>
+#    include <process.h>
+#    define make_directory(path) _mkdir(path)
+#    define process_id() _getpid()
+#else
+#    include <sys/stat.h>
+#    include <unistd.h>
+#    define make_directory(path) mkdir(path, 0755)
+#    define process_id() getpid()
+#endif
+
+static const char *cache_directory = "shader_cache";
+
+namespace
 {
-    std::string content = File::content(path);
-    const char *ccontent = content.c_str();
+    // Programs started by preload, waiting to be taken by their Shader
+    std::map<std::string, Shader::Program> preloaded;
 
-    unsigned int id = glCreateShader(type);
-    glShaderSource(id, 1, &ccontent, NULL);
-    glCompileShader(id);
+    // Every shader that exists, so changed files can be reloaded
+    std::vector<Shader *> live;
+};
+
+static uint64_t hash_bytes(uint64_t hash, const std::string &bytes)
+{
+    // FNV-1a, with the terminator so consecutive strings can not run
+    // into each other
+    for (size_t i = 0; i <= bytes.size(); i++)
+    {
+        hash ^= static_cast<unsigned char>(bytes.c_str()[i]);
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static std::string gl_string(GLenum name)
+{
+    const GLubyte *value = glGetString(name);
+    return value ? reinterpret_cast<const char *>(value) : "";
+}
+
+static bool parallel_compile()
+{
+    static bool available = false;
+    static bool initialized = false;
+
+    if (!initialized)
+    {
+        initialized = true;
+        available = GLAD_GL_KHR_parallel_shader_compile;
+
+        // Let the driver use as many threads as it likes
+        if (available)
+        {
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        }
+    }
+
+    return available;
+}
+
+static std::string binary_path(const std::vector<std::string> &contents,
+        const std::vector<unsigned int> &types)
+{
+    // Binaries are only valid for the driver and GPU that made them
+    static const std::string driver = gl_string(GL_VENDOR) + "/" +
+        gl_string(GL_RENDERER) + "/" + gl_string(GL_VERSION);
+
+    uint64_t hash = hash_bytes(14695981039346656037ull, driver);
+    for (size_t i = 0; i < contents.size(); i++)
+    {
+        hash = hash_bytes(hash, std::to_string(types[i]));
+        hash = hash_bytes(hash, contents[i]);
+    }
+
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx",
+            static_cast<unsigned long long>(hash));
+
+    return std::string(cache_directory) + "/" + name + ".bin";
+}
+
+static std::string info_log(unsigned int id, bool program)
+{
+    int length = 0;
+    if (program)
+        glGetProgramiv(id, GL_INFO_LOG_LENGTH, &length);
+    else
+        glGetShaderiv(id, GL_INFO_LOG_LENGTH, &length);
+
+    std::string log(std::max(length, 1), '\0');
+    if (program)
+        glGetProgramInfoLog(id, length, NULL, &log[0]);
+    else
+        glGetShaderInfoLog(id, length, NULL, &log[0]);
+
+    return log.c_str();
+}
+
+static bool load_binary(unsigned int id, const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+
+    uint32_t format = 0;
+    file.read(reinterpret_cast<char *>(&format), sizeof(format));
+    std::string binary((std::istreambuf_iterator<char>(file)),
+            std::istreambuf_iterator<char>());
+
+    if (!file || binary.empty())
+    {
+        return false;
+    }
+
+    // Fails after driver updates, the program is then compiled as usual
+    glProgramBinary(id, format, binary.data(), binary.size());
 
-    char shader_error_msg[512];
     int success;
-    glGetShaderiv(id, GL_COMPILE_STATUS, &success);
+    glGetProgramiv(id, GL_LINK_STATUS, &success);
+    return success;
+}
 
-    if (!success)
+static void save_binary(unsigned int id, const std::string &path)
+{
+    int length = 0;
+    glGetProgramiv(id, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
     {
-        glGetShaderInfoLog(id, 512, NULL, shader_error_msg);
-        printf("Failed to compile shader %s\n%s", path.c_str(),
-                shader_error_msg);
-        return 0;
+        return;
     }
 
-    return id;
+    std::string binary(length, '\0');
+    GLenum format = 0;
+    glGetProgramBinary(id, length, NULL, &format, &binary[0]);
+
+    make_directory(cache_directory);
+
+    // Ranks build the same programs at once, so each writes its own file
+    // and renames it into place, and readers never see a partial binary
+    std::string temporary = path + "." + std::to_string(process_id());
+
+    uint32_t stored_format = format;
+    std::ofstream file(temporary, std::ios::binary);
+    file.write(reinterpret_cast<const char *>(&stored_format),
+            sizeof(stored_format));
+    file.write(binary.data(), binary.size());
+    file.close();
+
+    if (!file || rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        remove(temporary.c_str());
+    }
+}
+
+// Starts compiling and linking without waiting for either
+static Shader::Program start_program(const std::vector<unsigned int> &types,
+        const std::vector<std::string> &contents, const std::string &path)
+{
+    Shader::Program program;
+    program.id = glCreateProgram();
+    program.cached = load_binary(program.id, path);
+
+    if (program.cached)
+    {
+        return program;
+    }
+
+    parallel_compile();
+
+    glProgramParameteri(program.id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+            GL_TRUE);
+
+    for (size_t i = 0; i < contents.size(); i++)
+    {
+        const char *ccontent = contents[i].c_str();
+
+        unsigned int stage = glCreateShader(types[i]);
+        glShaderSource(stage, 1, &ccontent, NULL);
+        glCompileShader(stage);
+        glAttachShader(program.id, stage);
+
+        program.stages.push_back(stage);
+    }
+
+    glLinkProgram(program.id);
+
+    return program;
+}
+
+std::string Shader::source_path(const std::string &path)
+{
+    std::string in_source = std::string(PROJECT_SOURCE_DIR) + "/" + path;
+    return std::ifstream(in_source) ? in_source : path;
+}
+
+static void read_sources(const std::vector<Shader::Source> &sources,
+        std::vector<unsigned int> &types, std::vector<std::string> &contents)
+{
+    for (const Shader::Source &source : sources)
+    {
+        std::string content = File::content(
+                Shader::source_path(source.path));
+        if (!source.defines.empty())
+        {
+            // Line numbers in errors still match the file
+            size_t version_end = content.find('\n') + 1;
+            content.insert(version_end, source.defines + "#line 2\n");
+        }
+
+        types.push_back(source.type);
+        contents.push_back(content);
+    }
 }
 
 Shader::Shader(const std::vector<Source> &sources)
+    : finished(false), sources(sources), reloading({0, {}, false})
 {
-    this->id = glCreateProgram();
+    live.push_back(this);
+
+    std::vector<unsigned int> types;
+    std::vector<std::string> contents;
+    read_sources(sources, types, contents);
 
-    std::vector<unsigned int> shader_ids;
     for (size_t i = 0; i < sources.size(); i++)
     {
-        const Source &source = sources[i];
-        unsigned int shader_id = compile_shader(source.path, source.type);
+        this->name += (i ? ", " : "") + sources[i].path;
+    }
+
+    this->cache_path = binary_path(contents, types);
+
+    auto pending = preloaded.find(this->cache_path);
+    if (pending != preloaded.end())
+    {
+        this->program = pending->second;
+        preloaded.erase(pending);
+    }
+    else
+    {
+        this->program = start_program(types, contents, this->cache_path);
+    }
+}
+
+void Shader::preload(const std::vector<Source> &sources)
+{
+    std::vector<unsigned int> types;
+    std::vector<std::string> contents;
+    read_sources(sources, types, contents);
+
+    std::string path = binary_path(contents, types);
+    if (preloaded.find(path) == preloaded.end())
+    {
+        preloaded[path] = start_program(types, contents, path);
+    }
+}
 
-        if (!shader_id)
+static void delete_program(Shader::Program &program)
+{
+    for (unsigned int stage : program.stages)
+    {
+        glDeleteShader(stage);
+    }
+
+    glDeleteProgram(program.id);
+    program = {0, {}, false};
+}
+
+Shader::~Shader()
+{
+    live.erase(std::find(live.begin(), live.end(), this));
+
+    delete_program(this->program);
+    delete_program(this->reloading);
+}
+
+static bool program_ready(const Shader::Program &program)
+{
+    if (program.cached || !parallel_compile())
+    {
+        return true;
+    }
+
+    int complete;
+    glGetProgramiv(program.id, GL_COMPLETION_STATUS_KHR, &complete);
+    return complete;
+}
+
+bool Shader::ready() const
+{
+    return this->finished || program_ready(this->program);
+}
+
+bool Shader::preloaded_ready()
+{
+    for (const auto &pending : preloaded)
+    {
+        if (!program_ready(pending.second))
         {
-            for (size_t j = 0; j < i; j++)
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Checks the link once the program is done. Successful links are cached,
+// failed ones are deleted and their logs returned in log.
+static bool finish_program(Shader::Program &program,
+        const std::string &path, std::string &log)
+{
+    int success;
+    glGetProgramiv(program.id, GL_LINK_STATUS, &success);
+
+    if (!success)
+    {
+        for (unsigned int stage : program.stages)
+        {
+            int compiled;
+            glGetShaderiv(stage, GL_COMPILE_STATUS, &compiled);
+            if (!compiled)
             {
-                glDeleteShader(shader_ids[j]);
+                log += info_log(stage, false);
             }
-
-            this->id = 0;
-            return;
         }
+        log += info_log(program.id, true);
+
+        delete_program(program);
+        return false;
+    }
+
+    if (!program.cached)
+    {
+        save_binary(program.id, path);
+    }
+
+    for (unsigned int stage : program.stages)
+    {
+        glDeleteShader(stage);
+    }
+    program.stages.clear();
+
+    return true;
+}
+
+bool Shader::valid() const
+{
+    if (this->finished)
+    {
+        return this->program.id;
+    }
 
-        glAttachShader(this->id, shader_id);
+    this->finished = true;
 
-        shader_ids.push_back(shader_id);
+    std::string log;
+    if (!finish_program(this->program, this->cache_path, log))
+    {
+        std::cout << "Failed to build shaders " << this->name << "\n"
+            << log << "\n";
+        this->build_error = this->name + "\n" + log;
     }
 
-    glLinkProgram(this->id);
+    return this->program.id;
+}
+
+void Shader::reload()
+{
+    delete_program(this->reloading);
+
+    std::vector<unsigned int> types;
+    std::vector<std::string> contents;
+    read_sources(this->sources, types, contents);
 
-    for (auto shader_id : shader_ids)
+    this->reloading_path = binary_path(contents, types);
+    this->reloading = start_program(types, contents, this->reloading_path);
+}
+
+bool Shader::finish_reload()
+{
+    if (!this->reloading.id || !program_ready(this->reloading))
     {
-        glDeleteShader(shader_id);
+        return false;
     }
 
-    GLint link_success;
-    glGetProgramiv(this->id, GL_LINK_STATUS, &link_success);
-    if (!link_success)
+    std::string log;
+    if (finish_program(this->reloading, this->reloading_path, log))
     {
-        this->id = 0;
-        std::cout << "Failed to link shaders: ";
-        for (size_t i = 0; i < sources.size(); i++)
+        // Uniform locations and bindings are explicit, so the new program
+        // is used as is from the next bind
+        this->valid();
+        delete_program(this->program);
+
+        this->program = this->reloading;
+        this->cache_path = this->reloading_path;
+        this->build_error.clear();
+        this->reloading = {0, {}, false};
+
+        std::cout << "Reloaded " << this->name << "\n";
+    }
+    else
+    {
+        this->build_error = this->name + "\n" + log;
+    }
+
+    return true;
+}
+
+void Shader::reload_files(const std::vector<std::string> &paths)
+{
+    for (Shader *shader : live)
+    {
+        for (const Source &source : shader->sources)
         {
-            std::cout << sources[i].path;
-            if (i < sources.size() - 1)
+            if (std::find(paths.begin(), paths.end(),
+                        source_path(source.path)) != paths.end())
             {
-                std::cout << ", ";
+                shader->reload();
+                break;
             }
         }
     }
 }
 
-Shader::~Shader()
+void Shader::update_reloads()
 {
-    glDeleteProgram(this->id);
+    for (Shader *shader : live)
+    {
+        shader->finish_reload();
+    }
 }
 
-bool Shader::valid() const
+std::vector<std::string> Shader::build_errors()
 {
-    return this->id;
+    std::vector<std::string> errors;
+    for (const Shader *shader : live)
+    {
+        if (!shader->build_error.empty())
+        {
+            errors.push_back(shader->build_error);
+        }
+    }
+
+    return errors;
 }
 
 void Shader::bind() const
 {
-    glUseProgram(this->id);
+    // Waits for the program the first time
+    this->valid();
+    glUseProgram(this->program.id);
+}
+
+int Shader::location(const std::string &name) const
+{
+    return glGetUniformLocation(this->program.id, name.c_str());
 }
 
 void Shader::set_int(unsigned int location, int value) const
@@ -136,54 +506,61 @@ void Shader::set_mat4(unsigned int location, const glm::mat4 &value) const
 
 void Shader::set_int(const std::string &name, int value) const
 {
-    this->set_int(glGetUniformLocation(this->id, name.c_str()), value);
+    this->set_int(this->location(name), value);
 }
 
 void Shader::set_float(const std::string &name, float value) const
 {
-    this->set_float(glGetUniformLocation(this->id, name.c_str()), value);
+    this->set_float(this->location(name), value);
 }
 
 void Shader::set_vec2(const std::string &name, const glm::vec2 &value) const
 {
-    this->set_vec2(glGetUniformLocation(this->id, name.c_str()), value);
+    this->set_vec2(this->location(name), value);
 }
 
 void Shader::set_ivec2(const std::string &name, const glm::ivec2 &value) const
 {
-    this->set_ivec2(glGetUniformLocation(this->id, name.c_str()), value);
+    this->set_ivec2(this->location(name), value);
 }
 
 void Shader::set_vec3(const std::string &name, const glm::vec3 &value) const
 {
-    this->set_vec3(glGetUniformLocation(this->id, name.c_str()), value);
+    this->set_vec3(this->location(name), value);
 }
 
 void Shader::set_ivec3(const std::string &name, const glm::ivec3 &value) const
 {
-    this->set_ivec3(glGetUniformLocation(this->id, name.c_str()), value);
+    this->set_ivec3(this->location(name), value);
 }
 
 void Shader::set_vec4(const std::string &name, const glm::vec4 &value) const
 {
-    this->set_vec4(glGetUniformLocation(this->id, name.c_str()), value);
+    this->set_vec4(this->location(name), value);
 }
 
 void Shader::set_mat4(const std::string &name, const glm::mat4 &value) const
 {
-    this->set_mat4(glGetUniformLocation(this->id, name.c_str()), value);
+    this->set_mat4(this->location(name), value);
 }
 
 RenderShader::RenderShader(const std::string &vertex_path,
         const std::string &fragment_path)
-    : Shader({{vertex_path, GL_VERTEX_SHADER},
-            {fragment_path, GL_FRAGMENT_SHADER}})
+    : Shader({{vertex_path, GL_VERTEX_SHADER, ""},
+            {fragment_path, GL_FRAGMENT_SHADER, ""}})
 { }
 
-ComputeShader::ComputeShader(const std::string &path)
-    : Shader({{path, GL_COMPUTE_SHADER}}), work_group(1)
+ComputeShader::ComputeShader(const std::string &path,
+        const std::string &defines)
+    : Shader({{path, GL_COMPUTE_SHADER, defines}}), work_group(1)
 {}
 
+void ComputeShader::preload(const std::string &path,
+        const std::string &defines)
+{
+    Shader::preload({{path, GL_COMPUTE_SHADER, defines}});
+}
+
 void ComputeShader::set_work_group(const glm::uvec3 &work_group)
 {
     this->work_group = work_group;
@@ -195,3 +572,11 @@ void ComputeShader::dispatch_and_wait() const
             this->work_group.z);
     glMemoryBarrier(GL_ALL_BARRIER_BITS);
 }
+
+void ComputeShader::dispatch_indirect_and_wait(unsigned int buffer,
+        size_t offset) const
+{
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, buffer);
+    glDispatchComputeIndirect(static_cast<GLintptr>(offset));
+    glMemoryBarrier(GL_ALL_BARRIER_BITS);
+}
@@ -3,27 +3,84 @@
 #include <vector>
 #include <glm/gtc/matrix_transform.hpp>
 
+// Programs are linked from a binary cache keyed by the sources and the
+// driver when possible. Otherwise they are compiled in the background with
+// GL_KHR_parallel_shader_compile, and the link is only checked once the
+// program is first used, so all programs compile at the same time.
 class Shader
 {
-private:
+public:
+    // Defines are inserted after the #version line, so one file can be
+    // compiled into specialised variants
     struct Source
     {
         std::string path;
         unsigned int type;
+        std::string defines;
     };
 
-protected:
-    unsigned int id;
+    // Compile and link in flight, or a program loaded from the cache
+    struct Program
+    {
+        unsigned int id;
+        std::vector<unsigned int> stages;
+        bool cached;
+    };
+
+private:
+    mutable Program program;
+    mutable bool finished;
+    std::string name;
+    std::string cache_path;
+
+    // Hot reloads build a new program next to the current one, which is
+    // only replaced if the new one links
+    std::vector<Source> sources;
+    Program reloading;
+    std::string reloading_path;
+    mutable std::string build_error;
 
 protected:
     Shader(const std::vector<Source> &sources);
 
+    // Starts a program so a later Shader with the same sources takes it
+    static void preload(const std::vector<Source> &sources);
+
+private:
+    int location(const std::string &name) const;
+
+    void reload();
+    bool finish_reload();
+
 public:
     ~Shader();
 
+    // Registered by address for hot reloads, so never copied
+    Shader(const Shader &) = delete;
+    Shader &operator=(const Shader &) = delete;
+
+    // Whether the program can be used without waiting for the driver
+    bool ready() const;
+    static bool preloaded_ready();
+
+    // Waits for the program and reports whether it linked
     bool valid() const;
     void bind() const;
 
+    // Sources are read from the source tree when it is there, rather than
+    // from the copy made in the build directory, so edits are picked up
+    static std::string source_path(const std::string &path);
+
+    // Starts rebuilding every shader that uses one of the paths, as given
+    // by source_path
+    static void reload_files(const std::vector<std::string> &paths);
+
+    // Swaps in the reloads that are done, without waiting for the rest
+    static void update_reloads();
+
+    // Logs of the shaders whose last build or reload failed, for display
+    static std::vector<std::string> build_errors();
+
     void set_int(unsigned int location, int value) const;
     void set_float(unsigned int location, float value) const;
     void set_vec2(unsigned int location, const glm::vec2 &value) const;
@@ -56,8 +113,14 @@ private:
     glm::uvec3 work_group;
 
 public:
-    ComputeShader(const std::string &path);
+    ComputeShader(const std::string &path, const std::string &defines = "");
+
+    static void preload(const std::string &path,
+            const std::string &defines = "");
 
     void set_work_group(const glm::uvec3 &work_group);
     void dispatch_and_wait() const;
+
+    // Work group count is read from buffer at offset, as three uints
+    void dispatch_indirect_and_wait(unsigned int buffer, size_t offset) const;
 };
@@ -0,0 +1,45 @@
+#include "simulator.hpp"
+
+Simulator::~Simulator()
+{}
+
+bool Simulator::compute_metrics(float, Metrics &)
+{
+    return false;
+}
+
+bool Simulator::occupancy_mask(float, std::vector<unsigned char> &)
+{
+    return false;
+}
+
+bool Simulator::trail_density(std::vector<float> &, float)
+{
+    return false;
+}
+
+bool Simulator::set_obstacles(const Obstacles &)
+{
+    return false;
+}
+
+bool Simulator::agent_buffers(unsigned int &, unsigned int &, int &) const
+{
+    return false;
+}
+
+bool Simulator::resize(int, const glm::ivec3 &)
+{
+    return false;
+}
+
+bool Simulator::set_coarse_diffusion(int factor)
+{
+    return factor == 1;
+}
+
+void Simulator::reset_benchmark_counters()
+{}
+
+void Simulator::write_benchmark_fields(std::ostream &, double) const
+{}
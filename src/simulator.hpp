@@ -0,0 +1,84 @@
+#pragma once
+#include <glm/gtc/matrix_transform.hpp>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "texture.hpp"
+#include "trailedit.hpp"
+#include "metrics.hpp"
+#include "obstacles.hpp"
+
+// Common interface of the GPU and CPU simulators
+class Simulator
+{
+public:
+    virtual ~Simulator();
+
+    virtual void update(float dt) = 0;
+
+    virtual const Texture3D *trail() const = 0;
+    virtual glm::ivec3 trail_size() const = 0;
+
+    // Render color of each species channel in the trail
+    virtual std::vector<glm::vec4> species_colors() const = 0;
+
+    // Adds count agents of a species at random points within radius of
+    // center, in voxel coordinates
+    virtual void spawn(const glm::vec3 &center, float radius, int count,
+            int species_id) = 0;
+    // Removes the agents within radius of any of the centers
+    virtual void erase_agents(const std::vector<glm::vec3> &centers,
+            float radius) = 0;
+
+    virtual void edit_trail(const TrailEdit &edit) = 0;
+
+    // Writes the live agents in the format read by Distribution::load.
+    // Returns false if the agents could not be saved.
+    virtual bool save_checkpoint(const std::string &path) const = 0;
+
+    virtual void update_debug_window() = 0;
+
+    // Fills in the metrics of the current trail, with occupied voxels above
+    // threshold. Returns false if the simulator can not compute them.
+    virtual bool compute_metrics(float threshold, Metrics &metrics);
+
+    // One byte per voxel, in x, then y, then z order, set where the summed
+    // trail is above threshold. Returns false if it is not available.
+    virtual bool occupancy_mask(float threshold,
+            std::vector<unsigned char> &mask);
+
+    // Trail summed over all species, one float per voxel in the same order
+    // as occupancy_mask. Calls with the same vector may leave the bricks of
+    // TrailEdit::brick_size where no voxel moved more than tolerance as
+    // they were. Returns false if it is not available.
+    virtual bool trail_density(std::vector<float> &density, float tolerance);
+
+    // Makes the solid voxels walls, which agents steer around and the trail
+    // does not diffuse into. Returns false if the simulator can not use
+    // them.
+    virtual bool set_obstacles(const Obstacles &obstacles);
+
+    // Packed agents on the GPU and an upper bound on their count, along
+    // with the buffer whose first uint is the live count, or 0 if the bound
+    // is the count. Returns false if the agents are not on the GPU.
+    virtual bool agent_buffers(unsigned int &agents,
+            unsigned int &count_buffer, int &bound) const;
+
+    // Changes the volume and the agent count in place. The trail is
+    // resampled into the new volume, agents keep their place relative to
+    // it, and obstacles are dropped. Returns false if the simulator can not
+    // resize.
+    virtual bool resize(int num_agents, const glm::ivec3 &size);
+
+    // Diffuses the trail on a grid factor times coarser than the volume,
+    // or at full resolution for a factor of 1. Returns false if the
+    // simulator can not use the factor.
+    virtual bool set_coarse_diffusion(int factor);
+
+    // Clears what write_benchmark_fields reports, when timing starts
+    virtual void reset_benchmark_counters();
+
+    // Writes extra benchmark report fields, each preceded by a comma
+    virtual void write_benchmark_fields(std::ostream &out,
+            double seconds) const;
+};
@@ -0,0 +1,669 @@
+#include "skeleton.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include "numa.hpp"
+
+// Neighbourhoods are 3x3x3 cubes, indexed by (dx + 1) + 3 (dy + 1) +
+// 9 (dz + 1), with the voxel itself at the center
+static const int center = 13;
+
+// Beyond this, thickness is clamped
+static const int max_radius = 16;
+
+static glm::ivec3 cube_offset(int cell)
+{
+    return glm::ivec3(cell % 3 - 1, (cell / 3) % 3 - 1, cell / 9 - 1);
+}
+
+static int cube_cell(const glm::ivec3 &offset)
+{
+    return (offset.x + 1) + 3 * (offset.y + 1) + 9 * (offset.z + 1);
+}
+
+static int manhattan(const glm::ivec3 &offset)
+{
+    return std::abs(offset.x) + std::abs(offset.y) + std::abs(offset.z);
+}
+
+// Neighbours of every cell within the cube, 26-adjacent among all cells
+// and 6-adjacent among the 18-neighbours of the center, looked up by the
+// simple point test
+struct CubeTables
+{
+    int adjacent26[27][26];
+    int count26[27];
+    int adjacent6[27][6];
+    int count6[27];
+};
+
+static CubeTables build_cube_tables()
+{
+    CubeTables tables = CubeTables();
+    for (int a = 0; a < 27; a++)
+    {
+        for (int b = 0; b < 27; b++)
+        {
+            if (a == b || b == center)
+            {
+                continue;
+            }
+
+            glm::ivec3 d = cube_offset(a) - cube_offset(b);
+            if (std::abs(d.x) <= 1 && std::abs(d.y) <= 1 &&
+                    std::abs(d.z) <= 1)
+            {
+                tables.adjacent26[a][tables.count26[a]++] = b;
+            }
+            if (manhattan(d) == 1 && manhattan(cube_offset(b)) <= 2)
+            {
+                tables.adjacent6[a][tables.count6[a]++] = b;
+            }
+        }
+    }
+
+    return tables;
+}
+
+static const CubeTables &cube_tables()
+{
+    static const CubeTables tables = build_cube_tables();
+    return tables;
+}
+
+// At most one occupied neighbour, so removing it would shorten a curve
+static bool is_end(const bool cube[27])
+{
+    int count = 0;
+    for (int cell = 0; cell < 27; cell++)
+    {
+        count += cell != center && cube[cell] ? 1 : 0;
+    }
+
+    return count <= 1;
+}
+
+// A voxel is simple, and can be removed without changing the topology,
+// when its occupied neighbours are one 26-connected component and its
+// empty 18-neighbours have exactly one 6-connected component that touches
+// its faces
+static bool is_simple(const bool cube[27])
+{
+    const CubeTables &tables = cube_tables();
+    int stack[27];
+    bool seen[27] = {};
+
+    int total = 0;
+    int start = -1;
+    for (int cell = 0; cell < 27; cell++)
+    {
+        if (cell != center && cube[cell])
+        {
+            total++;
+            start = cell;
+        }
+    }
+    if (start < 0)
+    {
+        return false;
+    }
+
+    int top = 0;
+    int reached = 1;
+    stack[top++] = start;
+    seen[start] = true;
+    while (top > 0)
+    {
+        int cell = stack[--top];
+        for (int i = 0; i < tables.count26[cell]; i++)
+        {
+            int other = tables.adjacent26[cell][i];
+            if (cube[other] && !seen[other])
+            {
+                seen[other] = true;
+                stack[top++] = other;
+                reached++;
+            }
+        }
+    }
+    if (reached != total)
+    {
+        return false;
+    }
+
+    // The faces of the center, each adjacent to it
+    static const int faces[6] = {4, 10, 12, 14, 16, 22};
+
+    std::fill(seen, seen + 27, false);
+    int components = 0;
+    for (int face : faces)
+    {
+        if (cube[face] || seen[face])
+        {
+            continue;
+        }
+
+        if (++components > 1)
+        {
+            return false;
+        }
+
+        top = 0;
+        stack[top++] = face;
+        seen[face] = true;
+        while (top > 0)
+        {
+            int cell = stack[--top];
+            for (int i = 0; i < tables.count6[cell]; i++)
+            {
+                int other = tables.adjacent6[cell][i];
+                if (!cube[other] && !seen[other])
+                {
+                    seen[other] = true;
+                    stack[top++] = other;
+                }
+            }
+        }
+    }
+
+    return components == 1;
+}
+
+Skeleton::Skeleton()
+    : size(0)
+{
+    std::vector<int> cpus;
+    for (const std::vector<int> &node : Numa::node_cpus())
+    {
+        cpus.insert(cpus.end(), node.begin(), node.end());
+    }
+
+    this->pool.reset(new WorkerPool(cpus));
+}
+
+void Skeleton::thin(std::vector<unsigned char> &mask, const glm::ivec3 &size)
+{
+    set_size(size);
+
+    // Border voxels are peeled from one side at a time, so a tube thins
+    // towards its middle
+    const glm::ivec3 directions[6] =
+    {
+        glm::ivec3(0, 0, -1), glm::ivec3(0, 0, 1),
+        glm::ivec3(0, -1, 0), glm::ivec3(0, 1, 0),
+        glm::ivec3(-1, 0, 0), glm::ivec3(1, 0, 0),
+    };
+
+    // Voxels of one subfield are never neighbours, so whether one of them
+    // is simple does not depend on the others, and a whole subfield can be
+    // removed in parallel. Subfields alternate along every axis, with the
+    // last layer of an odd axis in a third one, as it wraps onto the first.
+    glm::ivec3 classes;
+    for (int i = 0; i < 3; i++)
+    {
+        classes[i] = size[i] % 2 ? 3 : 2;
+    }
+    int num_subfields = classes.x * classes.y * classes.z;
+
+    auto subfield = [this, &classes](size_t index)
+    {
+        glm::ivec3 position = voxel_position(index);
+        glm::ivec3 parity;
+        for (int i = 0; i < 3; i++)
+        {
+            parity[i] = classes[i] == 3 && position[i] == this->size[i] - 1 ?
+                2 : position[i] % 2;
+        }
+
+        return parity.x + classes.x * (parity.y + classes.y * parity.z);
+    };
+
+    // Every worker keeps the occupied voxels of its layers, so later
+    // passes skip the empty space, and its candidates by subfield
+    int num_workers = this->pool->size();
+    std::vector<std::vector<size_t>> occupied(num_workers);
+    std::vector<std::vector<size_t>> candidates(num_workers * num_subfields);
+    std::vector<unsigned char> removed(num_workers);
+
+    this->pool->run([this, &mask, &occupied, num_workers](int index)
+            {
+                size_t layer = static_cast<size_t>(this->size.x) *
+                    this->size.y;
+                size_t begin = layer * (index * this->size.z / num_workers);
+                size_t end = layer *
+                    ((index + 1) * this->size.z / num_workers);
+
+                for (size_t i = begin; i < end; i++)
+                {
+                    if (mask[i])
+                    {
+                        occupied[index].push_back(i);
+                    }
+                }
+            });
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (const glm::ivec3 &direction : directions)
+        {
+            int side = cube_cell(direction);
+
+            // Most voxels are rejected here
+            this->pool->run([this, &mask, &occupied, &candidates, &subfield,
+                    side, num_subfields](int index)
+                    {
+                        std::vector<size_t> &voxels = occupied[index];
+                        std::vector<size_t> *found =
+                            &candidates[index * num_subfields];
+                        for (int s = 0; s < num_subfields; s++)
+                        {
+                            found[s].clear();
+                        }
+
+                        voxels.erase(std::remove_if(voxels.begin(),
+                                    voxels.end(), [&mask](size_t i)
+                                    {
+                                        return !mask[i];
+                                    }), voxels.end());
+
+                        bool cube[27];
+                        for (size_t i : voxels)
+                        {
+                            neighbourhood(mask, i, cube);
+                            if (!cube[side] && !is_end(cube) &&
+                                    is_simple(cube))
+                            {
+                                found[subfield(i)].push_back(i);
+                            }
+                        }
+                    });
+
+            // Removing a candidate can change whether its neighbours are
+            // simple, so they are checked again one subfield at a time
+            std::fill(removed.begin(), removed.end(), 0);
+            for (int s = 0; s < num_subfields; s++)
+            {
+                this->pool->run([this, &mask, &candidates, &removed, s,
+                        num_subfields](int index)
+                        {
+                            bool cube[27];
+                            for (size_t i :
+                                    candidates[index * num_subfields + s])
+                            {
+                                neighbourhood(mask, i, cube);
+                                if (!is_end(cube) && is_simple(cube))
+                                {
+                                    mask[i] = 0;
+                                    removed[index] = 1;
+                                }
+                            }
+                        });
+            }
+
+            changed = changed || std::find(removed.begin(), removed.end(),
+                    1) != removed.end();
+        }
+    }
+}
+
+Skeleton::Graph Skeleton::extract_graph(
+        const std::vector<unsigned char> &skeleton,
+        const std::vector<unsigned char> &mask, const glm::ivec3 &size)
+{
+    set_size(size);
+
+    size_t voxels = skeleton.size();
+    std::vector<unsigned char> degree(voxels, 0);
+    std::vector<unsigned char> radius(voxels, 0);
+
+    // Skeleton neighbours and the chessboard distance to the empty space
+    // around every skeleton voxel
+    int num_workers = this->pool->size();
+    this->pool->run([this, &skeleton, &mask, &degree, &radius,
+            num_workers](int index)
+            {
+                int z_begin = index * this->size.z / num_workers;
+                int z_end = (index + 1) * this->size.z / num_workers;
+                size_t layer = static_cast<size_t>(this->size.x) *
+                    this->size.y;
+                size_t begin = layer * z_begin;
+                size_t end = layer * z_end;
+
+                for (size_t i = begin; i < end; i++)
+                {
+                    if (!skeleton[i])
+                    {
+                        continue;
+                    }
+
+                    for (int cell = 0; cell < 27; cell++)
+                    {
+                        degree[i] += cell != center &&
+                            skeleton[neighbour(i, cell)] ? 1 : 0;
+                    }
+
+                    glm::ivec3 position = voxel_position(i);
+                    int r = 1;
+                    for (; r < max_radius; r++)
+                    {
+                        bool empty = false;
+                        for (int dz = -r; dz <= r && !empty; dz++)
+                        {
+                            for (int dy = -r; dy <= r && !empty; dy++)
+                            {
+                                // Only the shell at distance r
+                                int step = std::abs(dz) == r ||
+                                    std::abs(dy) == r ? 1 : 2 * r;
+                                for (int dx = -r; dx <= r; dx += step)
+                                {
+                                    glm::ivec3 other = position +
+                                        glm::ivec3(dx, dy, dz);
+                                    if (!mask[voxel_index(other)])
+                                    {
+                                        empty = true;
+                                        break;
+                                    }
+                                }
+                            }
+                        }
+
+                        if (empty)
+                        {
+                            break;
+                        }
+                    }
+
+                    radius[i] = r;
+                }
+            });
+
+    // Voxels that are not in the middle of a tube are node voxels, and
+    // touching node voxels are merged into one node
+    std::vector<size_t> node_voxels;
+    for (size_t i = 0; i < voxels; i++)
+    {
+        if (skeleton[i] && degree[i] != 2)
+        {
+            node_voxels.push_back(i);
+        }
+    }
+
+    std::unordered_map<size_t, int> slot;
+    for (size_t n = 0; n < node_voxels.size(); n++)
+    {
+        slot[node_voxels[n]] = n;
+    }
+
+    std::vector<int> parent(node_voxels.size());
+    for (size_t n = 0; n < parent.size(); n++)
+    {
+        parent[n] = n;
+    }
+
+    auto find = [&parent](int n)
+    {
+        while (parent[n] != n)
+        {
+            parent[n] = parent[parent[n]];
+            n = parent[n];
+        }
+        return n;
+    };
+
+    for (size_t n = 0; n < node_voxels.size(); n++)
+    {
+        for (int cell = 0; cell < 27; cell++)
+        {
+            auto other = slot.find(neighbour(node_voxels[n], cell));
+            if (cell != center && other != slot.end())
+            {
+                int a = find(n);
+                int b = find(other->second);
+                parent[std::max(a, b)] = std::min(a, b);
+            }
+        }
+    }
+
+    Graph graph;
+    std::unordered_map<size_t, int> voxel_node;
+    std::vector<int> root_node(node_voxels.size(), -1);
+    std::vector<int> node_voxel_count;
+    for (size_t n = 0; n < node_voxels.size(); n++)
+    {
+        int root = find(n);
+        if (root_node[root] < 0)
+        {
+            root_node[root] = graph.nodes.size();
+            Node node;
+            node.position = glm::vec3(voxel_position(node_voxels[root]));
+            graph.nodes.push_back(node);
+            node_voxel_count.push_back(0);
+        }
+
+        // Averaged relative to the root voxel, so nodes across the wrap
+        // stay together
+        int id = root_node[root];
+        glm::ivec3 delta = voxel_position(node_voxels[n]) -
+            voxel_position(node_voxels[root]);
+        delta -= size * glm::ivec3(glm::round(glm::vec3(delta) /
+                    glm::vec3(size)));
+
+        Node &node = graph.nodes[id];
+        int count = ++node_voxel_count[id];
+        glm::vec3 root_position = glm::vec3(voxel_position(node_voxels[root]));
+        node.position += (root_position + glm::vec3(delta) - node.position) /
+            static_cast<float>(count);
+
+        voxel_node[node_voxels[n]] = id;
+    }
+
+    std::vector<bool> visited(voxels, false);
+    std::set<std::pair<int, int>> touching;
+
+    // Follows a tube from a node voxel until it reaches another node voxel
+    auto trace = [&](size_t start, int first_cell)
+    {
+        size_t previous = start;
+        size_t current = neighbour(start, first_cell);
+        float length = glm::length(glm::vec3(cube_offset(first_cell)));
+        float radius_sum = radius[start];
+        int samples = 1;
+
+        while (!voxel_node.count(current))
+        {
+            visited[current] = true;
+            radius_sum += radius[current];
+            samples++;
+
+            int next = -1;
+            for (int cell = 0; cell < 27 && next < 0; cell++)
+            {
+                size_t other = neighbour(current, cell);
+                if (cell != center && skeleton[other] && other != previous)
+                {
+                    next = cell;
+                }
+            }
+
+            if (next < 0)
+            {
+                return;
+            }
+
+            previous = current;
+            current = neighbour(current, next);
+            length += glm::length(glm::vec3(cube_offset(next)));
+        }
+
+        radius_sum += radius[current];
+        samples++;
+
+        Edge edge;
+        edge.from = voxel_node[start];
+        edge.to = voxel_node[current];
+        edge.length = length;
+        edge.thickness = 2.0f * radius_sum / samples - 1.0f;
+        graph.edges.push_back(edge);
+    };
+
+    auto trace_node_voxel = [&](size_t voxel)
+    {
+        for (int cell = 0; cell < 27; cell++)
+        {
+            size_t other = neighbour(voxel, cell);
+            if (cell == center || !skeleton[other] || visited[other])
+            {
+                continue;
+            }
+
+            auto node = voxel_node.find(other);
+            if (node == voxel_node.end())
+            {
+                trace(voxel, cell);
+                continue;
+            }
+
+            // Neighbouring voxels of different nodes, joined once
+            int from = voxel_node[voxel];
+            int to = node->second;
+            if (from < to && touching.insert(std::make_pair(from, to)).second)
+            {
+                Edge edge;
+                edge.from = from;
+                edge.to = to;
+                edge.length = glm::length(glm::vec3(cube_offset(cell)));
+                edge.thickness = radius[voxel] + radius[other] - 1.0f;
+                graph.edges.push_back(edge);
+            }
+        }
+    };
+
+    for (size_t voxel : node_voxels)
+    {
+        trace_node_voxel(voxel);
+    }
+
+    // Closed loops without junctions get a node of their own
+    for (size_t i = 0; i < voxels; i++)
+    {
+        if (skeleton[i] && !visited[i] && !voxel_node.count(i))
+        {
+            Node node;
+            node.position = glm::vec3(voxel_position(i));
+            voxel_node[i] = graph.nodes.size();
+            graph.nodes.push_back(node);
+
+            trace_node_voxel(i);
+        }
+    }
+
+    return graph;
+}
+
+bool Skeleton::Graph::write_graphml(const std::string &path) const
+{
+    std::ofstream out(path);
+
+    out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        << "<graphml xmlns=\"http://graphml.graphdrawing.org/xmlns\">\n";
+
+    const char *node_keys[] = {"x", "y", "z"};
+    for (const char *key : node_keys)
+    {
+        out << "  <key id=\"" << key << "\" for=\"node\" attr.name=\""
+            << key << "\" attr.type=\"float\"/>\n";
+    }
+
+    const char *edge_keys[] = {"length", "thickness"};
+    for (const char *key : edge_keys)
+    {
+        out << "  <key id=\"" << key << "\" for=\"edge\" attr.name=\""
+            << key << "\" attr.type=\"float\"/>\n";
+    }
+
+    out << "  <graph id=\"network\" edgedefault=\"undirected\">\n";
+
+    for (size_t i = 0; i < this->nodes.size(); i++)
+    {
+        const glm::vec3 &p = this->nodes[i].position;
+        out << "    <node id=\"n" << i << "\">"
+            << "<data key=\"x\">" << p.x << "</data>"
+            << "<data key=\"y\">" << p.y << "</data>"
+            << "<data key=\"z\">" << p.z << "</data></node>\n";
+    }
+
+    for (const Edge &edge : this->edges)
+    {
+        out << "    <edge source=\"n" << edge.from << "\" target=\"n"
+            << edge.to << "\">"
+            << "<data key=\"length\">" << edge.length << "</data>"
+            << "<data key=\"thickness\">" << edge.thickness
+            << "</data></edge>\n";
+    }
+
+    out << "  </graph>\n</graphml>\n";
+
+    return static_cast<bool>(out);
+}
+
+void Skeleton::set_size(const glm::ivec3 &size)
+{
+    this->size = size;
+    for (int cell = 0; cell < 27; cell++)
+    {
+        glm::ivec3 offset = cube_offset(cell);
+        this->cell_steps[cell] = offset.x + static_cast<std::ptrdiff_t>(
+                size.x) * (offset.y + static_cast<std::ptrdiff_t>(size.y) *
+                offset.z);
+    }
+}
+
+size_t Skeleton::voxel_index(const glm::ivec3 &voxel) const
+{
+    glm::ivec3 wrapped = voxel;
+    for (int i = 0; i < 3; i++)
+    {
+        wrapped[i] = ((wrapped[i] % this->size[i]) + this->size[i]) %
+            this->size[i];
+    }
+
+    return wrapped.x + this->size.x * (wrapped.y +
+            static_cast<size_t>(this->size.y) * wrapped.z);
+}
+
+glm::ivec3 Skeleton::voxel_position(size_t index) const
+{
+    size_t layer = static_cast<size_t>(this->size.x) * this->size.y;
+    return glm::ivec3(index % this->size.x,
+            (index / this->size.x) % this->size.y, index / layer);
+}
+
+size_t Skeleton::neighbour(size_t index, int cell) const
+{
+    return voxel_index(voxel_position(index) + cube_offset(cell));
+}
+
+void Skeleton::neighbourhood(const std::vector<unsigned char> &mask,
+        size_t index, bool cube[27]) const
+{
+    glm::ivec3 position = voxel_position(index);
+
+    bool inner = true;
+    for (int i = 0; i < 3; i++)
+    {
+        inner = inner && position[i] > 0 && position[i] < this->size[i] - 1;
+    }
+
+    for (int cell = 0; cell < 27; cell++)
+    {
+        size_t other = inner ? index + this->cell_steps[cell] :
+            voxel_index(position + cube_offset(cell));
+        cube[cell] = mask[other] != 0;
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "workerpool.hpp"
+
+// Network graph of an occupancy mask. The mask is thinned to a curve
+// skeleton, whose junctions and ends become nodes and whose tubes between
+// them become edges. The volume wraps like the simulation.
+class Skeleton
+{
+public:
+    struct Node
+    {
+        glm::vec3 position;
+    };
+
+    // Length along the skeleton and mean diameter of the tube, in voxels
+    struct Edge
+    {
+        int from;
+        int to;
+        float length;
+        float thickness;
+    };
+
+    struct Graph
+    {
+        std::vector<Node> nodes;
+        std::vector<Edge> edges;
+
+        bool write_graphml(const std::string &path) const;
+    };
+
+private:
+    glm::ivec3 size;
+    std::unique_ptr<WorkerPool> pool;
+
+    // Index steps to the neighbourhood of a voxel away from the borders
+    std::ptrdiff_t cell_steps[27];
+
+public:
+    Skeleton();
+
+    // Removes simple points of the mask until only curves remain, keeping
+    // the ends of the curves and the topology of the mask
+    void thin(std::vector<unsigned char> &mask, const glm::ivec3 &size);
+
+    // Traces the graph of a thinned mask. The original mask gives the
+    // thickness of the tubes.
+    Graph extract_graph(const std::vector<unsigned char> &skeleton,
+            const std::vector<unsigned char> &mask,
+            const glm::ivec3 &size);
+
+private:
+    void set_size(const glm::ivec3 &size);
+    size_t voxel_index(const glm::ivec3 &voxel) const;
+    glm::ivec3 voxel_position(size_t index) const;
+    size_t neighbour(size_t index, int offset) const;
+    void neighbourhood(const std::vector<unsigned char> &mask, size_t index,
+            bool cube[27]) const;
+};
@@ -0,0 +1,167 @@
+#include "slabstore.hpp"
+#include <cstring>
+#include <algorithm>
+#include <cstdlib>
+#include <stdio.h>
+
+#ifndef _WIN32
+#    include <sys/mman.h>
+#    include <fcntl.h>
+#    include <unistd.h>
+#endif
+
+SlabStore::SlabStore()
+    : size(0), layer_size(0), data(nullptr), data_size(0)
+{}
+
+SlabStore::~SlabStore()
+{
+    if (this->pending_read.valid())
+        this->pending_read.wait();
+    if (this->pending_write.valid())
+        this->pending_write.wait();
+
+    if (!this->data)
+        return;
+
+#ifdef _WIN32
+    delete[] this->data;
+#else
+    munmap(this->data, this->data_size);
+#endif
+}
+
+bool SlabStore::initialize(const glm::ivec3 &size, size_t texel_size)
+{
+    this->size = size;
+    this->layer_size = static_cast<size_t>(size.x) * size.y * texel_size;
+    this->data_size = this->layer_size * size.z;
+
+#ifdef _WIN32
+    this->data = new unsigned char[this->data_size]();
+#else
+    // The file is unlinked right away, so it is cleaned up when the mapping
+    // goes away. A sparse file means untouched layers read back as zero.
+    char path[] = "/tmp/physarum-trail-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        printf("Failed to create slab backing file %s\n", path);
+        return false;
+    }
+
+    unlink(path);
+
+    if (ftruncate(fd, this->data_size) != 0)
+    {
+        printf("Failed to resize slab backing file to %zu bytes\n",
+                this->data_size);
+        close(fd);
+        return false;
+    }
+
+    void *mapping = mmap(nullptr, this->data_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+    {
+        printf("Failed to map slab backing file\n");
+        return false;
+    }
+
+    this->data = static_cast<unsigned char *>(mapping);
+#endif
+
+    return true;
+}
+
+bool SlabStore::valid() const
+{
+    return this->data != nullptr;
+}
+
+void *SlabStore::texel(int x, int y, int z) const
+{
+    size_t texel_size = this->layer_size / (this->size.x * this->size.y);
+    size_t offset = z * this->layer_size +
+        (x + y * static_cast<size_t>(this->size.x)) * texel_size;
+
+    return this->data + offset;
+}
+
+size_t SlabStore::layers_size(int depth) const
+{
+    return depth * this->layer_size;
+}
+
+void SlabStore::read_async(void *destination, int z, int depth)
+{
+    this->wait_read();
+
+#ifndef _WIN32
+    int first = ((z % this->size.z) + this->size.z) % this->size.z;
+    int count = std::min(depth, this->size.z - first);
+    madvise(this->data + first * this->layer_size,
+            count * this->layer_size, MADV_WILLNEED);
+#endif
+
+    this->pending_read = std::async(std::launch::async,
+            [this, destination, z, depth]()
+            {
+                this->copy_layers(destination, nullptr, z, depth, false);
+            });
+}
+
+void SlabStore::write_async(const void *source, int z, int depth)
+{
+    this->wait_write();
+
+    this->pending_write = std::async(std::launch::async,
+            [this, source, z, depth]()
+            {
+                this->copy_layers(nullptr, source, z, depth, true);
+            });
+}
+
+void SlabStore::wait_read()
+{
+    if (this->pending_read.valid())
+        this->pending_read.get();
+}
+
+void SlabStore::wait_write()
+{
+    if (this->pending_write.valid())
+        this->pending_write.get();
+}
+
+void SlabStore::copy_layers(void *destination, const void *source,
+        int z, int depth, bool to_store) const
+{
+    // Layers are contiguous, so a range is at most two copies when it wraps
+    int first = ((z % this->size.z) + this->size.z) % this->size.z;
+    size_t done = 0;
+
+    while (depth > 0)
+    {
+        int count = std::min(depth, this->size.z - first);
+        size_t bytes = count * this->layer_size;
+        unsigned char *stored = this->data + first * this->layer_size;
+
+        if (to_store)
+        {
+            memcpy(stored, static_cast<const unsigned char *>(source) + done,
+                    bytes);
+        }
+        else
+        {
+            memcpy(static_cast<unsigned char *>(destination) + done, stored,
+                    bytes);
+        }
+
+        done += bytes;
+        depth -= count;
+        first = 0;
+    }
+}
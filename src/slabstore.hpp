@@ -0,0 +1,39 @@
+#pragma once
+#include <glm/gtc/matrix_transform.hpp>
+#include <future>
+
+// Backing storage for volumes that do not fit on the GPU. The volume is kept
+// in a memory-mapped file and moved in and out in z-layer ranges, which wrap
+// around the z bounds.
+class SlabStore
+{
+private:
+    glm::ivec3 size;
+    size_t layer_size;
+
+    unsigned char *data;
+    size_t data_size;
+
+    std::future<void> pending_read;
+    std::future<void> pending_write;
+
+public:
+    SlabStore();
+    ~SlabStore();
+
+    bool initialize(const glm::ivec3 &size, size_t texel_size);
+    bool valid() const;
+
+    void *texel(int x, int y, int z) const;
+    size_t layers_size(int depth) const;
+
+    void read_async(void *destination, int z, int depth);
+    void write_async(const void *source, int z, int depth);
+
+    void wait_read();
+    void wait_write();
+
+private:
+    void copy_layers(void *destination, const void *source,
+            int z, int depth, bool to_store) const;
+};
@@ -4,136 +4,2418 @@
 #include <cmath>
 #include <limits>
 #include <iostream>
-#include "calc.hpp"
+#include <cstring>
+#include <algorithm>
+#include <cstddef>
+#include <sstream>
 #include "timer.hpp"
 #include "graphics.hpp"
+#include "autotune.hpp"
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-SlimeSimulator::SlimeSimulator(int num_agents, const glm::ivec3 &size)
+// Species channels are half floats, two per texel component
+static const unsigned int half_one = 0x3C00;
+static const unsigned int half_sign = 0x8000;
+
+static void set_species_channel(glm::uvec4 &texel, int species,
+        unsigned int value)
+{
+    int shift = (species % 2) * 16;
+    unsigned int &component = texel[species / 2];
+    component = (component & ~(0xFFFFu << shift)) | (value << shift);
+}
+
+// Channel-wise max of two texels. Trail values are never negative, so the
+// bits of a half compare like its value once negative zero is cleared.
+static unsigned int max_channels(unsigned int a, unsigned int b)
+{
+    unsigned int result = 0;
+    for (int shift = 0; shift < 32; shift += 16)
+    {
+        unsigned int x = (a >> shift) & 0xFFFF;
+        unsigned int y = (b >> shift) & 0xFFFF;
+        x = x == half_sign ? 0 : x;
+        y = y == half_sign ? 0 : y;
+        result |= std::max(x, y) << shift;
+    }
+
+    return result;
+}
+
+// Merges the deposits made between before and after into a stored texel.
+// Deposits only raise a channel, so channels that changed take the max.
+static unsigned int merge_deposit_channels(unsigned int stored,
+        unsigned int before, unsigned int after)
+{
+    unsigned int result = 0;
+    for (int shift = 0; shift < 32; shift += 16)
+    {
+        unsigned int mask = 0xFFFFu << shift;
+        result |= (before & mask) == (after & mask) ? stored & mask :
+            max_channels(stored & mask, after & mask);
+    }
+
+    return result;
+}
+
+static const char *agent_shader_path = "assets/shaders/agent.comp";
+static const char *diffuse_shader_path = "assets/shaders/diffuse.comp";
+static const char *bucket_shader_path = "assets/shaders/bucket.comp";
+static const char *compact_shader_path = "assets/shaders/compact.comp";
+static const char *spawn_shader_path = "assets/shaders/spawn.comp";
+static const char *init_shader_path = "assets/shaders/init.comp";
+static const char *metrics_shader_path = "assets/shaders/metrics.comp";
+static const char *multigrid_shader_path = "assets/shaders/multigrid.comp";
+static const char *summed_area_shader_path =
+    "assets/shaders/summedarea.comp";
+static const char *spatial_hash_shader_path =
+    "assets/shaders/spatialhash.comp";
+static const char *resample_shader_path = "assets/shaders/resample.comp";
+static const char *coarse_shader_path = "assets/shaders/coarsetrail.comp";
+static const char *preview_shader_path = "assets/shaders/preview.comp";
+
+// Used when the driver does not report its memory
+static const size_t default_resident_budget = size_t(2) << 30;
+
+// Half of the video memory that is free when the simulator is made, which
+// leaves room for the agents and everything else on the GPU
+static size_t query_resident_budget()
+{
+    GLint kilobytes[4] = {};
+    if (GLAD_GL_NVX_gpu_memory_info)
+    {
+        glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX,
+                kilobytes);
+    }
+    else if (GLAD_GL_ATI_meminfo)
+    {
+        // The first value is the free memory of the texture pool
+        glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, kilobytes);
+    }
+
+    if (kilobytes[0] <= 0)
+    {
+        return default_resident_budget;
+    }
+
+    return static_cast<size_t>(kilobytes[0]) * 1024 / 2;
+}
+
+std::string SlimeSimulator::variant_defines(const glm::ivec3 &size,
+        int num_species, const glm::ivec3 &local_size,
+        const char *radius_name, int radius)
+{
+    std::ostringstream defines;
+    defines << "#define LOCAL_SIZE_X " << local_size.x << "\n"
+        << "#define LOCAL_SIZE_Y " << local_size.y << "\n"
+        << "#define LOCAL_SIZE_Z " << local_size.z << "\n"
+        << "#define " << radius_name << " " << radius << "\n"
+        << "#define NUM_SPECIES " << num_species << "\n"
+        << "#define BOUNDS ivec3(" << size.x << ", " << size.y << ", "
+        << size.z << ")\n";
+
+    bool pow2 = true;
+    for (int i = 0; i < 3; i++)
+    {
+        pow2 = pow2 && (size[i] & (size[i] - 1)) == 0;
+    }
+    if (pow2)
+    {
+        defines << "#define POW2_BOUNDS\n";
+    }
+
+    return defines.str();
+}
+
+// The agent dispatch sizes are written by compaction
+static std::string compact_defines(const WorkGroups &groups)
+{
+    return "#define AGENT_GROUP_SIZE " + std::to_string(groups.agent) + "\n";
+}
+
+SlimeSimulator::SlimeSimulator(int num_agents, const glm::ivec3 &size,
+        const Distribution &distribution, Transport *transport,
+        int num_species)
     : size(size), num_agents(num_agents),
-    agent_shader("assets/shaders/agent.comp"),
-    diffuse_shader("assets/shaders/diffuse.comp")
+    num_species(std::max(1, std::min(num_species, Species::max_count))),
+    agent_shader(nullptr), diffuse_shader(nullptr), compact_shader(nullptr),
+    summed_area_shader(nullptr), coarse_shader(nullptr),
+    variant_failed(false),
+    selected_sense_size(0), selected_blur_radius(0),
+    selected_summed_area(false), selected_crowding(false),
+    selected_coarse_factor(1),
+    work_groups(Autotune::defaults()),
+    bucket_shader(bucket_shader_path),
+    spawn_shader(spawn_shader_path),
+    init_shader(init_shader_path),
+    metrics_shader(metrics_shader_path),
+    multigrid_shader(multigrid_shader_path),
+    spatial_hash_shader(spatial_hash_shader_path),
+    resample_shader(resample_shader_path),
+    preview_shader(preview_shader_path),
+    vbo_agent(0), ssbo_species(0),
+    dynamic_population(false), ssbo_population(0), ssbo_agent_rank(0),
+    ssbo_group_sum(0), population_readback(0), readback_count(nullptr),
+    count_fence(nullptr), total_spawned(0), spawned_at_fence(0),
+    agent_bound(num_agents),
+    out_of_core(false), slab_depth(size.z), num_slabs(1), halo(0),
+    preview_factor(1),
+    ssbo_labels(0), ssbo_voxel_counts(0), ssbo_metrics(0),
+    ssbo_density(0), ssbo_changed_bricks(0),
+    ssbo_multigrid(), pending_diffusion_steps(0), pending_diffusion_dt(0.0f),
+    ssbo_coarse(), coarse_capacity(0),
+    ssbo_summed_area(0), summed_area_capacity(0),
+    ssbo_cell_counts(0), ssbo_cell_starts(0), ssbo_cell_groups(0),
+    ssbo_neighbours(0), ssbo_cell_slots(0), neighbour_capacity(0),
+    has_obstacles(false), ssbo_obstacle_field(0), ssbo_obstacle_mask(0),
+    transport(transport), distributed(false), connected(true),
+    domain_origin(0), domain_depth(size.z), agent_capacity(num_agents),
+    vbo_sorted_agent(0), ssbo_slab(0),
+    resident_budget(query_resident_budget()), shaders_built(true)
+{
+    species = Species::presets(this->num_species);
+
+    // Every program is checked, so all failed builds print their logs
+    for (const ComputeShader *shader : { &bucket_shader, &spawn_shader,
+            &init_shader, &metrics_shader, &multigrid_shader,
+            &spatial_hash_shader, &resample_shader, &preview_shader })
+    {
+        shaders_built = shader->valid() && shaders_built;
+    }
+    if (!shaders_built)
+    {
+        return;
+    }
+
+    int max_texture_size;
+    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_texture_size);
+
+    size_t layer_size = static_cast<size_t>(size.x) * size.y *
+        sizeof(glm::uvec4);
+    size_t resident_size = 2 * layer_size * size.z;
+
+    int wanted_halo =
+        std::max(max_sense_distance() + max_sense_size, max_blur_radius) + 1;
+
+    if (transport && transport->size() > 1)
+    {
+        distributed = true;
+
+        int rank = transport->rank();
+        int ranks = transport->size();
+        domain_origin = rank * size.z / ranks;
+        domain_depth = (rank + 1) * size.z / ranks - domain_origin;
+
+        // Halos only reach the direct neighbours
+        halo = std::min(wanted_halo, domain_depth);
+        if (halo < wanted_halo)
+        {
+            std::cout << "Rank " << rank << " only has " << domain_depth
+                << " layers, limiting halo to " << halo << "\n";
+        }
+    }
+    else if (resident_size > resident_budget || size.z > max_texture_size)
+    {
+        halo = wanted_halo;
+
+        int window_depth = std::min(
+                static_cast<int>(resident_budget / (2 * layer_size)),
+                max_texture_size);
+
+        // Two neighbouring windows must not wrap onto each other, since the
+        // next window is read while the current one is still being written
+        slab_depth = std::min(window_depth - 2 * halo,
+                (size.z - 2 * halo) / 2);
+        out_of_core = true;
+
+        if (slab_depth < 1)
+        {
+            std::cout << "Trail volume does not fit on the GPU, and its "
+                << size.x << "x" << size.y << " layers are too large to "
+                << "stream through z slabs with a halo of " << halo << "\n";
+            return;
+        }
+    }
+
+    glm::ivec3 window_size = size;
+    if (distributed)
+    {
+        window_size.z = domain_depth + 2 * halo;
+    }
+    else if (out_of_core)
+    {
+        num_slabs = (size.z + slab_depth - 1) / slab_depth;
+
+        if (!slab_store.initialize(size, sizeof(glm::uvec4)))
+        {
+            return;
+        }
+
+        window_size.z = slab_depth + 2 * halo;
+
+        window_staging.resize(slab_store.layers_size(window_size.z));
+        readback_staging.resize(slab_store.layers_size(window_size.z));
+        carry_staging.resize(slab_store.layers_size(halo));
+        wrap_staging.resize(slab_store.layers_size(halo));
+
+        preview_factor = (std::max(size.x, std::max(size.y, size.z)) +
+                preview_max_size - 1) / preview_max_size;
+        preview_texture.initialize(
+                (size + preview_factor - 1) / preview_factor, GL_RGBA32UI);
+        glClearTexImage(preview_texture.get_id(), 0, GL_RGBA_INTEGER,
+                GL_UNSIGNED_INT, nullptr);
+
+        std::cout << "Trail volume does not fit in "
+            << (resident_budget >> 20) << " MiB on the GPU, streaming "
+            << num_slabs << " slabs of " << slab_depth << " layers\n";
+    }
+    else
+    {
+        slab_depth = size.z;
+        halo = 0;
+        dynamic_population = true;
+    }
+
+    trail_texture.initialize(window_size, GL_RGBA32UI);
+    diffused_trail_texture.initialize(window_size, GL_RGBA32UI);
+
+    trail_texture.bind_to_unit(trail_texture_unit);
+    diffused_trail_texture.bind_to_unit(diffused_trail_texture_unit);
+
+    initialize_agents(distribution, window_size);
+
+    glCreateBuffers(1, &ssbo_species);
+    glNamedBufferData(ssbo_species, Species::max_count * sizeof(Species),
+            nullptr, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssbo_species);
+
+    if (out_of_core || distributed)
+    {
+        // Distributed ranks bucket by species once per step and by
+        // neighbour when migrating
+        int buckets = distributed ? std::max(3, this->num_species) :
+            num_slabs * this->num_species;
+
+        glCreateBuffers(1, &vbo_sorted_agent);
+        glNamedBufferData(vbo_sorted_agent, agent_capacity * sizeof(Agent),
+                nullptr, GL_DYNAMIC_COPY);
+
+        glCreateBuffers(1, &ssbo_slab);
+        glNamedBufferData(ssbo_slab, buckets * sizeof(unsigned int),
+                nullptr, GL_DYNAMIC_COPY);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, vbo_sorted_agent);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ssbo_slab);
+    }
+
+    if (dynamic_population)
+    {
+        Population population = Population();
+        population.count = this->num_agents;
+        population.capacity = agent_capacity;
+
+        glCreateBuffers(1, &ssbo_population);
+        glNamedBufferData(ssbo_population, sizeof(Population), &population,
+                GL_DYNAMIC_COPY);
+
+        glCreateBuffers(1, &vbo_sorted_agent);
+        glCreateBuffers(1, &ssbo_agent_rank);
+        glCreateBuffers(1, &ssbo_group_sum);
+        grow_agents(agent_capacity);
+
+        GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT |
+            GL_MAP_COHERENT_BIT;
+        glCreateBuffers(1, &population_readback);
+        glNamedBufferStorage(population_readback, sizeof(unsigned int),
+                nullptr, flags);
+        readback_count = static_cast<const unsigned int *>(
+                glMapNamedBufferRange(population_readback, 0,
+                    sizeof(unsigned int), flags));
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssbo_population);
+    }
+
+    // Ranks share the config file, so only single processes tune
+    std::string tune_key = Autotune::key(size, num_agents);
+    if (!Autotune::load(tune_key, work_groups) && !distributed)
+    {
+        tune_work_groups();
+        Autotune::save(tune_key, work_groups);
+    }
+
+    // The first variants are built here, so a shader that does not build
+    // stops the start instead of failing every step
+    select_variants();
+    for (const ComputeShader *shader :
+            { agent_shader, diffuse_shader, compact_shader })
+    {
+        shaders_built = shader->valid() && shaders_built;
+    }
+}
+
+SlimeSimulator::~SlimeSimulator()
+{
+    glDeleteBuffers(1, &vbo_agent);
+    glDeleteBuffers(1, &ssbo_species);
+    glDeleteBuffers(1, &vbo_sorted_agent);
+    glDeleteBuffers(1, &ssbo_slab);
+
+    if (count_fence)
+    {
+        glDeleteSync(count_fence);
+    }
+    if (population_readback)
+    {
+        glUnmapNamedBuffer(population_readback);
+    }
+
+    glDeleteBuffers(1, &ssbo_population);
+    glDeleteBuffers(1, &ssbo_agent_rank);
+    glDeleteBuffers(1, &ssbo_group_sum);
+    glDeleteBuffers(1, &population_readback);
+
+    glDeleteBuffers(1, &ssbo_labels);
+    glDeleteBuffers(1, &ssbo_voxel_counts);
+    glDeleteBuffers(1, &ssbo_metrics);
+    glDeleteBuffers(1, &ssbo_density);
+    glDeleteBuffers(1, &ssbo_changed_bricks);
+    glDeleteBuffers(3, ssbo_multigrid);
+    glDeleteBuffers(2, ssbo_coarse);
+    glDeleteBuffers(1, &ssbo_summed_area);
+
+    glDeleteBuffers(1, &ssbo_cell_counts);
+    glDeleteBuffers(1, &ssbo_cell_starts);
+    glDeleteBuffers(1, &ssbo_cell_groups);
+    glDeleteBuffers(1, &ssbo_neighbours);
+    glDeleteBuffers(1, &ssbo_cell_slots);
+
+    glDeleteBuffers(1, &ssbo_obstacle_field);
+    glDeleteBuffers(1, &ssbo_obstacle_mask);
+}
+
+void SlimeSimulator::preload_shaders(const glm::ivec3 &size, int num_agents,
+        int num_species)
+{
+    num_species = std::max(1, std::min(num_species, Species::max_count));
+
+    WorkGroups groups = Autotune::defaults();
+    Autotune::load(Autotune::key(size, num_agents), groups);
+
+    ComputeShader::preload(agent_shader_path, variant_defines(size,
+                num_species, glm::ivec3(groups.agent, 1, 1), "SENSE_SIZE",
+                default_sense_size));
+    ComputeShader::preload(diffuse_shader_path, variant_defines(size,
+                num_species, groups.diffuse, "BLUR_RADIUS",
+                default_blur_radius));
+    ComputeShader::preload(bucket_shader_path);
+    ComputeShader::preload(compact_shader_path, compact_defines(groups));
+    ComputeShader::preload(spawn_shader_path);
+    ComputeShader::preload(init_shader_path);
+    ComputeShader::preload(metrics_shader_path);
+    ComputeShader::preload(multigrid_shader_path);
+    ComputeShader::preload(spatial_hash_shader_path);
+    ComputeShader::preload(resample_shader_path);
+    ComputeShader::preload(preview_shader_path);
+}
+
+void SlimeSimulator::initialize_agents(const Distribution &distribution,
+        const glm::ivec3 &window_size)
+{
+    int total = distribution.count(num_agents);
+    int window_origin = distributed ? domain_origin - halo : 0;
+
+    // Ranks generate the share of the agents that matches their share of
+    // the layers, placed within their domain, so the start grows with the
+    // ranks like the volume. Checkpoints hold positions in the whole
+    // volume, so every rank reads all of them and keeps those in its domain.
+    int first = 0;
+    int generated = total;
+    if (distributed && distribution.kind != Distribution::Checkpoint)
+    {
+        first = static_cast<int>(static_cast<long long>(total) *
+                domain_origin / size.z);
+        generated = static_cast<int>(static_cast<long long>(total) *
+                (domain_origin + domain_depth) / size.z) - first;
+    }
+
+    agent_capacity = distributed ? std::max(generated, 64) :
+        std::max(generated, compact_group_size);
+
+    glCreateBuffers(1, &vbo_agent);
+    glNamedBufferData(vbo_agent, agent_capacity * sizeof(Agent), nullptr,
+            GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vbo_agent);
+
+    unsigned int ssbo_counter, ssbo_cdf, ssbo_mask, ssbo_checkpoint;
+    glCreateBuffers(1, &ssbo_counter);
+    glCreateBuffers(1, &ssbo_cdf);
+    glCreateBuffers(1, &ssbo_mask);
+    glCreateBuffers(1, &ssbo_checkpoint);
+
+    unsigned int zero = 0;
+    glNamedBufferData(ssbo_counter, sizeof(unsigned int), &zero,
+            GL_DYNAMIC_COPY);
+
+    // Unused inputs still need a buffer to bind
+    const std::vector<float> &cdf = distribution.cdf;
+    glNamedBufferData(ssbo_cdf,
+            std::max<size_t>(cdf.size(), 1) * sizeof(float),
+            cdf.empty() ? nullptr : cdf.data(), GL_STATIC_DRAW);
+
+    const std::vector<Distribution::Sample> &checkpoint =
+        distribution.checkpoint;
+    glNamedBufferData(ssbo_checkpoint,
+            std::max<size_t>(checkpoint.size(), 1) *
+            sizeof(Distribution::Sample),
+            checkpoint.empty() ? nullptr : checkpoint.data(),
+            GL_STATIC_DRAW);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, ssbo_counter);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, ssbo_cdf);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, ssbo_checkpoint);
+
+    init_shader.bind();
+    init_shader.set_ivec3(bounds_index, size);
+    init_shader.set_int(num_agents_index, generated);
+    init_shader.set_int(init_num_species_index, num_species);
+    init_shader.set_int(seed_index, static_cast<int>(distribution.seed));
+    init_shader.set_int(kind_index, distribution.kind);
+    init_shader.set_int(init_domain_origin_index, domain_origin);
+    init_shader.set_int(init_domain_depth_index, domain_depth);
+    init_shader.set_int(init_window_origin_index, window_origin);
+    init_shader.set_ivec2(image_size_index, distribution.image_size);
+    init_shader.set_int(window_depth_index, window_size.z);
+    init_shader.set_int(first_index_index, first);
+
+    init_shader.set_int(init_stage_index, 0);
+    init_shader.set_work_group(glm::uvec3((generated + 63) / 64, 1, 1));
+    init_shader.dispatch_and_wait();
+
+    // The only sync, to learn how many agents landed in the domain
+    unsigned int count;
+    glGetNamedBufferSubData(ssbo_counter, 0, sizeof(unsigned int), &count);
+    num_agents = count;
+    agent_bound = num_agents;
+
+    if (out_of_core)
+    {
+        // The volume only exists on the host, so mark it from a readback
+        std::vector<Agent> agents(num_agents);
+        glGetNamedBufferSubData(vbo_agent, 0, num_agents * sizeof(Agent),
+                agents.data());
+
+        for (const Agent &agent : agents)
+        {
+            glm::ivec3 voxel = glm::min(glm::ivec3(agent.position(
+                            glm::vec3(size))), size - 1);
+            set_species_channel(*static_cast<glm::uvec4 *>(
+                        slab_store.texel(voxel.x, voxel.y, voxel.z)),
+                    agent.species(), half_one);
+        }
+    }
+    else
+    {
+        // Agents scatter their species bits into a voxel mask, which is then
+        // written to every texel of the window
+        size_t voxels = static_cast<size_t>(size.x) * size.y * window_size.z;
+        glNamedBufferData(ssbo_mask, voxels * sizeof(unsigned int), nullptr,
+                GL_DYNAMIC_COPY);
+        glClearNamedBufferData(ssbo_mask, GL_R32UI, GL_RED_INTEGER,
+                GL_UNSIGNED_INT, nullptr);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, ssbo_mask);
+
+        init_shader.set_int(init_stage_index, 1);
+        init_shader.set_work_group(glm::uvec3((num_agents + 63) / 64, 1, 1));
+        init_shader.dispatch_and_wait();
+
+        init_shader.set_int(init_stage_index, 2);
+        init_shader.set_work_group(glm::uvec3((size.x + 63) / 64, size.y,
+                    window_size.z));
+        init_shader.dispatch_and_wait();
+    }
+
+    glDeleteBuffers(1, &ssbo_counter);
+    glDeleteBuffers(1, &ssbo_cdf);
+    glDeleteBuffers(1, &ssbo_mask);
+    glDeleteBuffers(1, &ssbo_checkpoint);
+
+    // Agents move between ranks, so leave room for the count to vary
+    int capacity = std::max(2 * num_agents, 64);
+    if (distributed && capacity < agent_capacity)
+    {
+        unsigned int agents;
+        glCreateBuffers(1, &agents);
+        glNamedBufferData(agents, capacity * sizeof(Agent), nullptr,
+                GL_DYNAMIC_COPY);
+        glCopyNamedBufferSubData(vbo_agent, agents, 0, 0,
+                num_agents * sizeof(Agent));
+        glDeleteBuffers(1, &vbo_agent);
+        vbo_agent = agents;
+        agent_capacity = capacity;
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vbo_agent);
+    }
+}
+
+bool SlimeSimulator::save_checkpoint(const std::string &path) const
+{
+    // Ranks only hold the agents in their own domain
+    if (distributed)
+    {
+        return false;
+    }
+
+    int count = num_agents;
+    if (dynamic_population)
+    {
+        // The exact count, including agents spawned since the last readback
+        unsigned int live;
+        glGetNamedBufferSubData(ssbo_population, offsetof(Population, count),
+                sizeof(unsigned int), &live);
+        count = std::min(static_cast<int>(live), agent_capacity);
+    }
+
+    std::vector<Agent> agents(count);
+    glGetNamedBufferSubData(vbo_agent, 0, count * sizeof(Agent),
+            agents.data());
+
+    std::vector<Distribution::Sample> samples;
+    samples.reserve(count);
+    for (const Agent &packed : agents)
+    {
+        // Killed since the last compaction
+        PackedAgent::State agent = packed.decode(glm::vec3(size));
+        if (agent.species < 0)
+        {
+            continue;
+        }
+
+        Distribution::Sample sample;
+        sample.position = agent.position;
+        PackedAgent::angles_of(agent.heading, sample.theta, sample.phi);
+        sample.species = agent.species;
+        samples.push_back(sample);
+    }
+
+    return Distribution::save_checkpoint(path, samples);
+}
+
+bool SlimeSimulator::compute_metrics(float threshold, Metrics &metrics)
+{
+    // Needs the whole volume and all agents in this process
+    if (out_of_core || distributed)
+    {
+        return false;
+    }
+
+    glm::ivec3 groups = metrics_groups();
+    int num_groups = groups.x * groups.y * groups.z;
+    size_t voxels = static_cast<size_t>(size.x) * size.y * size.z;
+
+    size_t header_size = metrics_header_size();
+    size_t results_size = header_size + num_groups * sizeof(glm::vec2);
+
+    allocate_metrics_buffers();
+
+    glClearNamedBufferData(ssbo_voxel_counts, GL_R32UI, GL_RED_INTEGER,
+            GL_UNSIGNED_INT, nullptr);
+    glClearNamedBufferData(ssbo_metrics, GL_R32UI, GL_RED_INTEGER,
+            GL_UNSIGNED_INT, nullptr);
+
+    metrics_shader.bind();
+    metrics_shader.set_ivec3(bounds_index, size);
+    metrics_shader.set_float(threshold_index, threshold);
+
+    int group_volume = metrics_group_size * metrics_group_size *
+        metrics_group_size;
+    for (int stage = 0; stage < 6; stage++)
+    {
+        // Component sizes reuse the agent counts once the histogram is done
+        if (stage == 3)
+        {
+            glClearNamedBufferData(ssbo_voxel_counts, GL_R32UI,
+                    GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        }
+
+        // Agents are counted over the bound, the live count is read on the
+        // device
+        metrics_shader.set_int(metrics_stage_index, stage);
+        metrics_shader.set_work_group(stage == 1 ?
+                glm::uvec3((agent_bound + group_volume - 1) / group_volume,
+                    1, 1) :
+                glm::uvec3(groups));
+        metrics_shader.dispatch_and_wait();
+    }
+
+    std::vector<unsigned char> results(results_size);
+    glGetNamedBufferSubData(ssbo_metrics, 0, results_size, results.data());
+
+    const unsigned int *counts =
+        reinterpret_cast<const unsigned int *>(results.data());
+    const glm::vec2 *partial =
+        reinterpret_cast<const glm::vec2 *>(results.data() + header_size);
+
+    double mass = 0.0;
+    double occupied = 0.0;
+    for (int i = 0; i < num_groups; i++)
+    {
+        mass += partial[i].x;
+        occupied += partial[i].y;
+    }
+
+    for (int i = 0; i < Metrics::histogram_bins; i++)
+    {
+        metrics.agent_density[i] = counts[i];
+    }
+
+    unsigned int components = counts[Metrics::histogram_bins];
+    unsigned int largest = counts[Metrics::histogram_bins + 1];
+
+    metrics.trail_mass = mass;
+    metrics.occupancy = static_cast<float>(occupied / voxels);
+    metrics.components = static_cast<int>(components);
+    metrics.largest_component = occupied > 0.0 ?
+        static_cast<float>(largest / occupied) : 0.0f;
+
+    return true;
+}
+
+bool SlimeSimulator::occupancy_mask(float threshold,
+        std::vector<unsigned char> &mask)
+{
+    if (out_of_core || distributed)
+    {
+        return false;
+    }
+
+    allocate_metrics_buffers();
+
+    // Packed to bits on the device, so only a 32nd of the voxel count is
+    // read back
+    size_t voxels = static_cast<size_t>(size.x) * size.y * size.z;
+    size_t words = (voxels + 31) / 32;
+    glClearNamedBufferSubData(ssbo_voxel_counts, GL_R32UI, 0,
+            words * sizeof(unsigned int), GL_RED_INTEGER, GL_UNSIGNED_INT,
+            nullptr);
+
+    metrics_shader.bind();
+    metrics_shader.set_ivec3(bounds_index, size);
+    metrics_shader.set_float(threshold_index, threshold);
+    metrics_shader.set_int(metrics_stage_index, 6);
+    metrics_shader.set_work_group(glm::uvec3(metrics_groups()));
+    metrics_shader.dispatch_and_wait();
+
+    std::vector<unsigned int> bits(words);
+    glGetNamedBufferSubData(ssbo_voxel_counts, 0,
+            words * sizeof(unsigned int), bits.data());
+
+    mask.resize(voxels);
+    for (size_t i = 0; i < voxels; i++)
+    {
+        mask[i] = (bits[i / 32] >> (i % 32)) & 1;
+    }
+
+    return true;
+}
+
+bool SlimeSimulator::trail_density(std::vector<float> &density,
+        float tolerance)
+{
+    if (out_of_core || distributed)
+    {
+        return false;
+    }
+
+    const int brick_size = TrailEdit::brick_size;
+    glm::ivec3 bricks = (size + brick_size - 1) / brick_size;
+    size_t num_bricks = static_cast<size_t>(bricks.x) * bricks.y * bricks.z;
+    size_t brick_voxels = static_cast<size_t>(brick_size) * brick_size *
+        brick_size;
+    size_t voxels = static_cast<size_t>(size.x) * size.y * size.z;
+
+    if (!ssbo_density)
+    {
+        glCreateBuffers(1, &ssbo_density);
+        glNamedBufferData(ssbo_density,
+                num_bricks * brick_voxels * sizeof(float), nullptr,
+                GL_DYNAMIC_COPY);
+
+        glCreateBuffers(1, &ssbo_changed_bricks);
+        glNamedBufferData(ssbo_changed_bricks,
+                num_bricks * sizeof(unsigned int), nullptr, GL_DYNAMIC_READ);
+
+        density.clear();
+    }
+
+    // A new vector, or a new volume, reads back every brick
+    if (density.size() != voxels)
+    {
+        float unknown = std::numeric_limits<float>::max();
+        glClearNamedBufferData(ssbo_density, GL_R32F, GL_RED, GL_FLOAT,
+                &unknown);
+        density.assign(voxels, 0.0f);
+    }
+
+    glClearNamedBufferData(ssbo_changed_bricks, GL_R32UI, GL_RED_INTEGER,
+            GL_UNSIGNED_INT, nullptr);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 31, ssbo_density);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 32, ssbo_changed_bricks);
+
+    metrics_shader.bind();
+    metrics_shader.set_ivec3(bounds_index, size);
+    metrics_shader.set_float(threshold_index, tolerance);
+    metrics_shader.set_work_group(glm::uvec3(metrics_groups()));
+    for (int stage = 7; stage <= 8; stage++)
+    {
+        metrics_shader.set_int(metrics_stage_index, stage);
+        metrics_shader.dispatch_and_wait();
+    }
+
+    changed_bricks.resize(num_bricks);
+    glGetNamedBufferSubData(ssbo_changed_bricks, 0,
+            num_bricks * sizeof(unsigned int), changed_bricks.data());
+
+    brick_staging.resize(brick_voxels);
+    for (size_t b = 0; b < num_bricks; b++)
+    {
+        if (!changed_bricks[b])
+        {
+            continue;
+        }
+
+        glGetNamedBufferSubData(ssbo_density,
+                b * brick_voxels * sizeof(float),
+                brick_voxels * sizeof(float), brick_staging.data());
+
+        glm::ivec3 origin = brick_size * glm::ivec3(b % bricks.x,
+                (b / bricks.x) % bricks.y, b / (bricks.x * bricks.y));
+        glm::ivec3 end = glm::min(origin + brick_size, size);
+        for (int z = origin.z; z < end.z; z++)
+        {
+            for (int y = origin.y; y < end.y; y++)
+            {
+                const float *row = &brick_staging[brick_size *
+                    ((y - origin.y) + brick_size * (z - origin.z))];
+                std::copy(row, row + (end.x - origin.x),
+                        &density[origin.x + size.x *
+                        (y + static_cast<size_t>(size.y) * z)]);
+            }
+        }
+    }
+
+    return true;
+}
+
+bool SlimeSimulator::set_obstacles(const Obstacles &obstacles)
+{
+    if (out_of_core || distributed || obstacles.empty() ||
+            obstacles.size != size)
+    {
+        return false;
+    }
+
+    // Packed to bits for the diffuse pass, which reads a box of them
+    size_t voxels = obstacles.mask.size();
+    std::vector<unsigned int> bits((voxels + 31) / 32, 0u);
+    for (size_t i = 0; i < voxels; i++)
+    {
+        bits[i / 32] |= static_cast<unsigned int>(obstacles.mask[i] != 0) <<
+            (i % 32);
+    }
+
+    if (!ssbo_obstacle_field)
+    {
+        glCreateBuffers(1, &ssbo_obstacle_field);
+        glCreateBuffers(1, &ssbo_obstacle_mask);
+    }
+
+    glNamedBufferData(ssbo_obstacle_field, voxels * sizeof(glm::vec4),
+            obstacles.field.data(), GL_STATIC_DRAW);
+    glNamedBufferData(ssbo_obstacle_mask, bits.size() * sizeof(unsigned int),
+            bits.data(), GL_STATIC_DRAW);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 25, ssbo_obstacle_field);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 26, ssbo_obstacle_mask);
+
+    // The variants that read them are selected on the next step
+    has_obstacles = true;
+    agent_shader = nullptr;
+
+    return true;
+}
+
+bool SlimeSimulator::agent_buffers(unsigned int &agents,
+        unsigned int &count_buffer, int &bound) const
+{
+    // Each rank only holds the agents of its own layers
+    if (distributed)
+    {
+        return false;
+    }
+
+    agents = vbo_agent;
+    count_buffer = dynamic_population ? ssbo_population : 0;
+    bound = dynamic_population ? agent_bound : num_agents;
+
+    return true;
+}
+
+bool SlimeSimulator::resize(int count, const glm::ivec3 &new_size)
+{
+    // Out-of-core windows and rank domains are laid out for the initial
+    // volume
+    int smallest = std::min(new_size.x, std::min(new_size.y, new_size.z));
+    int largest = std::max(new_size.x, std::max(new_size.y, new_size.z));
+    if (!dynamic_population || count < 0 || smallest < 1)
+    {
+        return false;
+    }
+
+    // Volumes that would need streaming are refused
+    int max_texture_size;
+    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_texture_size);
+    size_t resident_size = 2 * static_cast<size_t>(new_size.x) * new_size.y *
+        new_size.z * sizeof(glm::uvec4);
+    if (resident_size > resident_budget || largest > max_texture_size)
+    {
+        return false;
+    }
+
+    if (new_size != size)
+    {
+        resample_trail(new_size);
+    }
+    resize_population(count);
+
+    return true;
+}
+
+void SlimeSimulator::resample_trail(const glm::ivec3 &new_size)
+{
+    // Texture storage is immutable, so the trail is resampled into a new
+    // texture. The diffused trail is written before it is read every step.
+    Texture3D resampled;
+    resampled.initialize(new_size, GL_RGBA32UI);
+    resampled.bind_to_unit(diffused_trail_texture_unit);
+
+    resample_shader.bind();
+    resample_shader.set_ivec3(bounds_index, new_size);
+    resample_shader.set_ivec3(source_bounds_index, size);
+    resample_shader.set_work_group(glm::uvec3(
+                (new_size + resample_group_size - 1) / resample_group_size));
+    resample_shader.dispatch_and_wait();
+
+    trail_texture = std::move(resampled);
+    diffused_trail_texture = Texture3D();
+    diffused_trail_texture.initialize(new_size, GL_RGBA32UI);
+
+    trail_texture.bind_to_unit(trail_texture_unit);
+    diffused_trail_texture.bind_to_unit(diffused_trail_texture_unit);
+
+    size = new_size;
+    slab_depth = size.z;
+    domain_depth = size.z;
+
+    // Buffers sized by the volume are made again when next used, except
+    // the summed area table, which grows by itself
+    glDeleteBuffers(1, &ssbo_labels);
+    glDeleteBuffers(1, &ssbo_voxel_counts);
+    glDeleteBuffers(1, &ssbo_metrics);
+    glDeleteBuffers(1, &ssbo_density);
+    glDeleteBuffers(1, &ssbo_changed_bricks);
+    ssbo_labels = ssbo_voxel_counts = ssbo_metrics = 0;
+    ssbo_density = ssbo_changed_bricks = 0;
+
+    glDeleteBuffers(3, ssbo_multigrid);
+    ssbo_multigrid[0] = ssbo_multigrid[1] = ssbo_multigrid[2] = 0;
+    multigrid_levels.clear();
+
+    glDeleteBuffers(1, &ssbo_cell_counts);
+    glDeleteBuffers(1, &ssbo_cell_starts);
+    glDeleteBuffers(1, &ssbo_cell_groups);
+    ssbo_cell_counts = ssbo_cell_starts = ssbo_cell_groups = 0;
+
+    // Obstacles were voxelized for the old volume, and the variants take
+    // the bounds as a constant
+    has_obstacles = false;
+    agent_shader = nullptr;
+}
+
+void SlimeSimulator::resize_population(int count)
+{
+    // The exact count, as for checkpoints
+    unsigned int live;
+    glGetNamedBufferSubData(ssbo_population, offsetof(Population, count),
+            sizeof(unsigned int), &live);
+    int current = std::min(static_cast<int>(live), agent_capacity);
+    if (count == current)
+    {
+        return;
+    }
+
+    int added = count - current;
+    if (added > 0)
+    {
+        poll_agent_count();
+        if (agent_bound + added > agent_capacity)
+        {
+            grow_agents(std::max(2 * agent_capacity, agent_bound + added));
+        }
+    }
+
+    // New agents are spread over the volume and the species, and surplus
+    // agents are killed evenly over the species
+    spawn_shader.bind();
+    spawn_shader.set_ivec3(bounds_index, size);
+    spawn_shader.set_float(time_index, Timer::time());
+    spawn_shader.set_int(spawn_count_index, added > 0 ? added : count);
+    spawn_shader.set_int(spawn_mode_index, added > 0 ? 2 : 3);
+    spawn_shader.set_int(spawn_num_species_index, num_species);
+    spawn_shader.set_work_group(glm::uvec3(
+                ((added > 0 ? added : current) + 63) / 64, 1, 1));
+    spawn_shader.dispatch_and_wait();
+
+    if (added > 0)
+    {
+        agent_bound += added;
+        total_spawned += added;
+    }
+}
+
+glm::ivec3 SlimeSimulator::metrics_groups() const
+{
+    return (size + metrics_group_size - 1) / metrics_group_size;
+}
+
+size_t SlimeSimulator::metrics_header_size() const
+{
+    // Histogram, components, largest and padding
+    return (Metrics::histogram_bins + 4) * sizeof(unsigned int);
+}
+
+void SlimeSimulator::allocate_metrics_buffers()
+{
+    if (!ssbo_labels)
+    {
+        glm::ivec3 groups = metrics_groups();
+        size_t voxels = static_cast<size_t>(size.x) * size.y * size.z;
+
+        glCreateBuffers(1, &ssbo_labels);
+        glNamedBufferData(ssbo_labels, voxels * sizeof(unsigned int),
+                nullptr, GL_DYNAMIC_COPY);
+
+        glCreateBuffers(1, &ssbo_voxel_counts);
+        glNamedBufferData(ssbo_voxel_counts, voxels * sizeof(unsigned int),
+                nullptr, GL_DYNAMIC_COPY);
+
+        // Followed by the partial sums of every work group
+        glCreateBuffers(1, &ssbo_metrics);
+        glNamedBufferData(ssbo_metrics, metrics_header_size() +
+                groups.x * groups.y * groups.z * sizeof(glm::vec2),
+                nullptr, GL_DYNAMIC_READ);
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, ssbo_labels);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, ssbo_voxel_counts);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, ssbo_metrics);
+}
+
+bool SlimeSimulator::valid() const
+{
+    return shaders_built &&
+        (!out_of_core || (slab_depth >= 1 && slab_store.valid()));
+}
+
+void SlimeSimulator::update(float dt)
+{
+    if (distributed && !broadcast_control(dt))
+    {
+        return;
+    }
+
+    float step_dt = dt / static_cast<float>(steps_per_frame);
+    for (size_t i = 0; i < steps_per_frame; i++)
+    {
+        step_update(step_dt);
+    }
+}
+
+bool SlimeSimulator::follow()
+{
+    float dt = 0.0f;
+    if (!broadcast_control(dt))
+    {
+        return false;
+    }
+
+    float step_dt = dt / static_cast<float>(steps_per_frame);
+    for (size_t i = 0; i < steps_per_frame && connected; i++)
+    {
+        step_update(step_dt);
+    }
+
+    return connected;
+}
+
+void SlimeSimulator::step_update(float dt)
+{
+    select_variants();
+
+    glNamedBufferSubData(ssbo_species, 0, num_species * sizeof(Species),
+            species.data());
+
+    if (out_of_core)
+    {
+        step_update_out_of_core(dt);
+        return;
+    }
+
+    if (distributed)
+    {
+        step_update_distributed(dt);
+        return;
+    }
+
+    if (summed_area_sensing)
+    {
+        dispatch_summed_area();
+    }
+
+    compact_agents();
+    if (crowding)
+    {
+        build_spatial_hash();
+    }
+
+    for (int s = 0; s < num_species; s++)
+    {
+        dispatch_agents_indirect(dt, s);
+    }
+
+    if (implicit_diffusion)
+    {
+        // Deposits collect in the trail until the next diffusion step
+        pending_diffusion_dt += dt;
+        if (++pending_diffusion_steps >= diffusion_interval)
+        {
+            dispatch_implicit_diffuse(pending_diffusion_dt);
+            pending_diffusion_steps = 0;
+            pending_diffusion_dt = 0.0f;
+        }
+    }
+    else if (selected_coarse_factor > 1)
+    {
+        dispatch_coarse_diffuse(dt);
+    }
+    else
+    {
+        dispatch_diffuse(dt, 0, 0, size.z);
+
+        trail_texture.copy(&diffused_trail_texture);
+    }
+
+    request_agent_count();
+}
+
+void SlimeSimulator::step_update_out_of_core(float dt)
+{
+    bucket_agents(0, slab_depth, num_slabs, num_species);
+
+    size_t halo_size = slab_store.layers_size(halo);
+
+    slab_store.read_async(window_staging.data(), -halo,
+            slab_depth + 2 * halo);
+
+    for (int slab = 0; slab < num_slabs; slab++)
+    {
+        int core_origin = slab * slab_depth;
+        int core_depth = std::min(slab_depth, size.z - core_origin);
+        int window_origin = core_origin - halo;
+        int window_depth = core_depth + 2 * halo;
+
+        slab_store.wait_read();
+
+        // Layers past the top wrap onto the bottom of the volume, which is
+        // stepped first, so the windows up there read it from before
+        int past_top = window_origin + window_depth - size.z;
+        int read = std::min(past_top, core_depth);
+        if (slab == 0)
+        {
+            memcpy(wrap_staging.data(), window_staging.data() + halo_size,
+                    halo_size);
+        }
+        else if (read > 0)
+        {
+            memcpy(window_staging.data() +
+                    slab_store.layers_size(window_depth - read),
+                    wrap_staging.data() +
+                    slab_store.layers_size(past_top - read),
+                    slab_store.layers_size(read));
+        }
+
+        trail_texture.set_sub_data(window_staging.data(),
+                0, 0, 0, size.x, size.y, window_depth);
+
+        // The next window shares 2 * halo layers with this one. The top of
+        // this core is carried over from before the step, and the layers
+        // above it with the deposits made in them. The rest is read while
+        // this slab is processed.
+        if (slab + 1 < num_slabs)
+        {
+            memcpy(carry_staging.data(), window_staging.data() +
+                    slab_store.layers_size(core_depth), halo_size);
+
+            int next_origin = core_origin + core_depth;
+            int next_depth = std::min(slab_depth, size.z - next_origin);
+            slab_store.read_async(window_staging.data() + 2 * halo_size,
+                    next_origin + halo, next_depth);
+        }
+
+        dispatch_slab(dt, slab, window_origin);
+        dispatch_diffuse(dt, window_origin, core_origin, core_depth);
+
+        trail_texture.copy_sub(&diffused_trail_texture,
+                0, 0, halo, size.x, size.y, core_depth);
+        update_preview(core_origin, core_depth);
+
+        slab_store.wait_write();
+        trail_texture.get_sub_data(readback_staging.data(),
+                0, 0, 0, size.x, size.y, window_depth,
+                readback_staging.size());
+
+        // Deposits in the lower halo, and above the last window, belong to
+        // cores that were already stepped
+        const unsigned char *upper_halo = readback_staging.data() +
+            slab_store.layers_size(halo + core_depth);
+        merge_halo_deposits(window_staging.data(), readback_staging.data(),
+                window_origin);
+        if (slab + 1 < num_slabs)
+        {
+            memcpy(window_staging.data(), carry_staging.data(), halo_size);
+            memcpy(window_staging.data() + halo_size, upper_halo,
+                    halo_size);
+        }
+        else
+        {
+            merge_halo_deposits(wrap_staging.data(), upper_halo,
+                    core_origin + core_depth);
+        }
+
+        slab_store.write_async(readback_staging.data() + halo_size,
+                core_origin, core_depth);
+    }
+
+    slab_store.wait_write();
+}
+
+// Halo layers hold the trail from before the step with the deposits of
+// this window, while the store may already hold the stepped trail there
+void SlimeSimulator::merge_halo_deposits(const unsigned char *before,
+        const unsigned char *after, int z)
+{
+    size_t texels = static_cast<size_t>(size.x) * size.y;
+    const glm::uvec4 *old_texels =
+        reinterpret_cast<const glm::uvec4 *>(before);
+    const glm::uvec4 *new_texels =
+        reinterpret_cast<const glm::uvec4 *>(after);
+
+    for (int layer = 0; layer < halo; layer++)
+    {
+        int stored_z = ((z + layer) % size.z + size.z) % size.z;
+        glm::uvec4 *stored =
+            static_cast<glm::uvec4 *>(slab_store.texel(0, 0, stored_z));
+
+        for (size_t i = 0; i < texels; i++)
+        {
+            size_t t = layer * texels + i;
+            for (int c = 0; c < 4; c++)
+            {
+                stored[i][c] = merge_deposit_channels(stored[i][c],
+                        old_texels[t][c], new_texels[t][c]);
+            }
+        }
+    }
+}
+
+void SlimeSimulator::update_preview(int core_origin, int core_depth)
+{
+    int first = core_origin / preview_factor;
+    int last = (core_origin + core_depth - 1) / preview_factor;
+    glm::ivec3 preview_size = preview_texture.get_size();
+
+    // The diffused trail is not needed again until the next window
+    preview_texture.bind_to_unit(diffused_trail_texture_unit);
+
+    preview_shader.bind();
+    preview_shader.set_ivec3(bounds_index, size);
+    preview_shader.set_int(preview_factor_index, preview_factor);
+    preview_shader.set_int(preview_halo_index, halo);
+    preview_shader.set_int(core_origin_index, core_origin);
+    preview_shader.set_int(core_depth_index, core_depth);
+    preview_shader.set_work_group(glm::uvec3(
+                (glm::ivec3(preview_size.x, preview_size.y,
+                            last - first + 1) + preview_group_size - 1) /
+                preview_group_size));
+    preview_shader.dispatch_and_wait();
+
+    diffused_trail_texture.bind_to_unit(diffused_trail_texture_unit);
+}
+
+void SlimeSimulator::step_update_distributed(float dt)
+{
+    int window_origin = domain_origin - halo;
+
+    exchange_halo();
+
+    // Arrivals from the last migration are not sorted by species yet
+    bucket_agents(domain_origin, domain_depth, 1, num_species);
+    dispatch_slab(dt, 0, window_origin);
+    return_halo_deposits(dt);
+
+    dispatch_diffuse(dt, window_origin, domain_origin, domain_depth);
+    trail_texture.copy_sub(&diffused_trail_texture,
+            0, 0, halo, size.x, size.y, domain_depth);
+
+    migrate_agents();
+}
+
+bool SlimeSimulator::broadcast_control(float &dt)
+{
+    int rank = transport->rank();
+    bool last = rank == transport->size() - 1;
+
+    size_t species_size = num_species * sizeof(Species);
+    std::vector<unsigned char> data(sizeof(StepControl) + species_size);
+    StepControl control;
+
+    if (rank == 0)
+    {
+        control.dt = dt;
+        control.sense_size = sense_size;
+        control.diffuse_speed = diffuse_speed;
+        control.decay_speed = decay_speed;
+        control.blur_radius = blur_radius;
+
+        memcpy(data.data(), &control, sizeof(control));
+        memcpy(data.data() + sizeof(control), species.data(), species_size);
+    }
+    else
+    {
+        if (!transport->receive(-1, data) ||
+                data.size() != sizeof(control) + species_size)
+        {
+            connected = false;
+            return false;
+        }
+
+        memcpy(&control, data.data(), sizeof(control));
+        memcpy(species.data(), data.data() + sizeof(control), species_size);
+
+        dt = control.dt;
+        sense_size = control.sense_size;
+        diffuse_speed = control.diffuse_speed;
+        decay_speed = control.decay_speed;
+        blur_radius = control.blur_radius;
+    }
+
+    if (!last && !transport->send(1, data))
+    {
+        connected = false;
+    }
+
+    return connected;
+}
+
+void SlimeSimulator::exchange_halo()
+{
+    size_t halo_size = static_cast<size_t>(size.x) * size.y * halo *
+        sizeof(glm::uvec4);
+    std::vector<unsigned char> boundary(halo_size);
+    std::vector<unsigned char> received;
+
+    // Top of this domain goes up, the lower halo comes from below
+    trail_texture.get_sub_data(boundary.data(), 0, 0, domain_depth,
+            size.x, size.y, halo, halo_size);
+    connected = transport->shift(1, boundary, received) && connected;
+    if (received.size() == halo_size)
+    {
+        trail_texture.set_sub_data(received.data(),
+                0, 0, 0, size.x, size.y, halo);
+    }
+
+    // Bottom of this domain goes down, the upper halo comes from above
+    trail_texture.get_sub_data(boundary.data(), 0, 0, halo,
+            size.x, size.y, halo, halo_size);
+    connected = transport->shift(-1, boundary, received) && connected;
+    if (received.size() == halo_size)
+    {
+        trail_texture.set_sub_data(received.data(),
+                0, 0, halo + domain_depth, size.x, size.y, halo);
+    }
+}
+
+void SlimeSimulator::return_halo_deposits(float dt)
+{
+    // Agents that left the domain this step deposited in the halo layers
+    // next to it. Those are sent back to their owner, which merges them with
+    // max since deposits only move the trail of a species towards one.
+    int depth = std::min(halo,
+            static_cast<int>(std::ceil(max_move_speed() * dt)) + 1);
+    size_t layers = static_cast<size_t>(size.x) * size.y * depth;
+    size_t deposit_size = layers * sizeof(glm::uvec4);
+
+    std::vector<unsigned char> deposits(deposit_size);
+    std::vector<unsigned char> received;
+    std::vector<glm::uvec4> own(layers);
+
+    // Lower halo belongs to the rank below, received deposits belong on top
+    trail_texture.get_sub_data(deposits.data(), 0, 0, halo - depth,
+            size.x, size.y, depth, deposit_size);
+    connected = transport->shift(-1, deposits, received) && connected;
+    if (received.size() == deposit_size)
+    {
+        int oz = halo + domain_depth - depth;
+        const glm::uvec4 *incoming =
+            reinterpret_cast<const glm::uvec4 *>(received.data());
+
+        trail_texture.get_sub_data(own.data(), 0, 0, oz,
+                size.x, size.y, depth, deposit_size);
+        for (size_t i = 0; i < layers; i++)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                own[i][c] = max_channels(own[i][c], incoming[i][c]);
+            }
+        }
+        trail_texture.set_sub_data(own.data(), 0, 0, oz,
+                size.x, size.y, depth);
+    }
+
+    // Upper halo belongs to the rank above, received deposits belong below
+    trail_texture.get_sub_data(deposits.data(), 0, 0, halo + domain_depth,
+            size.x, size.y, depth, deposit_size);
+    connected = transport->shift(1, deposits, received) && connected;
+    if (received.size() == deposit_size)
+    {
+        const glm::uvec4 *incoming =
+            reinterpret_cast<const glm::uvec4 *>(received.data());
+
+        trail_texture.get_sub_data(own.data(), 0, 0, halo,
+                size.x, size.y, depth, deposit_size);
+        for (size_t i = 0; i < layers; i++)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                own[i][c] = max_channels(own[i][c], incoming[i][c]);
+            }
+        }
+        trail_texture.set_sub_data(own.data(), 0, 0, halo,
+                size.x, size.y, depth);
+    }
+}
+
+void SlimeSimulator::migrate_agents()
+{
+    // Buckets are the domain below, this domain and the domain above
+    bucket_agents(domain_origin - domain_depth, domain_depth, 3, 1);
+
+    std::vector<unsigned char> below(slab_agent_counts[0] * sizeof(Agent));
+    std::vector<unsigned char> above(slab_agent_counts[2] * sizeof(Agent));
+    std::vector<unsigned char> from_above;
+    std::vector<unsigned char> from_below;
+
+    if (!below.empty())
+    {
+        glGetNamedBufferSubData(vbo_agent,
+                slab_agent_offsets[0] * sizeof(Agent),
+                below.size(), below.data());
+    }
+    if (!above.empty())
+    {
+        glGetNamedBufferSubData(vbo_agent,
+                slab_agent_offsets[2] * sizeof(Agent),
+                above.size(), above.data());
+    }
+
+    connected = transport->shift(-1, below, from_above) && connected;
+    connected = transport->shift(1, above, from_below) && connected;
+
+    int kept = slab_agent_counts[1];
+    int arrived = (from_above.size() + from_below.size()) / sizeof(Agent);
+    int count = kept + arrived;
+
+    bool grow = count > agent_capacity;
+    if (grow)
+    {
+        agent_capacity = std::max(count, 2 * agent_capacity);
+        glNamedBufferData(vbo_sorted_agent, agent_capacity * sizeof(Agent),
+                nullptr, GL_DYNAMIC_COPY);
+    }
+
+    // Kept agents are compacted to the front, followed by the arrivals
+    size_t kept_size = kept * sizeof(Agent);
+    if (kept)
+    {
+        glCopyNamedBufferSubData(vbo_agent, vbo_sorted_agent,
+                slab_agent_offsets[1] * sizeof(Agent), 0, kept_size);
+    }
+    if (!from_above.empty())
+    {
+        glNamedBufferSubData(vbo_sorted_agent, kept_size,
+                from_above.size(), from_above.data());
+    }
+    if (!from_below.empty())
+    {
+        glNamedBufferSubData(vbo_sorted_agent, kept_size + from_above.size(),
+                from_below.size(), from_below.data());
+    }
+
+    std::swap(vbo_agent, vbo_sorted_agent);
+    if (grow)
+    {
+        glNamedBufferData(vbo_sorted_agent, agent_capacity * sizeof(Agent),
+                nullptr, GL_DYNAMIC_COPY);
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vbo_agent);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, vbo_sorted_agent);
+
+    num_agents = count;
+}
+
+void SlimeSimulator::spawn(const glm::vec3 &center, float radius, int count,
+        int species_id)
 {
-    assert(agent_shader.valid());
-    assert(diffuse_shader.valid());
+    if (!dynamic_population || count <= 0)
+    {
+        return;
+    }
 
-    trail_texture.initialize(size, GL_RGBA32F);
-    diffused_trail_texture.initialize(size, GL_RGBA32F);
+    poll_agent_count();
+
+    if (agent_bound + count > agent_capacity)
+    {
+        grow_agents(std::max(2 * agent_capacity, agent_bound + count));
+    }
 
-    std::vector<glm::vec4> trail_pixels(size.x * size.y * size.z,
-            glm::vec4(0.0f, 0.0f, 0.0f, 0.0f));
+    spawn_shader.bind();
+    spawn_shader.set_ivec3(bounds_index, size);
+    spawn_shader.set_float(time_index, Timer::time());
+    spawn_shader.set_int(spawn_count_index, count);
+    spawn_shader.set_vec3(spawn_center_index, center);
+    spawn_shader.set_float(spawn_radius_index, radius);
+    spawn_shader.set_int(spawn_species_index,
+            glm::clamp(species_id, 0, num_species - 1));
+    spawn_shader.set_int(spawn_mode_index, 0);
+    spawn_shader.set_work_group(glm::uvec3((count + 63) / 64, 1, 1));
+    spawn_shader.dispatch_and_wait();
 
-    float maxrad = std::min(size.x, std::min(size.y, size.z)) / 2.0f;
-    glm::vec3 center = glm::vec3(size) / 2.0f;
+    agent_bound += count;
+    total_spawned += count;
+}
 
-    std::vector<Agent> agents(this->num_agents);
-    for (auto &agent : agents)
+void SlimeSimulator::erase_agents(const std::vector<glm::vec3> &centers,
+        float radius)
+{
+    // Killed agents are removed by compaction, which only exists with a
+    // dynamic population
+    if (!dynamic_population || centers.empty())
     {
-        float randtheta = Calc::frand() * 2.0f * glm::pi<float>();
-        float randphi = Calc::frand() * 2.0f * glm::pi<float>();
-        float r = Calc::frand() * maxrad;
-        agent.position.x = center.x +
-            glm::sin(randphi) * glm::cos(randtheta) * r;
-        agent.position.y = center.y +
-            glm::sin(randphi) * glm::sin(randtheta) * r;
-        agent.position.z = center.z + glm::cos(randphi) * r;
-        agent.theta = randtheta + glm::pi<float>();
-        agent.phi = randphi + glm::pi<float>();
+        return;
+    }
 
-        agent.color = glm::vec4(1.0f);
+    spawn_shader.bind();
+    spawn_shader.set_ivec3(bounds_index, size);
+    spawn_shader.set_float(spawn_radius_index, radius);
+    spawn_shader.set_int(spawn_mode_index, 1);
+    spawn_shader.set_work_group(glm::uvec3((agent_bound + 63) / 64, 1, 1));
 
-        int px = std::floor(agent.position.x);
-        int py = std::floor(agent.position.y);
-        int pz = std::floor(agent.position.z);
+    // A brush stroke fits in one dispatch, so every agent is read once
+    int num_centers = centers.size();
+    for (int first = 0; first < num_centers; first += max_erase_centers)
+    {
+        int count = std::min(max_erase_centers, num_centers - first);
+        spawn_shader.set_int(spawn_num_centers_index, count);
+        for (int i = 0; i < count; i++)
+        {
+            spawn_shader.set_vec3(spawn_centers_index + i,
+                    centers[first + i]);
+        }
 
-        trail_pixels[px + py * size.x + pz * size.y * size.x] = agent.color;
+        spawn_shader.dispatch_and_wait();
     }
+}
 
-    trail_texture.set_data(trail_pixels.data());
+void SlimeSimulator::edit_trail(const TrailEdit &edit)
+{
+    // Ranks only hold their own domain
+    if (distributed)
+    {
+        return;
+    }
 
-    trail_texture.bind_to_unit(trail_texture_unit);
-    diffused_trail_texture.bind_to_unit(diffused_trail_texture_unit);
+    for (const TrailEdit::Box &box : edit.dirty_boxes(size))
+    {
+        size_t count = static_cast<size_t>(box.size.x) * box.size.y *
+            box.size.z;
 
-    glCreateBuffers(1, &vbo_agent);
-    glNamedBufferData(vbo_agent, this->num_agents * sizeof(Agent),
-            agents.data(), GL_STATIC_COPY);
+        // Out-of-core, the trail lives in the slab store and the edits are
+        // picked up when the windows are streamed in
+        if (!out_of_core)
+        {
+            edit_staging.resize(count);
+            trail_texture.get_sub_data(edit_staging.data(),
+                    box.origin.x, box.origin.y, box.origin.z,
+                    box.size.x, box.size.y, box.size.z,
+                    count * sizeof(glm::uvec4));
+        }
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vbo_agent);
+        size_t i = 0;
+        for (int z = box.origin.z; z < box.origin.z + box.size.z; z++)
+        {
+            for (int y = box.origin.y; y < box.origin.y + box.size.y; y++)
+            {
+                for (int x = box.origin.x; x < box.origin.x + box.size.x;
+                        x++, i++)
+                {
+                    float weight = edit.weight(glm::ivec3(x, y, z), size);
+                    if (weight <= 0.0f)
+                    {
+                        continue;
+                    }
 
-    glm::uvec3 agent_work_group =
-        glm::uvec3(std::ceil(this->num_agents / 64.0f), 1, 1);
-    glm::uvec3 image_work_group = glm::uvec3(std::ceil(size.x / 8.0f),
-            std::ceil(size.y / 8.0f), 1);
+                    glm::uvec4 &texel = out_of_core ?
+                        *static_cast<glm::uvec4 *>(slab_store.texel(x, y, z)) :
+                        edit_staging[i];
 
-    agent_shader.set_work_group(agent_work_group);
-    diffuse_shader.set_work_group(image_work_group);
+                    for (int c = 0; c < 4; c++)
+                    {
+                        glm::vec2 pair = glm::unpackHalf2x16(texel[c]);
+                        for (int k = 0; k < 2; k++)
+                        {
+                            if (edit.channels & (1u << (2 * c + k)))
+                            {
+                                pair[k] = edit.apply(pair[k], weight);
+                            }
+                        }
+                        texel[c] = glm::packHalf2x16(pair);
+                    }
+                }
+            }
+        }
+
+        if (!out_of_core)
+        {
+            trail_texture.set_sub_data(edit_staging.data(),
+                    box.origin.x, box.origin.y, box.origin.z,
+                    box.size.x, box.size.y, box.size.z);
+        }
+    }
 }
 
-SlimeSimulator::~SlimeSimulator()
+void SlimeSimulator::compact_agents()
+{
+    compact_shader->bind();
+    compact_shader->set_int(compact_num_species_index, num_species);
+
+    size_t compact_args = offsetof(Population, compact_args);
+
+    compact_shader->set_work_group(glm::uvec3(1, 1, 1));
+    for (int stage = 0; stage < 4; stage++)
+    {
+        compact_shader->set_int(stage_index, stage);
+        if (stage % 2 == 0)
+        {
+            compact_shader->dispatch_and_wait();
+        }
+        else
+        {
+            compact_shader->dispatch_indirect_and_wait(ssbo_population,
+                    compact_args);
+        }
+    }
+
+    std::swap(vbo_agent, vbo_sorted_agent);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vbo_agent);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, vbo_sorted_agent);
+}
+
+void SlimeSimulator::grow_agents(int capacity)
 {
+    // Geometric growth, so spawning every frame only reallocates rarely
+    unsigned int agents;
+    glCreateBuffers(1, &agents);
+    glNamedBufferData(agents, capacity * sizeof(Agent), nullptr,
+            GL_DYNAMIC_COPY);
+    glCopyNamedBufferSubData(vbo_agent, agents, 0, 0,
+            std::min(capacity, agent_capacity) * sizeof(Agent));
     glDeleteBuffers(1, &vbo_agent);
+    vbo_agent = agents;
+
+    int groups = (capacity + compact_group_size - 1) / compact_group_size;
+
+    glNamedBufferData(vbo_sorted_agent, capacity * sizeof(Agent), nullptr,
+            GL_DYNAMIC_COPY);
+    glNamedBufferData(ssbo_agent_rank, capacity * sizeof(unsigned int),
+            nullptr, GL_DYNAMIC_COPY);
+    glNamedBufferData(ssbo_group_sum,
+            groups * Species::max_count * sizeof(unsigned int),
+            nullptr, GL_DYNAMIC_COPY);
+
+    agent_capacity = capacity;
+    unsigned int population_capacity = capacity;
+    glNamedBufferSubData(ssbo_population, offsetof(Population, capacity),
+            sizeof(unsigned int), &population_capacity);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vbo_agent);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, vbo_sorted_agent);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, ssbo_agent_rank);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, ssbo_group_sum);
 }
 
-void SlimeSimulator::update(float dt)
+void SlimeSimulator::request_agent_count()
 {
-    float step_dt = dt / static_cast<float>(steps_per_frame);
-    for (size_t i = 0; i < steps_per_frame; i++)
+    poll_agent_count();
+    if (count_fence)
     {
-        step_update(step_dt);
+        return;
     }
+
+    glCopyNamedBufferSubData(ssbo_population, population_readback,
+            offsetof(Population, count), 0, sizeof(unsigned int));
+    count_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    spawned_at_fence = total_spawned;
 }
 
-void SlimeSimulator::step_update(float dt)
+void SlimeSimulator::poll_agent_count()
+{
+    if (!count_fence)
+    {
+        return;
+    }
+
+    GLenum status = glClientWaitSync(count_fence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+    {
+        return;
+    }
+
+    // Agents spawned after the copy are not in the count yet
+    num_agents = *readback_count;
+    agent_bound = num_agents + (total_spawned - spawned_at_fence);
+
+    glDeleteSync(count_fence);
+    count_fence = nullptr;
+}
+
+int SlimeSimulator::max_sense_distance() const
+{
+    int distance = 0;
+    for (const Species &s : species)
+    {
+        distance = std::max(distance, s.sense_distance);
+    }
+
+    return distance;
+}
+
+float SlimeSimulator::max_move_speed() const
+{
+    float speed = 0.0f;
+    for (const Species &s : species)
+    {
+        speed = std::max(speed, s.move_speed);
+    }
+
+    return speed;
+}
+
+void SlimeSimulator::bucket_agents(int origin, int depth, int slabs,
+        int species_per_slab)
+{
+    int buckets = slabs * species_per_slab;
+    size_t buckets_size = buckets * sizeof(unsigned int);
+
+    slab_agent_offsets.resize(buckets);
+    slab_agent_counts.resize(buckets);
+
+    glClearNamedBufferData(ssbo_slab, GL_R32UI, GL_RED_INTEGER,
+            GL_UNSIGNED_INT, nullptr);
+
+    bucket_shader.bind();
+    bucket_shader.set_ivec3(bounds_index, size);
+    bucket_shader.set_int(num_agents_index, num_agents);
+    bucket_shader.set_int(slab_depth_index, depth);
+    bucket_shader.set_int(slab_origin_index, origin);
+    bucket_shader.set_int(num_slabs_index, slabs);
+    bucket_shader.set_int(num_species_index, species_per_slab);
+    bucket_shader.set_int(scatter_index, 0);
+    bucket_shader.set_work_group(glm::uvec3((num_agents + 63) / 64, 1, 1));
+    bucket_shader.dispatch_and_wait();
+
+    glGetNamedBufferSubData(ssbo_slab, 0, buckets_size,
+            slab_agent_counts.data());
+
+    unsigned int offset = 0;
+    for (int bucket = 0; bucket < buckets; bucket++)
+    {
+        slab_agent_offsets[bucket] = offset;
+        offset += slab_agent_counts[bucket];
+    }
+
+    glNamedBufferSubData(ssbo_slab, 0, buckets_size,
+            slab_agent_offsets.data());
+
+    bucket_shader.set_int(scatter_index, 1);
+    bucket_shader.dispatch_and_wait();
+
+    std::swap(vbo_agent, vbo_sorted_agent);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vbo_agent);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, vbo_sorted_agent);
+}
+
+void SlimeSimulator::dispatch_slab(float dt, int slab, int window_origin)
+{
+    for (int s = 0; s < num_species; s++)
+    {
+        int bucket = slab * num_species + s;
+        dispatch_agents(dt, s, slab_agent_offsets[bucket],
+                slab_agent_counts[bucket], window_origin);
+    }
+}
+
+void SlimeSimulator::dispatch_agents(float dt, int species_id, int offset,
+        int count, int window_origin)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    bind_agent_shader(dt, species_id, window_origin);
+    agent_shader->set_int(indirect_index, 0);
+    agent_shader->set_int(num_agents_index, count);
+    agent_shader->set_int(agent_offset_index, offset);
+    int group = work_groups.agent;
+    agent_shader->set_work_group(glm::uvec3((count + group - 1) / group,
+                1, 1));
+    agent_shader->dispatch_and_wait();
+}
+
+void SlimeSimulator::dispatch_agents_indirect(float dt, int species_id)
+{
+    bind_agent_shader(dt, species_id, 0);
+    agent_shader->set_int(indirect_index, 1);
+    agent_shader->dispatch_indirect_and_wait(ssbo_population,
+            offsetof(Population, species_args) +
+            3 * species_id * sizeof(unsigned int));
+}
+
+// The current program is used until the new variant builds, and its log
+// is shown with the failed reloads
+ComputeShader *SlimeSimulator::variant(const char *path,
+        const std::string &defines, ComputeShader *current)
+{
+    std::unique_ptr<ComputeShader> &shader =
+        variants[std::string(path) + "\n" + defines];
+    if (!shader)
+    {
+        shader.reset(new ComputeShader(path, defines));
+    }
+
+    if (shader->valid() || !current)
+    {
+        return shader.get();
+    }
+
+    variant_failed = true;
+    return current;
+}
+
+void SlimeSimulator::select_variants()
+{
+    if (agent_shader && selected_sense_size == sense_size &&
+            selected_blur_radius == blur_radius &&
+            selected_summed_area == summed_area_sensing &&
+            selected_crowding == crowding &&
+            selected_coarse_factor == coarse_diffusion_factor() &&
+            !variant_failed)
+    {
+        return;
+    }
+
+    variant_failed = false;
+
+    std::string agent_defines = variant_defines(size, num_species,
+            glm::ivec3(work_groups.agent, 1, 1), "SENSE_SIZE", sense_size);
+    if (summed_area_sensing)
+    {
+        summed_area_shader = variant(summed_area_shader_path,
+                variant_defines(size, num_species,
+                    glm::ivec3(summed_area_group_size,
+                        summed_area_group_size, 1),
+                    "SENSE_SIZE", sense_size), summed_area_shader);
+        agent_defines += "#define SUMMED_AREA\n";
+    }
+    if (crowding)
+    {
+        agent_defines += "#define CROWDING\n";
+    }
+
+    std::string diffuse_defines = variant_defines(size, num_species,
+            work_groups.diffuse, "BLUR_RADIUS", blur_radius);
+    if (has_obstacles)
+    {
+        agent_defines += "#define OBSTACLES\n";
+        diffuse_defines += "#define OBSTACLES\n";
+    }
+
+    agent_shader = variant(agent_shader_path, agent_defines, agent_shader);
+    diffuse_shader = variant(diffuse_shader_path, diffuse_defines,
+            diffuse_shader);
+    compact_shader = variant(compact_shader_path,
+            compact_defines(work_groups), compact_shader);
+
+    int factor = coarse_diffusion_factor();
+    coarse_shader = factor > 1 ? variant(coarse_shader_path,
+            variant_defines(size, num_species, work_groups.diffuse,
+                "COARSE_FACTOR", factor), coarse_shader) : nullptr;
+
+    selected_sense_size = sense_size;
+    selected_blur_radius = blur_radius;
+    selected_summed_area = summed_area_sensing;
+    selected_crowding = crowding;
+    selected_coarse_factor = factor;
+}
+
+void SlimeSimulator::tune_work_groups()
+{
+    // Tuning runs real steps, so the agents and trail are restored after
+    const float dt = 1.0f / 60.0f;
+    const int repeats = 5;
+
+    glm::ivec3 window_size = trail_texture.get_size();
+    size_t agents_size = num_agents * sizeof(Agent);
+
+    unsigned int saved_agents;
+    glCreateBuffers(1, &saved_agents);
+    glNamedBufferData(saved_agents, std::max<size_t>(agents_size, 1),
+            nullptr, GL_STATIC_COPY);
+    glCopyNamedBufferSubData(vbo_agent, saved_agents, 0, 0, agents_size);
+
+    Texture3D saved_trail;
+    saved_trail.initialize(window_size, GL_RGBA32UI);
+    glCopyImageSubData(trail_texture.get_id(), GL_TEXTURE_3D, 0, 0, 0, 0,
+            saved_trail.get_id(), GL_TEXTURE_3D, 0, 0, 0, 0,
+            window_size.x, window_size.y, window_size.z);
+
+    glNamedBufferSubData(ssbo_species, 0, num_species * sizeof(Species),
+            species.data());
+
+    // All candidates compile in parallel while the first ones are timed
+    for (int candidate : Autotune::agent_candidates())
+    {
+        ComputeShader::preload(agent_shader_path, variant_defines(size,
+                    num_species, glm::ivec3(candidate, 1, 1), "SENSE_SIZE",
+                    sense_size));
+        ComputeShader::preload(compact_shader_path,
+                compact_defines({ candidate, work_groups.diffuse }));
+    }
+    for (const glm::ivec3 &candidate : Autotune::diffuse_candidates())
+    {
+        ComputeShader::preload(diffuse_shader_path, variant_defines(size,
+                    num_species, candidate, "BLUR_RADIUS", blur_radius));
+    }
+
+    double best = std::numeric_limits<double>::max();
+    WorkGroups tuned = work_groups;
+    for (int candidate : Autotune::agent_candidates())
+    {
+        work_groups.agent = candidate;
+        agent_shader = diffuse_shader = compact_shader = nullptr;
+        select_variants();
+        if (!agent_shader->valid() || !compact_shader->valid())
+        {
+            continue;
+        }
+
+        double seconds = Autotune::time([this, dt]()
+                {
+                    dispatch_agents(dt, 0, 0, num_agents, 0);
+                }, repeats);
+        if (seconds < best)
+        {
+            best = seconds;
+            tuned.agent = candidate;
+        }
+    }
+
+    best = std::numeric_limits<double>::max();
+    for (const glm::ivec3 &candidate : Autotune::diffuse_candidates())
+    {
+        work_groups.diffuse = candidate;
+        agent_shader = diffuse_shader = compact_shader = nullptr;
+        select_variants();
+        if (!diffuse_shader->valid())
+        {
+            continue;
+        }
+
+        double seconds = Autotune::time([this, dt, window_size]()
+                {
+                    dispatch_diffuse(dt, 0, 0, window_size.z);
+                }, repeats);
+        if (seconds < best)
+        {
+            best = seconds;
+            tuned.diffuse = candidate;
+        }
+    }
+
+    // The losing variants are dropped, the winners are in the binary cache
+    work_groups = tuned;
+    agent_shader = nullptr;
+    diffuse_shader = nullptr;
+    compact_shader = nullptr;
+    variants.clear();
+
+    glCopyNamedBufferSubData(saved_agents, vbo_agent, 0, 0, agents_size);
+    glCopyImageSubData(saved_trail.get_id(), GL_TEXTURE_3D, 0, 0, 0, 0,
+            trail_texture.get_id(), GL_TEXTURE_3D, 0, 0, 0, 0,
+            window_size.x, window_size.y, window_size.z);
+    glDeleteBuffers(1, &saved_agents);
+
+    std::cout << "Tuned work groups: agents " << tuned.agent
+        << ", diffuse " << tuned.diffuse.x << "x" << tuned.diffuse.y
+        << "x" << tuned.diffuse.z << "\n";
+}
+
+void SlimeSimulator::bind_agent_shader(float dt, int species_id,
+        int window_origin)
+{
+    agent_shader->bind();
+    agent_shader->set_float(dt_index, dt);
+    agent_shader->set_float(time_index, Timer::time());
+    agent_shader->set_int(species_index, species_id);
+    agent_shader->set_int(window_origin_index, window_origin);
+
+    // Dead agents are only removed with a dynamic population
+    agent_shader->set_float(lifetime_index,
+            dynamic_population ? lifetime : 0.0f);
+    agent_shader->set_float(starvation_index,
+            dynamic_population ? starvation : 0.0f);
+
+    if (crowding)
+    {
+        agent_shader->set_float(repulsion_index, repulsion);
+        agent_shader->set_float(alignment_index, alignment);
+        agent_shader->set_float(interaction_radius_index,
+                interaction_radius);
+    }
+}
+
+void SlimeSimulator::dispatch_diffuse(float dt, int window_origin,
+        int core_origin, int core_depth)
 {
-    agent_shader.bind();
-    agent_shader.set_ivec3(bounds_index, size);
-    agent_shader.set_int(num_agents_index, num_agents);
-    agent_shader.set_float(dt_index, dt);
-    agent_shader.set_float(time_index, Timer::time());
-    agent_shader.set_float(move_speed_index, move_speed);
-    agent_shader.set_float(turn_amount_index, turn_amount);
-    agent_shader.set_float(trail_weight_index, trail_weight);
-    agent_shader.set_float(sense_spacing_index, sense_spacing);
-    agent_shader.set_int(sense_distance_index, sense_distance);
-    agent_shader.set_int(sense_size_index, sense_size);
-    agent_shader.dispatch_and_wait();
-
-    diffuse_shader.bind();
-    diffuse_shader.set_ivec3(bounds_index, size);
-    diffuse_shader.set_float(dt_index, dt);
-    diffuse_shader.set_float(time_index, Timer::time());
-    diffuse_shader.set_float(diffuse_speed_index,
+    diffuse_shader->bind();
+    diffuse_shader->set_float(dt_index, dt);
+    diffuse_shader->set_float(time_index, Timer::time());
+    diffuse_shader->set_float(diffuse_speed_index,
             diffuse_speed);
-    diffuse_shader.set_float(decay_speed_index, decay_speed);
-    diffuse_shader.dispatch_and_wait();
+    diffuse_shader->set_float(decay_speed_index, decay_speed);
+    diffuse_shader->set_int(window_origin_index, window_origin);
+    diffuse_shader->set_int(core_origin_index, core_origin);
+    diffuse_shader->set_int(core_depth_index, core_depth);
+    // Derived from the tile, so the whole core is covered
+    glm::ivec3 group = work_groups.diffuse;
+    diffuse_shader->set_work_group(glm::uvec3(
+                (size.x + group.x - 1) / group.x,
+                (size.y + group.y - 1) / group.y,
+                (core_depth + group.z - 1) / group.z));
+    diffuse_shader->dispatch_and_wait();
+}
+
+void SlimeSimulator::dispatch_implicit_diffuse(float dt)
+{
+    if (!ssbo_multigrid[0])
+    {
+        multigrid_levels = Multigrid::hierarchy(size);
+
+        const Multigrid::Level &last = multigrid_levels.back();
+        size_t voxels = last.offset + static_cast<size_t>(last.size.x) *
+            last.size.y * last.size.z;
+
+        glCreateBuffers(3, ssbo_multigrid);
+        for (unsigned int buffer : ssbo_multigrid)
+        {
+            glNamedBufferData(buffer, voxels * sizeof(Multigrid::Texel),
+                    nullptr, GL_DYNAMIC_COPY);
+        }
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 16 + i, ssbo_multigrid[i]);
+    }
+
+    float coefficient = Multigrid::coefficient(diffuse_speed, blur_radius,
+            dt);
+
+    multigrid_shader.bind();
+    multigrid_shader.set_float(decay_index, decay_speed * dt);
+    multigrid_shader.set_int(obstacles_index, has_obstacles);
+
+    // The trail is read from and written back to its own image
+    dispatch_multigrid(0, 0, coefficient);
+    for (int i = 0; i < multigrid_cycles; i++)
+    {
+        multigrid_cycle(0, coefficient);
+    }
+    dispatch_multigrid(4, 0, coefficient);
+}
+
+void SlimeSimulator::multigrid_cycle(int level, float coefficient)
+{
+    bool coarsest = level + 1 == static_cast<int>(multigrid_levels.size());
+    int smoothing = coarsest ? Multigrid::coarse_smoothing :
+        Multigrid::pre_smoothing;
+    for (int i = 0; i < smoothing; i++)
+    {
+        dispatch_multigrid(1, level, coefficient);
+    }
+
+    if (coarsest)
+    {
+        return;
+    }
+
+    dispatch_multigrid(2, level, coefficient);
+    multigrid_cycle(level + 1, coefficient / 4.0f);
+    dispatch_multigrid(3, level, coefficient);
+
+    for (int i = 0; i < Multigrid::post_smoothing; i++)
+    {
+        dispatch_multigrid(1, level, coefficient);
+    }
+}
+
+void SlimeSimulator::dispatch_multigrid(int stage, int level,
+        float coefficient)
+{
+    const Multigrid::Level &fine = multigrid_levels[level];
+    const Multigrid::Level &coarse = multigrid_levels[std::min(level + 1,
+            static_cast<int>(multigrid_levels.size()) - 1)];
+
+    multigrid_shader.set_int(multigrid_stage_index, stage);
+    multigrid_shader.set_ivec3(level_size_index, fine.size);
+    multigrid_shader.set_int(level_offset_index, fine.offset);
+    multigrid_shader.set_float(coefficient_index, coefficient);
+    multigrid_shader.set_ivec3(coarse_size_index, coarse.size);
+    multigrid_shader.set_int(coarse_offset_index, coarse.offset);
+
+    // Restriction runs over the coarse level
+    glm::ivec3 extent = stage == 2 ? coarse.size : fine.size;
+    multigrid_shader.set_work_group(glm::uvec3(
+                (extent + multigrid_group_size - 1) / multigrid_group_size));
+    multigrid_shader.dispatch_and_wait();
+
+    if (stage == 1)
+    {
+        std::swap(ssbo_multigrid[0], ssbo_multigrid[2]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 16, ssbo_multigrid[0]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 18, ssbo_multigrid[2]);
+    }
+}
+
+bool SlimeSimulator::set_coarse_diffusion(int factor)
+{
+    if (factor != 1 && factor != 2 && factor != 4)
+    {
+        return false;
+    }
+
+    int previous = coarse_factor;
+    coarse_factor = factor;
+    if (factor == 1 || coarse_diffusion_factor() == factor)
+    {
+        return true;
+    }
+
+    coarse_factor = previous;
+    return false;
+}
 
-    trail_texture.copy(&diffused_trail_texture);
+int SlimeSimulator::coarse_diffusion_factor() const
+{
+    // Solid voxels do not survive the averaging
+    int factor = coarse_factor;
+    if (factor <= 1 || out_of_core || distributed || has_obstacles ||
+            size.x % factor || size.y % factor || size.z % factor)
+    {
+        return 1;
+    }
+
+    return factor;
+}
+
+void SlimeSimulator::dispatch_coarse_diffuse(float dt)
+{
+    int factor = selected_coarse_factor;
+    glm::ivec3 coarse_size = size / factor;
+    size_t needed = static_cast<size_t>(coarse_size.x) * coarse_size.y *
+        coarse_size.z * sizeof(glm::uvec4);
+    if (needed > coarse_capacity)
+    {
+        glDeleteBuffers(2, ssbo_coarse);
+        glCreateBuffers(2, ssbo_coarse);
+        for (unsigned int buffer : ssbo_coarse)
+        {
+            glNamedBufferData(buffer, needed, nullptr, GL_DYNAMIC_COPY);
+        }
+        coarse_capacity = needed;
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 16, ssbo_coarse[0]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 17, ssbo_coarse[1]);
+
+    // A box of radius r spreads the trail by a variance of r (r + 1) / 3
+    // voxels per axis at the full amount. Averaging over blocks and
+    // interpolating back already spreads the relaxed part by (f^2 - 1) / 12
+    // + f^2 / 6, so the coarse box, the nearest one in coarse voxels, only
+    // makes up the rest. Radius 1 on the 4x grid is spread by that alone.
+    int coarse_radius = std::max(1, (blur_radius + factor / 2) / factor);
+    float amount = std::min(1.0f, diffuse_speed * dt);
+    float spread = blur_radius * (blur_radius + 1) / 3.0f;
+    float resampling_spread = (factor * factor - 1) / 12.0f +
+        factor * factor / 6.0f;
+    float coarse_spread = factor * factor * coarse_radius *
+        (coarse_radius + 1) / 3.0f;
+    float coarse_amount = glm::clamp(amount *
+            (spread - resampling_spread) / coarse_spread, 0.0f, 1.0f);
+
+    coarse_shader->bind();
+    coarse_shader->set_float(dt_index, dt);
+    coarse_shader->set_float(decay_speed_index, decay_speed);
+    coarse_shader->set_float(fine_amount_index, amount);
+    coarse_shader->set_float(coarse_amount_index, coarse_amount);
+    coarse_shader->set_int(coarse_radius_index, coarse_radius);
+
+    glm::ivec3 group = work_groups.diffuse;
+    for (int stage = 0; stage < 3; stage++)
+    {
+        glm::ivec3 extent = stage == 2 ? size : coarse_size;
+        coarse_shader->set_int(coarse_stage_index, stage);
+        coarse_shader->set_work_group(glm::uvec3((extent + group - 1) /
+                    group));
+        coarse_shader->dispatch_and_wait();
+    }
+}
+
+void SlimeSimulator::dispatch_summed_area()
+{
+    glm::ivec3 extended = SummedArea::extended_size(size, sense_size);
+    size_t needed = static_cast<size_t>(extended.x) * extended.y *
+        extended.z * num_species * sizeof(unsigned int);
+    if (needed > summed_area_capacity)
+    {
+        glDeleteBuffers(1, &ssbo_summed_area);
+        glCreateBuffers(1, &ssbo_summed_area);
+        glNamedBufferData(ssbo_summed_area, needed, nullptr,
+                GL_DYNAMIC_COPY);
+        summed_area_capacity = needed;
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 19, ssbo_summed_area);
+
+    // Each stage scans the lines along one axis, over the other two
+    summed_area_shader->bind();
+    for (int stage = 0; stage < 3; stage++)
+    {
+        glm::ivec2 lines = stage == 0 ? glm::ivec2(extended.y, extended.z) :
+            stage == 1 ? glm::ivec2(extended.x, extended.z) :
+            glm::ivec2(extended.x, extended.y);
+        summed_area_shader->set_int(summed_area_stage_index, stage);
+        summed_area_shader->set_work_group(glm::uvec3(
+                    (lines.x + summed_area_group_size - 1) /
+                    summed_area_group_size,
+                    (lines.y + summed_area_group_size - 1) /
+                    summed_area_group_size, 1));
+        summed_area_shader->dispatch_and_wait();
+    }
+}
+
+void SlimeSimulator::build_spatial_hash()
+{
+    // One more cell than voxels, which stays empty and ends the last voxel
+    int cells = size.x * size.y * size.z + 1;
+    int cell_groups = (cells + spatial_hash_group_size - 1) /
+        spatial_hash_group_size;
+
+    if (!ssbo_cell_counts)
+    {
+        glCreateBuffers(1, &ssbo_cell_counts);
+        glCreateBuffers(1, &ssbo_cell_starts);
+        glCreateBuffers(1, &ssbo_cell_groups);
+        glNamedBufferData(ssbo_cell_counts, cells * sizeof(unsigned int),
+                nullptr, GL_DYNAMIC_COPY);
+        glNamedBufferData(ssbo_cell_starts, cells * sizeof(unsigned int),
+                nullptr, GL_DYNAMIC_COPY);
+        glNamedBufferData(ssbo_cell_groups,
+                cell_groups * sizeof(unsigned int), nullptr, GL_DYNAMIC_COPY);
+    }
+
+    if (neighbour_capacity < agent_capacity)
+    {
+        glDeleteBuffers(1, &ssbo_neighbours);
+        glDeleteBuffers(1, &ssbo_cell_slots);
+        glCreateBuffers(1, &ssbo_neighbours);
+        glCreateBuffers(1, &ssbo_cell_slots);
+        glNamedBufferData(ssbo_neighbours,
+                agent_capacity * sizeof(glm::vec4), nullptr, GL_DYNAMIC_COPY);
+        glNamedBufferData(ssbo_cell_slots,
+                agent_capacity * sizeof(unsigned int), nullptr,
+                GL_DYNAMIC_COPY);
+        neighbour_capacity = agent_capacity;
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 20, ssbo_cell_counts);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 21, ssbo_cell_starts);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 22, ssbo_cell_groups);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 23, ssbo_neighbours);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 24, ssbo_cell_slots);
+
+    glClearNamedBufferData(ssbo_cell_counts, GL_R32UI, GL_RED_INTEGER,
+            GL_UNSIGNED_INT, nullptr);
+
+    spatial_hash_shader.bind();
+    spatial_hash_shader.set_ivec3(bounds_index, size);
+    spatial_hash_shader.set_int(num_cells_index, cells);
+    spatial_hash_shader.set_int(num_cell_groups_index, cell_groups);
+
+    // The agent passes run over the compacted agents, with the dispatch of
+    // the compaction. The cell passes are split over rows of groups to
+    // stay below the dispatch limit.
+    size_t agent_args = offsetof(Population, compact_args);
+    int row = std::min(cell_groups, 32768);
+    glm::uvec3 cell_dispatch(row, (cell_groups + row - 1) / row, 1);
+
+    for (int stage = 0; stage < 5; stage++)
+    {
+        spatial_hash_shader.set_int(spatial_hash_stage_index, stage);
+        if (stage == 0 || stage == 4)
+        {
+            spatial_hash_shader.dispatch_indirect_and_wait(ssbo_population,
+                    agent_args);
+        }
+        else
+        {
+            spatial_hash_shader.set_work_group(stage == 2 ?
+                    glm::uvec3(1, 1, 1) : cell_dispatch);
+            spatial_hash_shader.dispatch_and_wait();
+        }
+    }
 }
 
 const Texture3D *SlimeSimulator::trail() const
 {
-    return &trail_texture;
+    // The trail textures only hold the last window
+    return out_of_core ? &preview_texture : &trail_texture;
+}
+
+glm::ivec3 SlimeSimulator::trail_size() const
+{
+    return out_of_core ? size : trail_texture.get_size();
+}
+
+std::vector<glm::vec4> SlimeSimulator::species_colors() const
+{
+    std::vector<glm::vec4> colors;
+    for (const Species &s : species)
+    {
+        colors.push_back(s.color);
+    }
+
+    return colors;
 }
 
 void SlimeSimulator::update_debug_window()
 {
     ImGui::Begin("Parameters");
 
-    ImGui::DragFloat("Move Speed", &move_speed, 1.0f, 0.0f,
-            (std::numeric_limits<float>::max)());
-    ImGui::DragFloat("Turn Amount", &turn_amount, 1.0f, 0.0f,
-            (std::numeric_limits<float>::max)());
-    ImGui::DragFloat("Trail Weight", &trail_weight, 0.1f, 0.0f,
-            (std::numeric_limits<float>::max)());
-    ImGui::DragFloat("Sense Spacing",
-            &sense_spacing, 1.0f, 0.0f, 180.0f);
-    ImGui::DragInt("Sense Distance", &sense_distance, 1, 1, 100);
-    ImGui::DragInt("Sense Size", &sense_size, 1, 1, 3);
+    // Windows only hold enough halo for the initial distance
+    int sense_distance_limit = out_of_core || distributed ?
+        std::max(1, halo - max_sense_size - 1) : 100;
+    Species::update_debug_window(species, sense_distance_limit);
+
+    if (!out_of_core && !distributed &&
+            ImGui::Checkbox("Summed Area Sensing", &summed_area_sensing) &&
+            !summed_area_sensing)
+    {
+        sense_size = std::min(sense_size, max_sense_size);
+    }
+    ImGui::DragInt("Sense Size", &sense_size, 1, 1, summed_area_sensing ?
+            SummedArea::max_radius : max_sense_size);
 
     ImGui::DragFloat("Diffuse Speed", &diffuse_speed, 0.05f, 0.0f, 10.0f);
     ImGui::DragFloat("Decay Speed", &decay_speed, 0.05f, 0.0f, 10.0f);
-    ImGui::DragInt("Blur Radius", &blur_radius, 1, 1, 5);
+    ImGui::DragInt("Blur Radius", &blur_radius, 1, 1, max_blur_radius);
+
+    if (!out_of_core && !distributed)
+    {
+        ImGui::Checkbox("Crowding", &crowding);
+        if (crowding)
+        {
+            ImGui::DragFloat("Repulsion", &repulsion, 0.05f, 0.0f, 10.0f);
+            ImGui::DragFloat("Alignment", &alignment, 0.05f, 0.0f, 10.0f);
+            ImGui::DragFloat("Interaction Radius", &interaction_radius,
+                    0.01f, 0.05f, 0.5f);
+        }
+
+        ImGui::Checkbox("Implicit Diffusion", &implicit_diffusion);
+        if (implicit_diffusion)
+        {
+            ImGui::DragInt("Diffusion Interval", &diffusion_interval, 1, 1,
+                    100);
+            ImGui::DragInt("Multigrid Cycles", &multigrid_cycles, 1, 1, 8);
+            diffusion_interval = std::max(1, diffusion_interval);
+        }
+        else
+        {
+            const char *factors[] = { "Off", "2x", "4x" };
+            int current = coarse_factor == 4 ? 2 : coarse_factor == 2 ? 1 : 0;
+            if (ImGui::Combo("Coarse Diffusion", &current, factors, 3))
+            {
+                coarse_factor = 1 << current;
+            }
+            if (coarse_factor > 1 && coarse_diffusion_factor() == 1)
+            {
+                ImGui::Text("Needs a volume divisible by %d and no obstacles",
+                        coarse_factor);
+            }
+        }
+    }
+
+    if (dynamic_population)
+    {
+        // Packed ages saturate, so longer lifetimes would never end
+        ImGui::DragFloat("Lifetime", &lifetime, 1.0f, 0.0f,
+                PackedAgent::max_age);
+        ImGui::DragFloat("Starvation", &starvation, 0.01f, 0.0f, 10.0f);
+        ImGui::Text("%d agents, capacity %d", num_agents, agent_capacity);
+    }
+
+    if (out_of_core)
+    {
+        ImGui::Text("Streaming %d slabs of %d layers", num_slabs, slab_depth);
+        ImGui::Text("Drawn at 1/%d resolution", preview_factor);
+    }
+    if (distributed)
+    {
+        ImGui::Text("Rank %d of %d, layers %d-%d, %d agents",
+                transport->rank(), transport->size(), domain_origin,
+                domain_origin + domain_depth - 1, num_agents);
+    }
 
     ImGui::End();
 }
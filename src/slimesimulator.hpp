@@ -1,31 +1,209 @@
 #pragma once
+#include <glad/glad.h>
 #include <glm/gtc/matrix_transform.hpp>
+#include <vector>
+#include <map>
+#include <memory>
+#include <string>
+#include "simulator.hpp"
+#include "distribution.hpp"
+#include "species.hpp"
 #include "shader.hpp"
 #include "texture.hpp"
+#include "slabstore.hpp"
+#include "transport.hpp"
+#include "autotune.hpp"
+#include "multigrid.hpp"
+#include "summedarea.hpp"
+#include "packedagent.hpp"
 
-class SlimeSimulator
+class SlimeSimulator : public Simulator
 {
 private:
-    struct Agent
+    typedef PackedAgent Agent;
+
+    // Live agent count and indirect dispatch arguments, laid out to match
+    // the std430 population buffer
+    struct Population
+    {
+        unsigned int count;
+        unsigned int capacity;
+        unsigned int scanned;
+        unsigned int padding;
+        unsigned int compact_args[3];
+        unsigned int padding2;
+        unsigned int species_offset[Species::max_count];
+        unsigned int species_count[Species::max_count];
+        unsigned int species_args[Species::max_count * 3];
+    };
+
+    // Sent from rank 0 up the ring every frame, followed by the species
+    // parameters, so all ranks step together with the same parameters
+    struct StepControl
     {
-        glm::vec3 position;
-        float theta;
-        float phi;
-        glm::vec3 padding;
-        glm::vec4 color;
+        float dt;
+        int sense_size;
+        float diffuse_speed;
+        float decay_speed;
+        int blur_radius;
     };
 
 private:
     glm::ivec3 size;
     int num_agents;
+    int num_species;
 
-    ComputeShader agent_shader;
-    ComputeShader diffuse_shader;
+    std::vector<Species> species;
+
+    // Agent and diffuse programs are specialised on the sense size, blur
+    // radius and work groups, and built when the values are first used.
+    // Compaction sizes the agent dispatches, so it follows the agent work
+    // group size. Variants that fail to build are kept, so they are rebuilt
+    // when their files are edited, and the selection is made again every
+    // step until they link.
+    std::map<std::string, std::unique_ptr<ComputeShader>> variants;
+    ComputeShader *agent_shader;
+    ComputeShader *diffuse_shader;
+    ComputeShader *compact_shader;
+    ComputeShader *summed_area_shader;
+    ComputeShader *coarse_shader;
+    bool variant_failed;
+    int selected_sense_size;
+    int selected_blur_radius;
+    bool selected_summed_area;
+    bool selected_crowding;
+    int selected_coarse_factor;
+    WorkGroups work_groups;
+    ComputeShader bucket_shader;
+    ComputeShader spawn_shader;
+    ComputeShader init_shader;
+    ComputeShader metrics_shader;
+    ComputeShader multigrid_shader;
+    ComputeShader spatial_hash_shader;
+    ComputeShader resample_shader;
+    ComputeShader preview_shader;
 
     Texture3D trail_texture;
     Texture3D diffused_trail_texture;
 
     unsigned int vbo_agent;
+    unsigned int ssbo_species;
+
+    // In-core agents spawn and die. The population only lives on the GPU,
+    // where dead agents are compacted away every step and the agent
+    // dispatches are sized indirectly. num_agents is read back without
+    // stalling through a fence, and agent_bound is an upper bound on the
+    // count for growing the agent buffers.
+    bool dynamic_population;
+    unsigned int ssbo_population;
+    unsigned int ssbo_agent_rank;
+    unsigned int ssbo_group_sum;
+    unsigned int population_readback;
+    const unsigned int *readback_count;
+    GLsync count_fence;
+    long long total_spawned;
+    long long spawned_at_fence;
+    int agent_bound;
+
+    // Out-of-core mode, used when the volume does not fit in
+    // resident_budget. The trail textures then only hold a window of
+    // slab_depth + 2 * halo layers, and the full volume lives in slab_store.
+    // The volume is drawn from preview_texture instead, which every window
+    // shrinks its core into by preview_factor along each axis.
+    bool out_of_core;
+    int slab_depth;
+    int num_slabs;
+    int halo;
+    int preview_factor;
+
+    SlabStore slab_store;
+    std::vector<unsigned char> window_staging;
+    std::vector<unsigned char> readback_staging;
+
+    // Halos are read as they were before the step. The top of each core is
+    // kept from before it is stepped for the next window, and the bottom
+    // of the volume for the windows that wrap onto it.
+    std::vector<unsigned char> carry_staging;
+    std::vector<unsigned char> wrap_staging;
+
+    Texture3D preview_texture;
+
+    std::vector<glm::uvec4> edit_staging;
+
+    // Union-find labels and agent counts per voxel, and the metrics
+    // results, allocated when metrics are first computed
+    unsigned int ssbo_labels;
+    unsigned int ssbo_voxel_counts;
+    unsigned int ssbo_metrics;
+
+    // Trail density as last read back, brick by brick, and the bricks that
+    // changed since, so the isosurface only reads back those
+    unsigned int ssbo_density;
+    unsigned int ssbo_changed_bricks;
+    std::vector<unsigned int> changed_bricks;
+    std::vector<float> brick_staging;
+
+    // Solution, right hand side and smoothed values of every multigrid
+    // level, allocated when implicit diffusion is first used. Jacobi
+    // sweeps swap the solution and smoothed buffers, and every level runs
+    // an even number of them, so the solution ends up where it started.
+    std::vector<Multigrid::Level> multigrid_levels;
+    unsigned int ssbo_multigrid[3];
+    int pending_diffusion_steps;
+    float pending_diffusion_dt;
+
+    // Block averages of the trail and their change for coarse diffusion,
+    // grown to the largest coarse grid used so far
+    unsigned int ssbo_coarse[2];
+    size_t coarse_capacity;
+
+    // Summed area table of the trail for sensing, grown to the largest
+    // sense size used so far
+    unsigned int ssbo_summed_area;
+    size_t summed_area_capacity;
+
+    // Uniform grid of the agents with one cell per voxel: agents and start
+    // per cell, the group sums of the scan over the cells, and the agents
+    // sorted by cell with the slot of each in its cell. The agent buffers
+    // follow agent_capacity. The agents of a cell end where the next cell
+    // starts.
+    unsigned int ssbo_cell_counts;
+    unsigned int ssbo_cell_starts;
+    unsigned int ssbo_cell_groups;
+    unsigned int ssbo_neighbours;
+    unsigned int ssbo_cell_slots;
+    int neighbour_capacity;
+
+    // In-core only. Distance to the nearest obstacle with the direction away
+    // from it per voxel, read by the agents, and one bit per voxel set in
+    // solid voxels, read by diffusion.
+    bool has_obstacles;
+    unsigned int ssbo_obstacle_field;
+    unsigned int ssbo_obstacle_mask;
+
+    // Distributed mode, used when a transport with more than one rank is
+    // given. Each rank owns the layers [domain_origin, domain_origin +
+    // domain_depth) and the agents in them, and its window has halo layers
+    // on both sides that are exchanged with the neighbouring ranks.
+    Transport *transport;
+    bool distributed;
+    bool connected;
+    int domain_origin;
+    int domain_depth;
+    int agent_capacity;
+
+    // Agents are kept sorted by slab, and by species within each slab, so
+    // every dispatch runs a single species. Bucket slab * num_species +
+    // species starts at slab_agent_offsets[bucket].
+    unsigned int vbo_sorted_agent;
+    unsigned int ssbo_slab;
+    std::vector<unsigned int> slab_agent_offsets;
+    std::vector<unsigned int> slab_agent_counts;
+
+    // Both trail textures must fit in it to stay resident
+    size_t resident_budget;
+
+    bool shaders_built;
 
     const unsigned int trail_texture_unit = 0;
     const unsigned int diffused_trail_texture_unit = 1;
@@ -35,40 +213,239 @@ private:
     const unsigned int time_index = 2;
 
     const unsigned int num_agents_index = 3;
-    const unsigned int move_speed_index = 4;
-    const unsigned int turn_amount_index = 5;
-    const unsigned int trail_weight_index = 6;
-    const unsigned int sense_spacing_index = 7;
-    const unsigned int sense_distance_index = 8;
-    const unsigned int sense_size_index = 9;
+    const unsigned int window_origin_index = 10;
+    const unsigned int agent_offset_index = 11;
+    const unsigned int species_index = 12;
+    const unsigned int indirect_index = 13;
+    const unsigned int lifetime_index = 14;
+    const unsigned int starvation_index = 15;
+    const unsigned int repulsion_index = 16;
+    const unsigned int alignment_index = 17;
+    const unsigned int interaction_radius_index = 18;
 
     const unsigned int diffuse_speed_index = 3;
     const unsigned int decay_speed_index = 4;
-    const unsigned int blur_radius_index = 5;
+    const unsigned int core_origin_index = 12;
+    const unsigned int core_depth_index = 13;
+
+    const unsigned int slab_depth_index = 10;
+    const unsigned int scatter_index = 11;
+    const unsigned int slab_origin_index = 12;
+    const unsigned int num_slabs_index = 13;
+    const unsigned int num_species_index = 14;
+
+    const unsigned int stage_index = 0;
+    const unsigned int compact_num_species_index = 1;
+
+    const unsigned int spawn_count_index = 3;
+    const unsigned int spawn_center_index = 4;
+    const unsigned int spawn_radius_index = 5;
+    const unsigned int spawn_species_index = 6;
+    const unsigned int spawn_mode_index = 7;
+    const unsigned int spawn_num_species_index = 8;
+    const unsigned int spawn_num_centers_index = 9;
+    const unsigned int spawn_centers_index = 10;
+
+    // The size of the centers array in spawn.comp
+    const int max_erase_centers = 32;
+
+    const unsigned int init_stage_index = 1;
+    const unsigned int init_num_species_index = 4;
+    const unsigned int seed_index = 5;
+    const unsigned int kind_index = 6;
+    const unsigned int init_domain_origin_index = 7;
+    const unsigned int init_domain_depth_index = 8;
+    const unsigned int init_window_origin_index = 9;
+    const unsigned int image_size_index = 10;
+    const unsigned int window_depth_index = 11;
+    const unsigned int first_index_index = 12;
+
+    const unsigned int metrics_stage_index = 1;
+    const unsigned int threshold_index = 2;
+
+    const unsigned int multigrid_stage_index = 0;
+    const unsigned int level_size_index = 1;
+    const unsigned int level_offset_index = 2;
+    const unsigned int coefficient_index = 3;
+    const unsigned int coarse_size_index = 4;
+    const unsigned int coarse_offset_index = 5;
+    const unsigned int decay_index = 6;
+    const unsigned int obstacles_index = 7;
+
+    const unsigned int summed_area_stage_index = 0;
+
+    const unsigned int spatial_hash_stage_index = 1;
+    const unsigned int num_cells_index = 2;
+    const unsigned int num_cell_groups_index = 3;
+
+    const unsigned int source_bounds_index = 1;
+
+    const unsigned int preview_factor_index = 1;
+    const unsigned int preview_halo_index = 2;
+
+    const unsigned int coarse_stage_index = 0;
+    const unsigned int fine_amount_index = 5;
+    const unsigned int coarse_amount_index = 6;
+    const unsigned int coarse_radius_index = 7;
+
+    const int compact_group_size = 256;
+    const int metrics_group_size = 8;
+    const int multigrid_group_size = 8;
+    const int summed_area_group_size = 8;
+    const int spatial_hash_group_size = 256;
+    const int resample_group_size = 8;
+    const int preview_group_size = 8;
+    const int preview_max_size = 128;
+
+    const int max_sense_size = 3;
+    const int max_blur_radius = 5;
 
     const size_t steps_per_frame = 1;
 
-    float move_speed = 1.0f;
-    float turn_amount = 15.0f;
-    float trail_weight = 1.0f;
-    float sense_spacing = 15.0f;
-    int sense_distance = 20;
-    int sense_size = 1;
+    int sense_size = default_sense_size;
+
+    float lifetime = 0.0f;
+    float starvation = 0.0f;
 
     float diffuse_speed = 3.0f;
     float decay_speed = 0.1f;
-    int blur_radius = 1;
+    int blur_radius = default_blur_radius;
+
+    // In-core only. Implicit diffusion is stable for any step, so it runs
+    // once every diffusion_interval agent steps over their combined time.
+    bool implicit_diffusion = false;
+    int diffusion_interval = 10;
+    int multigrid_cycles = 2;
+
+    // In-core only, without obstacles. Explicit diffusion runs on a grid
+    // coarse_factor times coarser than the trail, when it divides the
+    // volume, while agents deposit on and sense the full resolution trail.
+    int coarse_factor = 1;
+
+    // In-core only. Sensing reads box sums from a summed area table built
+    // every step, which costs the same for any sense size up to
+    // SummedArea::max_radius.
+    bool summed_area_sensing = false;
+
+    // In-core only. Agents closer than interaction_radius voxels, at most
+    // half, repel each other and align their headings.
+    bool crowding = false;
+    float repulsion = 1.0f;
+    float alignment = 0.5f;
+    float interaction_radius = 0.5f;
+
+public:
+    static const int default_sense_size = 1;
+    static const int default_blur_radius = 1;
 
 public:
-    SlimeSimulator(int num_agents, const glm::ivec3 &size);
+    SlimeSimulator(int num_agents, const glm::ivec3 &size,
+            const Distribution &distribution, Transport *transport = nullptr,
+            int num_species = 1);
     ~SlimeSimulator();
 
-    void update(float dt);
+    // Shaders register themselves for hot reloads, so the simulator stays
+    // where it was made and is handed around through pointers
+    SlimeSimulator(const SlimeSimulator &) = delete;
+    SlimeSimulator &operator=(const SlimeSimulator &) = delete;
+
+    // Starts compiling the programs before the simulator is created
+    static void preload_shaders(const glm::ivec3 &size, int num_agents,
+            int num_species);
+
+    // Parameters that the agent and diffuse shaders take as constants
+    static std::string variant_defines(const glm::ivec3 &size,
+            int num_species, const glm::ivec3 &local_size,
+            const char *radius_name, int radius);
+
+    // False if a program did not build, with its log printed, or if the
+    // volume did not fit on the GPU and could not be streamed through it
+    // from the host either
+    bool valid() const;
 
-    const Texture3D *trail() const;
+    void update(float dt) override;
+    bool follow();
 
-    void update_debug_window();
+    const Texture3D *trail() const override;
+    glm::ivec3 trail_size() const override;
+    std::vector<glm::vec4> species_colors() const override;
+
+    void spawn(const glm::vec3 &center, float radius, int count,
+            int species_id) override;
+    void erase_agents(const std::vector<glm::vec3> &centers, float radius)
+        override;
+
+    void edit_trail(const TrailEdit &edit) override;
+
+    bool save_checkpoint(const std::string &path) const override;
+
+    bool compute_metrics(float threshold, Metrics &metrics) override;
+    bool occupancy_mask(float threshold,
+            std::vector<unsigned char> &mask) override;
+    bool trail_density(std::vector<float> &density, float tolerance)
+        override;
+
+    bool set_obstacles(const Obstacles &obstacles) override;
+    bool agent_buffers(unsigned int &agents, unsigned int &count_buffer,
+            int &bound) const override;
+
+    // In-core only. Buffers only grow when the new count exceeds their
+    // capacity, while the trail textures are made again at the new size.
+    bool resize(int num_agents, const glm::ivec3 &size) override;
+
+    bool set_coarse_diffusion(int factor) override;
+
+    void update_debug_window() override;
 
 private:
+    void initialize_agents(const Distribution &distribution,
+            const glm::ivec3 &window_size);
+
+    glm::ivec3 metrics_groups() const;
+    size_t metrics_header_size() const;
+    void allocate_metrics_buffers();
+
     void step_update(float dt);
+    void step_update_out_of_core(float dt);
+    void step_update_distributed(float dt);
+
+    bool broadcast_control(float &dt);
+    void exchange_halo();
+    void return_halo_deposits(float dt);
+    void migrate_agents();
+
+    int max_sense_distance() const;
+    float max_move_speed() const;
+
+    void resample_trail(const glm::ivec3 &new_size);
+    void resize_population(int count);
+
+    void compact_agents();
+    void grow_agents(int capacity);
+    void request_agent_count();
+    void poll_agent_count();
+
+    void bucket_agents(int origin, int depth, int slabs,
+            int species_per_slab);
+    void dispatch_slab(float dt, int slab, int window_origin);
+    void merge_halo_deposits(const unsigned char *before,
+            const unsigned char *after, int z);
+    void update_preview(int core_origin, int core_depth);
+    void dispatch_agents(float dt, int species_id, int offset, int count,
+            int window_origin);
+    void dispatch_agents_indirect(float dt, int species_id);
+    ComputeShader *variant(const char *path, const std::string &defines,
+            ComputeShader *current);
+    void select_variants();
+    void tune_work_groups();
+    void bind_agent_shader(float dt, int species_id, int window_origin);
+    void dispatch_diffuse(float dt, int window_origin,
+            int core_origin, int core_depth);
+    void dispatch_implicit_diffuse(float dt);
+    int coarse_diffusion_factor() const;
+    void dispatch_coarse_diffuse(float dt);
+    void multigrid_cycle(int level, float coefficient);
+    void dispatch_multigrid(int stage, int level, float coefficient);
+    void dispatch_summed_area();
+    void build_spatial_hash();
 };
@@ -0,0 +1,114 @@
+#include "species.hpp"
+#include <imgui.h>
+#include <limits>
+#include <string>
+#include <cmath>
+
+const int Species::max_count;
+
+float Species::attraction(int other) const
+{
+    return other < 4 ? this->attraction_low[other] :
+        this->attraction_high[other - 4];
+}
+
+void Species::set_attraction(int other, float value)
+{
+    if (other < 4)
+        this->attraction_low[other] = value;
+    else
+        this->attraction_high[other - 4] = value;
+}
+
+static float to_rad(float deg)
+{
+    return deg * glm::pi<float>() / 180.0f;
+}
+
+void Species::update_rotation()
+{
+    float spacing = to_rad(this->sense_spacing);
+    float turn = to_rad(this->turn_amount);
+    this->rotation = glm::vec4(std::cos(spacing), std::sin(spacing),
+            std::cos(turn), std::sin(turn));
+}
+
+std::vector<Species> Species::presets(int count)
+{
+    const glm::vec4 colors[max_count] =
+    {
+        glm::vec4(1.0f, 1.0f, 1.0f, 1.0f),
+        glm::vec4(1.0f, 0.3f, 0.2f, 1.0f),
+        glm::vec4(0.2f, 0.6f, 1.0f, 1.0f),
+        glm::vec4(0.3f, 1.0f, 0.3f, 1.0f),
+        glm::vec4(1.0f, 0.9f, 0.2f, 1.0f),
+        glm::vec4(0.8f, 0.3f, 1.0f, 1.0f),
+        glm::vec4(0.2f, 1.0f, 0.9f, 1.0f),
+        glm::vec4(1.0f, 0.5f, 0.8f, 1.0f),
+    };
+
+    std::vector<Species> species(count);
+    for (int i = 0; i < count; i++)
+    {
+        Species &s = species[i];
+        s = Species();
+        s.color = colors[i];
+        s.move_speed = 1.0f;
+        s.turn_amount = 15.0f;
+        s.trail_weight = 1.0f;
+        s.sense_spacing = 15.0f;
+        s.sense_distance = 20;
+        s.update_rotation();
+
+        // Follow the own trail and avoid the others
+        for (int j = 0; j < count; j++)
+        {
+            s.set_attraction(j, i == j ? 1.0f : -0.5f);
+        }
+    }
+
+    return species;
+}
+
+void Species::update_debug_window(std::vector<Species> &species,
+        int max_sense_distance)
+{
+    int count = species.size();
+
+    for (int i = 0; i < count; i++)
+    {
+        Species &s = species[i];
+
+        ImGui::PushID(i);
+        if (ImGui::TreeNode("Species", "Species %d", i))
+        {
+            ImGui::ColorEdit4("Color", &s.color.x);
+            ImGui::DragFloat("Move Speed", &s.move_speed, 1.0f, 0.0f,
+                    (std::numeric_limits<float>::max)());
+            ImGui::DragFloat("Turn Amount", &s.turn_amount, 1.0f, 0.0f,
+                    (std::numeric_limits<float>::max)());
+            ImGui::DragFloat("Trail Weight", &s.trail_weight, 0.1f, 0.0f,
+                    (std::numeric_limits<float>::max)());
+            ImGui::DragFloat("Sense Spacing",
+                    &s.sense_spacing, 1.0f, 0.0f, 180.0f);
+            ImGui::DragInt("Sense Distance", &s.sense_distance, 1, 1,
+                    max_sense_distance);
+
+            for (int j = 0; j < count; j++)
+            {
+                float value = s.attraction(j);
+                std::string label = "Attraction to " + std::to_string(j);
+                if (ImGui::DragFloat(label.c_str(), &value, 0.05f,
+                            -10.0f, 10.0f))
+                {
+                    s.set_attraction(j, value);
+                }
+            }
+
+            ImGui::TreePop();
+        }
+        ImGui::PopID();
+
+        s.update_rotation();
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <glm/gtc/matrix_transform.hpp>
+#include <vector>
+
+// Per-species parameters, laid out to match the std430 species buffer
+struct Species
+{
+    static const int max_count = 8;
+
+    glm::vec4 color;
+    float move_speed;
+    float turn_amount;
+    float trail_weight;
+    float sense_spacing;
+    int sense_distance;
+    int padding[3];
+
+    // How strongly the trail of each species attracts (positive) or repels
+    // (negative) this species, species 0-3 in low and 4-7 in high
+    glm::vec4 attraction_low;
+    glm::vec4 attraction_high;
+
+    // Cosine and sine of the sense spacing and of the turn amount, so
+    // agents rotate their heading without trigonometry
+    glm::vec4 rotation;
+
+    float attraction(int other) const;
+    void set_attraction(int other, float value);
+
+    // Recomputes rotation after the angles change
+    void update_rotation();
+
+    static std::vector<Species> presets(int count);
+    static void update_debug_window(std::vector<Species> &species,
+            int max_sense_distance);
+};
@@ -0,0 +1,163 @@
+#include "summedarea.hpp"
+#include <algorithm>
+
+static int wrap(int value, int bound)
+{
+    return ((value % bound) + bound) % bound;
+}
+
+static glm::uvec4 quantize(const glm::vec4 &value)
+{
+    const float limit = 65535.0f / SummedArea::scale;
+    glm::uvec4 result;
+    for (int i = 0; i < 4; i++)
+    {
+        float clamped = std::min(std::max(value[i], 0.0f), limit);
+        result[i] = static_cast<unsigned int>(
+                clamped * SummedArea::scale + 0.5f);
+    }
+
+    return result;
+}
+
+SummedArea::SummedArea(WorkerPool &pool)
+    : pool(pool), size(0), extended(0), radius(0), channels(4)
+{}
+
+glm::ivec3 SummedArea::extended_size(const glm::ivec3 &size, int radius)
+{
+    return size + 2 * radius + 1;
+}
+
+void SummedArea::build(const Texel *texels, const glm::ivec3 &size,
+        int radius, int channels)
+{
+    this->size = size;
+    this->extended = extended_size(size, radius);
+    this->radius = radius;
+    this->channels = channels;
+
+    const glm::ivec3 &extended = this->extended;
+    int vectors = channels / 4;
+    this->sums.resize(static_cast<size_t>(extended.x) * extended.y *
+            extended.z * vectors);
+
+    // Prefix sums along x, filled from the wrapped trail
+    parallel_range(extended.z, [this, texels, &size, &extended, vectors,
+            radius](int z_begin, int z_end)
+            {
+                for (int z = z_begin; z < z_end; z++)
+                {
+                    int tz = wrap(z - radius - 1, size.z);
+                    for (int y = 0; y < extended.y; y++)
+                    {
+                        int ty = wrap(y - radius - 1, size.y);
+                        glm::uvec4 low(0);
+                        glm::uvec4 high(0);
+                        for (int x = 0; x < extended.x; x++)
+                        {
+                            int tx = wrap(x - radius - 1, size.x);
+                            const Texel &texel = texels[tx +
+                                static_cast<size_t>(size.x) *
+                                (ty + static_cast<size_t>(size.y) * tz)];
+
+                            size_t i = index(x, y, z);
+                            low += quantize(texel.low);
+                            this->sums[i] = low;
+                            if (vectors > 1)
+                            {
+                                high += quantize(texel.high);
+                                this->sums[i + 1] = high;
+                            }
+                        }
+                    }
+                }
+            });
+
+    // Along y within each layer, then along z within each range of rows
+    size_t row = static_cast<size_t>(extended.x) * vectors;
+    size_t layer = row * extended.y;
+    parallel_range(extended.z, [this, &extended, row](int z_begin,
+                int z_end)
+            {
+                for (int z = z_begin; z < z_end; z++)
+                {
+                    for (int y = 1; y < extended.y; y++)
+                    {
+                        glm::uvec4 *current = &this->sums[index(0, y, z)];
+                        for (size_t i = 0; i < row; i++)
+                        {
+                            current[i] += current[i - row];
+                        }
+                    }
+                }
+            });
+
+    parallel_range(extended.y, [this, &extended, row, layer](int y_begin,
+                int y_end)
+            {
+                for (int z = 1; z < extended.z; z++)
+                {
+                    for (int y = y_begin; y < y_end; y++)
+                    {
+                        glm::uvec4 *current = &this->sums[index(0, y, z)];
+                        for (size_t i = 0; i < row; i++)
+                        {
+                            current[i] += current[i - layer];
+                        }
+                    }
+                }
+            });
+}
+
+SummedArea::Texel SummedArea::box_sum(int x, int y, int z) const
+{
+    // The box of the voxel spans the extended coordinates (lo, hi]
+    glm::ivec3 lo(wrap(x, this->size.x), wrap(y, this->size.y),
+            wrap(z, this->size.z));
+    int width = 2 * this->radius + 1;
+
+    glm::uvec4 low(0);
+    glm::uvec4 high(0);
+    for (int corner = 0; corner < 8; corner++)
+    {
+        glm::ivec3 bits(corner & 1, (corner >> 1) & 1, corner >> 2);
+        glm::ivec3 p = lo + bits * width;
+        size_t i = index(p.x, p.y, p.z);
+
+        // Corners at an odd number of upper bounds are added
+        bool add = (bits.x + bits.y + bits.z) % 2 == 1;
+        low = add ? low + this->sums[i] : low - this->sums[i];
+        if (this->channels > 4)
+        {
+            high = add ? high + this->sums[i + 1] : high - this->sums[i + 1];
+        }
+    }
+
+    Texel sum;
+    sum.low = glm::vec4(low) / static_cast<float>(scale);
+    sum.high = glm::vec4(high) / static_cast<float>(scale);
+    return sum;
+}
+
+void SummedArea::parallel_range(int depth,
+        const std::function<void(int, int)> &task)
+{
+    int workers = this->pool.size();
+    this->pool.run([depth, workers, &task](int index)
+            {
+                int begin = depth * index / workers;
+                int end = depth * (index + 1) / workers;
+                if (begin < end)
+                {
+                    task(begin, end);
+                }
+            });
+}
+
+size_t SummedArea::index(int x, int y, int z) const
+{
+    return (x + static_cast<size_t>(this->extended.x) *
+            (y + static_cast<size_t>(this->extended.y) * z)) *
+        (this->channels / 4);
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include "workerpool.hpp"
+#include "multigrid.hpp"
+
+// Summed area table of the trail, so a sense box of any size is summed from
+// its eight corners. The table covers the volume extended by radius + 1
+// layers below and radius above on every axis, filled with the wrapped
+// trail, so every box around a voxel of the volume lies inside it. Values
+// are fixed point and summed with unsigned overflow, which keeps box sums
+// exact as long as they fit in 32 bits.
+class SummedArea
+{
+public:
+    typedef Multigrid::Texel Texel;
+
+    // Trail values are stored in steps of 1 / scale and clamped to 16 bits,
+    // so a box of 33³ voxels still fits
+    static const int max_radius = 16;
+    static const int scale = 4096;
+
+private:
+    WorkerPool &pool;
+
+    glm::ivec3 size;
+    glm::ivec3 extended;
+    int radius;
+    int channels;
+
+    // channels / 4 uvec4 per voxel of the extended volume
+    std::vector<glm::uvec4> sums;
+
+public:
+    SummedArea(WorkerPool &pool);
+
+    static glm::ivec3 extended_size(const glm::ivec3 &size, int radius);
+
+    // Rebuilds the table from the trail, with four or eight channels
+    void build(const Texel *texels, const glm::ivec3 &size, int radius,
+            int channels);
+
+    // Sum over the box of the built radius around a voxel of the volume
+    Texel box_sum(int x, int y, int z) const;
+
+private:
+    // Runs task on the range of [0, depth) of every worker
+    void parallel_range(int depth, const std::function<void(int, int)> &task);
+
+    size_t index(int x, int y, int z) const;
+};
@@ -0,0 +1,371 @@
+#include "sweep.hpp"
+#include <glad/glad.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "slimesimulator.hpp"
+#include "timer.hpp"
+
+static const char *agent_shader_path = "assets/shaders/agent.comp";
+static const char *diffuse_shader_path = "assets/shaders/diffuse.comp";
+static const char *init_shader_path = "assets/shaders/init.comp";
+static const char *metrics_shader_path = "assets/shaders/sweep_metrics.comp";
+
+static int max_texture_size()
+{
+    int max_size;
+    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_size);
+    return max_size;
+}
+
+// How many instances fit in the largest atlas
+static int atlas_capacity(const glm::ivec3 &size)
+{
+    glm::ivec3 tiles = glm::ivec3(max_texture_size()) / size;
+    return tiles.x * tiles.y * tiles.z;
+}
+
+// Fills x first, then y, then z, so small sweeps keep a small atlas
+static glm::ivec3 atlas_tiles(const glm::ivec3 &size, int count)
+{
+    glm::ivec3 limit = glm::ivec3(max_texture_size()) / size;
+
+    glm::ivec3 tiles;
+    tiles.x = std::max(1, std::min(count, limit.x));
+    tiles.y = std::max(1,
+            std::min((count + tiles.x - 1) / tiles.x, limit.y));
+    tiles.z = std::max(1, (count + tiles.x * tiles.y - 1) /
+            (tiles.x * tiles.y));
+    return tiles;
+}
+
+static std::string atlas_defines(const glm::ivec3 &tiles)
+{
+    return "#define ATLAS_TILES ivec3(" + std::to_string(tiles.x) + ", " +
+        std::to_string(tiles.y) + ", " + std::to_string(tiles.z) + ")\n";
+}
+
+static std::vector<std::string> split(const std::string &line)
+{
+    std::vector<std::string> fields;
+    std::istringstream stream(line);
+    std::string field;
+    while (std::getline(stream, field, ','))
+    {
+        field.erase(0, field.find_first_not_of(" \t\r"));
+        field.erase(field.find_last_not_of(" \t\r") + 1);
+        fields.push_back(field);
+    }
+
+    return fields;
+}
+
+Sweep::Sweep(const glm::ivec3 &size, int agents_per_instance,
+        const std::vector<Parameters> &parameters,
+        const Distribution &distribution)
+    : size(size),
+    num_instances(std::min(static_cast<int>(parameters.size()),
+                atlas_capacity(size))),
+    tiles(atlas_tiles(size, num_instances)),
+    num_agents(agents_per_instance * num_instances),
+    parameters(parameters.begin(), parameters.begin() + num_instances),
+    work_groups(Autotune::defaults()),
+    agent_shader(agent_shader_path,
+            SlimeSimulator::variant_defines(size, 1,
+                glm::ivec3(work_groups.agent, 1, 1), "SENSE_SIZE",
+                SlimeSimulator::default_sense_size) + atlas_defines(tiles)),
+    diffuse_shader(diffuse_shader_path,
+            SlimeSimulator::variant_defines(size, 1, work_groups.diffuse,
+                "BLUR_RADIUS", SlimeSimulator::default_blur_radius) +
+            atlas_defines(tiles)),
+    init_shader(init_shader_path),
+    metrics_shader(metrics_shader_path),
+    shaders_built(true),
+    vbo_agent(0), ssbo_species(0), ssbo_population(0), ssbo_rates(0),
+    ssbo_metrics(0)
+{
+    // Every program is checked, so all failed builds print their logs
+    for (const ComputeShader *shader : { &agent_shader, &diffuse_shader,
+            &init_shader, &metrics_shader })
+    {
+        shaders_built = shader->valid() && shaders_built;
+    }
+    if (!shaders_built)
+    {
+        return;
+    }
+
+    if (num_instances < static_cast<int>(parameters.size()))
+    {
+        std::cout << "Only " << num_instances << " of " << parameters.size()
+            << " sweep instances fit in one atlas\n";
+    }
+
+    glm::ivec3 atlas_size = size * tiles;
+    trail_texture.initialize(atlas_size, GL_RGBA32UI);
+    diffused_trail_texture.initialize(atlas_size, GL_RGBA32UI);
+
+    trail_texture.bind_to_unit(trail_texture_unit);
+    diffused_trail_texture.bind_to_unit(diffused_trail_texture_unit);
+
+    // Padding tiles past the last instance get no agents and no parameters
+    int num_tiles = tiles.x * tiles.y * tiles.z;
+    std::vector<Species> species(num_tiles, Species());
+    std::vector<glm::vec2> rates(num_tiles, glm::vec2(0.0f));
+    for (int i = 0; i < num_instances; i++)
+    {
+        species[i] = this->parameters[i].species;
+        rates[i] = glm::vec2(this->parameters[i].diffuse_speed,
+                this->parameters[i].decay_speed);
+    }
+
+    glCreateBuffers(1, &ssbo_species);
+    glNamedBufferData(ssbo_species, num_tiles * sizeof(Species),
+            species.data(), GL_STATIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssbo_species);
+
+    glCreateBuffers(1, &ssbo_rates);
+    glNamedBufferData(ssbo_rates, num_tiles * sizeof(glm::vec2),
+            rates.data(), GL_STATIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, ssbo_rates);
+
+    // Only read by indirect agent dispatches, which sweeps do not use, but
+    // the agent shader still declares it
+    glCreateBuffers(1, &ssbo_population);
+    glNamedBufferData(ssbo_population, population_size, nullptr,
+            GL_STATIC_DRAW);
+    glClearNamedBufferData(ssbo_population, GL_R32UI, GL_RED_INTEGER,
+            GL_UNSIGNED_INT, nullptr);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssbo_population);
+
+    glCreateBuffers(1, &ssbo_metrics);
+    glNamedBufferData(ssbo_metrics,
+            2 * num_instances * sizeof(unsigned int), nullptr,
+            GL_DYNAMIC_READ);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, ssbo_metrics);
+
+    initialize_agents(distribution);
+}
+
+Sweep::~Sweep()
+{
+    glDeleteBuffers(1, &vbo_agent);
+    glDeleteBuffers(1, &ssbo_species);
+    glDeleteBuffers(1, &ssbo_population);
+    glDeleteBuffers(1, &ssbo_rates);
+    glDeleteBuffers(1, &ssbo_metrics);
+}
+
+bool Sweep::valid() const
+{
+    return shaders_built;
+}
+
+bool Sweep::load_parameters(const std::string &path,
+        std::vector<Parameters> &result)
+{
+    std::ifstream file(path);
+    std::string line;
+    if (!std::getline(file, line))
+    {
+        return false;
+    }
+
+    std::vector<std::string> columns = split(line);
+
+    Parameters defaults;
+    defaults.species = Species::presets(1)[0];
+    defaults.diffuse_speed = 3.0f;
+    defaults.decay_speed = 0.1f;
+
+    result.clear();
+    while (std::getline(file, line))
+    {
+        std::vector<std::string> fields = split(line);
+        if (fields.empty() || fields[0].empty())
+        {
+            continue;
+        }
+
+        Parameters p = defaults;
+        for (size_t i = 0; i < fields.size() && i < columns.size(); i++)
+        {
+            float value = std::strtof(fields[i].c_str(), nullptr);
+            const std::string &column = columns[i];
+
+            if (column == "move_speed")
+                p.species.move_speed = value;
+            else if (column == "turn_amount")
+                p.species.turn_amount = value;
+            else if (column == "trail_weight")
+                p.species.trail_weight = value;
+            else if (column == "sense_spacing")
+                p.species.sense_spacing = value;
+            else if (column == "sense_distance")
+                p.species.sense_distance = static_cast<int>(value);
+            else if (column == "diffuse_speed")
+                p.diffuse_speed = value;
+            else if (column == "decay_speed")
+                p.decay_speed = value;
+        }
+        p.species.update_rotation();
+
+        result.push_back(p);
+    }
+
+    return !result.empty();
+}
+
+void Sweep::initialize_agents(const Distribution &distribution)
+{
+    // Checkpoints hold agents of a full volume, not of an instance
+    int kind = distribution.kind == Distribution::Checkpoint ?
+        Distribution::Sphere : distribution.kind;
+
+    glCreateBuffers(1, &vbo_agent);
+    glNamedBufferData(vbo_agent, std::max(num_agents, 1) * sizeof(Agent),
+            nullptr, GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vbo_agent);
+
+    unsigned int ssbo_counter, ssbo_cdf, ssbo_checkpoint;
+    glCreateBuffers(1, &ssbo_counter);
+    glCreateBuffers(1, &ssbo_cdf);
+    glCreateBuffers(1, &ssbo_checkpoint);
+
+    unsigned int zero = 0;
+    glNamedBufferData(ssbo_counter, sizeof(unsigned int), &zero,
+            GL_DYNAMIC_COPY);
+
+    const std::vector<float> &cdf = distribution.cdf;
+    glNamedBufferData(ssbo_cdf,
+            std::max<size_t>(cdf.size(), 1) * sizeof(float),
+            cdf.empty() ? nullptr : cdf.data(), GL_STATIC_DRAW);
+    glNamedBufferData(ssbo_checkpoint, sizeof(Distribution::Sample),
+            nullptr, GL_STATIC_DRAW);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, ssbo_counter);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, ssbo_cdf);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, ssbo_checkpoint);
+
+    // Species of the generated agents are contiguous blocks, which are the
+    // instances. Positions are local to the instance tile.
+    init_shader.bind();
+    init_shader.set_ivec3(bounds_index, size);
+    init_shader.set_int(init_stage_index, 0);
+    init_shader.set_int(num_agents_index, num_agents);
+    init_shader.set_int(init_num_species_index, num_instances);
+    init_shader.set_int(seed_index, static_cast<int>(distribution.seed));
+    init_shader.set_int(kind_index, kind);
+    init_shader.set_int(init_domain_origin_index, 0);
+    init_shader.set_int(init_domain_depth_index, size.z);
+    init_shader.set_ivec2(image_size_index, distribution.image_size);
+    init_shader.set_work_group(glm::uvec3((num_agents + 63) / 64, 1, 1));
+    init_shader.dispatch_and_wait();
+
+    glDeleteBuffers(1, &ssbo_counter);
+    glDeleteBuffers(1, &ssbo_cdf);
+    glDeleteBuffers(1, &ssbo_checkpoint);
+}
+
+void Sweep::update(float dt)
+{
+    agent_shader.bind();
+    agent_shader.set_float(dt_index, dt);
+    agent_shader.set_float(time_index, Timer::time());
+    agent_shader.set_int(num_agents_index, num_agents);
+    agent_shader.set_int(window_origin_index, 0);
+    agent_shader.set_int(agent_offset_index, 0);
+    agent_shader.set_int(species_index, 0);
+    agent_shader.set_int(indirect_index, 0);
+    agent_shader.set_float(lifetime_index, 0.0f);
+    agent_shader.set_float(starvation_index, 0.0f);
+    int group = work_groups.agent;
+    agent_shader.set_work_group(glm::uvec3(
+                (num_agents + group - 1) / group, 1, 1));
+    agent_shader.dispatch_and_wait();
+
+    glm::ivec3 atlas_size = size * tiles;
+    diffuse_shader.bind();
+    diffuse_shader.set_float(dt_index, dt);
+    diffuse_shader.set_float(time_index, Timer::time());
+    diffuse_shader.set_int(window_origin_index, 0);
+    diffuse_shader.set_int(core_origin_index, 0);
+    diffuse_shader.set_int(core_depth_index, atlas_size.z);
+    glm::ivec3 tile = work_groups.diffuse;
+    diffuse_shader.set_work_group(glm::uvec3(
+                (atlas_size + tile - 1) / tile));
+    diffuse_shader.dispatch_and_wait();
+
+    trail_texture.copy(&diffused_trail_texture);
+}
+
+void Sweep::run(int steps, const std::string &path)
+{
+    const float dt = 1.0f / 60.0f;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; i++)
+    {
+        update(dt);
+    }
+    glFinish();
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << num_instances << " instances, " << steps << " steps in "
+        << seconds << " s, " << num_instances * steps / seconds
+        << " instance steps per second\n";
+
+    if (!write_metrics(path))
+    {
+        std::cout << "Could not write " << path << "\n";
+        return;
+    }
+
+    std::cout << "Sweep metrics written to " << path << "\n";
+}
+
+bool Sweep::write_metrics(const std::string &path)
+{
+    glClearNamedBufferData(ssbo_metrics, GL_R32UI, GL_RED_INTEGER,
+            GL_UNSIGNED_INT, nullptr);
+
+    metrics_shader.bind();
+    metrics_shader.set_ivec3(bounds_index, size);
+    metrics_shader.set_ivec3(tiles_index, tiles);
+    metrics_shader.set_int(num_instances_index, num_instances);
+    metrics_shader.set_float(threshold_index, occupied_threshold);
+
+    glm::ivec3 atlas_size = size * tiles;
+    metrics_shader.set_work_group(glm::uvec3(tiles.x,
+                (atlas_size.y + 7) / 8, (atlas_size.z + 7) / 8));
+    metrics_shader.dispatch_and_wait();
+
+    // Only two values per instance are read back, not the atlas
+    std::vector<unsigned int> metrics(2 * num_instances);
+    glGetNamedBufferSubData(ssbo_metrics, 0,
+            metrics.size() * sizeof(unsigned int), metrics.data());
+
+    std::ofstream out(path);
+    out << "instance,move_speed,turn_amount,trail_weight,sense_spacing,"
+        << "sense_distance,diffuse_speed,decay_speed,agents,trail_mass,"
+        << "occupancy\n";
+
+    double texels = static_cast<double>(size.x) * size.y * size.z;
+    int agents_per_instance = num_agents / std::max(num_instances, 1);
+    for (int i = 0; i < num_instances; i++)
+    {
+        const Parameters &p = parameters[i];
+        out << i << "," << p.species.move_speed << ","
+            << p.species.turn_amount << "," << p.species.trail_weight << ","
+            << p.species.sense_spacing << "," << p.species.sense_distance
+            << "," << p.diffuse_speed << "," << p.decay_speed << ","
+            << agents_per_instance << "," << metrics[2 * i] / 256.0 << ","
+            << metrics[2 * i + 1] / texels << "\n";
+    }
+
+    return static_cast<bool>(out);
+}
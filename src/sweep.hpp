@@ -0,0 +1,116 @@
+#pragma once
+#include <glm/gtc/matrix_transform.hpp>
+#include <string>
+#include <vector>
+#include "distribution.hpp"
+#include "species.hpp"
+#include "shader.hpp"
+#include "texture.hpp"
+#include "autotune.hpp"
+#include "packedagent.hpp"
+
+// Runs many small independent simulations at once. Instances are tiles of
+// one atlas texture and blocks of one agent buffer, so every pass advances
+// all of them in a single dispatch. Each instance has its own species
+// parameters and diffuse and decay speeds, and only uses trail channel 0.
+class Sweep
+{
+public:
+    struct Parameters
+    {
+        Species species;
+        float diffuse_speed;
+        float decay_speed;
+    };
+
+private:
+    // Packed like in SlimeSimulator, with species holding the instance
+    typedef PackedAgent Agent;
+
+    // Of one instance
+    glm::ivec3 size;
+    int num_instances;
+    glm::ivec3 tiles;
+    int num_agents;
+
+    std::vector<Parameters> parameters;
+
+    WorkGroups work_groups;
+    ComputeShader agent_shader;
+    ComputeShader diffuse_shader;
+    ComputeShader init_shader;
+    ComputeShader metrics_shader;
+    bool shaders_built;
+
+    Texture3D trail_texture;
+    Texture3D diffused_trail_texture;
+
+    unsigned int vbo_agent;
+    unsigned int ssbo_species;
+    unsigned int ssbo_population;
+    unsigned int ssbo_rates;
+    unsigned int ssbo_metrics;
+
+    // The population buffer of SlimeSimulator
+    const size_t population_size =
+        (8 + 5 * Species::max_count) * sizeof(unsigned int);
+
+    const unsigned int trail_texture_unit = 0;
+    const unsigned int diffused_trail_texture_unit = 1;
+
+    const unsigned int bounds_index = 0;
+    const unsigned int dt_index = 1;
+    const unsigned int time_index = 2;
+
+    const unsigned int num_agents_index = 3;
+    const unsigned int window_origin_index = 10;
+    const unsigned int agent_offset_index = 11;
+    const unsigned int species_index = 12;
+    const unsigned int indirect_index = 13;
+    const unsigned int lifetime_index = 14;
+    const unsigned int starvation_index = 15;
+
+    const unsigned int core_origin_index = 12;
+    const unsigned int core_depth_index = 13;
+
+    const unsigned int init_stage_index = 1;
+    const unsigned int init_num_species_index = 4;
+    const unsigned int seed_index = 5;
+    const unsigned int kind_index = 6;
+    const unsigned int init_domain_origin_index = 7;
+    const unsigned int init_domain_depth_index = 8;
+    const unsigned int image_size_index = 10;
+
+    const unsigned int tiles_index = 1;
+    const unsigned int num_instances_index = 2;
+    const unsigned int threshold_index = 3;
+
+    // Trail above this counts as occupied
+    const float occupied_threshold = 0.1f;
+
+public:
+    Sweep(const glm::ivec3 &size, int agents_per_instance,
+            const std::vector<Parameters> &parameters,
+            const Distribution &distribution);
+    ~Sweep();
+
+    // False if a program did not build, with its log printed
+    bool valid() const;
+
+    // One instance per row of a CSV file. The header names the columns,
+    // from move_speed, turn_amount, trail_weight, sense_spacing,
+    // sense_distance, diffuse_speed and decay_speed. Missing columns keep
+    // the defaults of a single species.
+    static bool load_parameters(const std::string &path,
+            std::vector<Parameters> &result);
+
+    void update(float dt);
+
+    // Runs a fixed number of steps and writes the parameters and summary
+    // metrics of every instance as CSV
+    void run(int steps, const std::string &path);
+
+private:
+    void initialize_agents(const Distribution &distribution);
+    bool write_metrics(const std::string &path);
+};
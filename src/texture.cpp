@@ -1,6 +1,26 @@
 #include "texture.hpp"
 #include <glad/glad.h>
 
+static void pixel_format(unsigned int internal_format,
+        unsigned int *format, unsigned int *type)
+{
+    switch (internal_format)
+    {
+        case GL_RGBA32F:
+            *format = GL_RGBA;
+            *type = GL_FLOAT;
+            break;
+        case GL_RGBA32UI:
+            *format = GL_RGBA_INTEGER;
+            *type = GL_UNSIGNED_INT;
+            break;
+        case GL_R32UI:
+            *format = GL_RED_INTEGER;
+            *type = GL_UNSIGNED_INT;
+            break;
+    }
+}
+
 Texture3D::Texture3D()
     : id(0), size(0), internal_format(0)
 {}
@@ -31,6 +51,30 @@ Texture3D::~Texture3D()
     }
 }
 
+Texture3D::Texture3D(Texture3D &&other)
+    : id(other.id), size(other.size), internal_format(other.internal_format)
+{
+    other.id = 0;
+}
+
+Texture3D &Texture3D::operator=(Texture3D &&other)
+{
+    if (this != &other)
+    {
+        if (id)
+        {
+            glDeleteTextures(1, &this->id);
+        }
+
+        this->id = other.id;
+        this->size = other.size;
+        this->internal_format = other.internal_format;
+        other.id = 0;
+    }
+
+    return *this;
+}
+
 void Texture3D::set_data(const void *data) const
 {
     this->set_sub_data(data, 0, 0, 0, this->size.x, this->size.y, this->size.z);
@@ -43,30 +87,38 @@ void Texture3D::set_sub_data(const void *data,
 
     unsigned int format;
     unsigned int type;
-
-    switch (this->internal_format)
-    {
-        case GL_RGBA32F:
-            format = GL_RGBA;
-            type = GL_FLOAT;
-            break;
-        case GL_R32UI:
-            format = GL_RED_INTEGER;
-            type = GL_UNSIGNED_INT;
-            break;
-    }
+    pixel_format(this->internal_format, &format, &type);
 
     glTextureSubImage3D(this->id, 0, ox, oy, oz, width,
             height, depth, format, type, data);
 }
 
+void Texture3D::get_sub_data(void *data, int ox, int oy, int oz,
+        int width, int height, int depth, size_t buffer_size) const
+{
+    assert(id);
+
+    unsigned int format;
+    unsigned int type;
+    pixel_format(this->internal_format, &format, &type);
+
+    glGetTextureSubImage(this->id, 0, ox, oy, oz, width, height, depth,
+            format, type, buffer_size, data);
+}
+
 void Texture3D::copy(const Texture3D *source) const
+{
+    this->copy_sub(source, 0, 0, 0, this->size.x, this->size.y, this->size.z);
+}
+
+void Texture3D::copy_sub(const Texture3D *source, int ox, int oy, int oz,
+        int width, int height, int depth) const
 {
     assert(id);
 
     glCopyImageSubData(source->get_id(), GL_TEXTURE_3D,
-            0, 0, 0, 0, this->id, GL_TEXTURE_3D, 0,
-            0, 0, 0, this->size.x, this->size.y, this->size.z);
+            0, ox, oy, oz, this->id, GL_TEXTURE_3D, 0,
+            ox, oy, oz, width, height, depth);
 }
 
 void Texture3D::bind_to_unit(unsigned int unit) const
@@ -81,3 +133,8 @@ unsigned int Texture3D::get_id() const
 {
     return this->id;
 }
+
+glm::ivec3 Texture3D::get_size() const
+{
+    return this->size;
+}
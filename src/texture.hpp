@@ -2,6 +2,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <vector>
 
+// Owns its texture, so it can be moved but not copied
 class Texture3D
 {
 private:
@@ -13,13 +14,23 @@ public:
     Texture3D();
     ~Texture3D();
 
+    Texture3D(Texture3D &&other);
+    Texture3D &operator=(Texture3D &&other);
+    Texture3D(const Texture3D &) = delete;
+    Texture3D &operator=(const Texture3D &) = delete;
+
     void initialize(const glm::ivec3 &size, unsigned int internal_format);
 
     void set_data(const void *data) const;
     void set_sub_data(const void *data,
             int ox, int oy, int oz, int width, int height, int depth) const;
+    void get_sub_data(void *data, int ox, int oy, int oz,
+            int width, int height, int depth, size_t buffer_size) const;
     void copy(const Texture3D *source) const;
+    void copy_sub(const Texture3D *source, int ox, int oy, int oz,
+            int width, int height, int depth) const;
 
     void bind_to_unit(unsigned int unit) const;
     unsigned int get_id() const;
+    glm::ivec3 get_size() const;
 };
@@ -0,0 +1,127 @@
+#include "trailedit.hpp"
+#include <algorithm>
+#include <cmath>
+
+static int wrap(int value, int bound)
+{
+    return ((value % bound) + bound) % bound;
+}
+
+// Bricks along one axis touched by [low, high], with wrapping
+static std::vector<bool> touched_bricks(float low, float high, int size,
+        int bricks)
+{
+    std::vector<bool> touched(bricks, false);
+
+    int begin = static_cast<int>(std::floor(low));
+    int end = static_cast<int>(std::floor(high));
+    if (end - begin + 1 >= size)
+    {
+        touched.assign(bricks, true);
+        return touched;
+    }
+
+    for (int v = begin; v <= end; v++)
+    {
+        touched[wrap(v, size) / TrailEdit::brick_size] = true;
+    }
+
+    return touched;
+}
+
+std::vector<TrailEdit::Box> TrailEdit::dirty_boxes(
+        const glm::ivec3 &volume) const
+{
+    glm::ivec3 bricks = (volume + brick_size - 1) / brick_size;
+    std::vector<bool> dirty(static_cast<size_t>(bricks.x) * bricks.y *
+            bricks.z, false);
+
+    for (const glm::vec3 &center : this->centers)
+    {
+        std::vector<bool> xs = touched_bricks(center.x - this->radius,
+                center.x + this->radius, volume.x, bricks.x);
+        std::vector<bool> ys = touched_bricks(center.y - this->radius,
+                center.y + this->radius, volume.y, bricks.y);
+        std::vector<bool> zs = touched_bricks(center.z - this->radius,
+                center.z + this->radius, volume.z, bricks.z);
+
+        for (int bz = 0; bz < bricks.z; bz++)
+        {
+            for (int by = 0; by < bricks.y && zs[bz]; by++)
+            {
+                for (int bx = 0; bx < bricks.x && ys[by]; bx++)
+                {
+                    if (xs[bx])
+                    {
+                        dirty[bx + bricks.x * (by + bricks.y * bz)] = true;
+                    }
+                }
+            }
+        }
+    }
+
+    // Consecutive dirty bricks in a row become one box
+    std::vector<Box> boxes;
+    for (int bz = 0; bz < bricks.z; bz++)
+    {
+        for (int by = 0; by < bricks.y; by++)
+        {
+            int bx = 0;
+            while (bx < bricks.x)
+            {
+                size_t row = bricks.x * (by + static_cast<size_t>(bricks.y) *
+                        bz);
+                if (!dirty[row + bx])
+                {
+                    bx++;
+                    continue;
+                }
+
+                int run_begin = bx;
+                while (bx < bricks.x && dirty[row + bx])
+                {
+                    bx++;
+                }
+
+                Box box;
+                box.origin = glm::ivec3(run_begin, by, bz) * brick_size;
+                box.size = glm::min(glm::ivec3(bx, by + 1, bz + 1) *
+                        brick_size, volume) - box.origin;
+                boxes.push_back(box);
+            }
+        }
+    }
+
+    return boxes;
+}
+
+float TrailEdit::weight(const glm::ivec3 &voxel,
+        const glm::ivec3 &volume) const
+{
+    float result = 0.0f;
+    glm::vec3 position = glm::vec3(voxel) + 0.5f;
+
+    for (const glm::vec3 &center : this->centers)
+    {
+        glm::vec3 delta = glm::abs(position - center);
+        delta = glm::min(delta, glm::vec3(volume) - delta);
+
+        float distance = glm::length(delta);
+        if (distance < this->radius)
+        {
+            result = std::max(result, 1.0f - distance / this->radius);
+        }
+    }
+
+    return result;
+}
+
+float TrailEdit::apply(float value, float weight) const
+{
+    if (this->erase)
+    {
+        return value * (1.0f - weight);
+    }
+
+    return std::max(value, this->amount * weight);
+}
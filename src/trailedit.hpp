@@ -0,0 +1,34 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+
+// A batch of brush stamps on the trail, applied once per frame. Stamps wrap
+// around the volume like the agents do.
+struct TrailEdit
+{
+    struct Box
+    {
+        glm::ivec3 origin;
+        glm::ivec3 size;
+    };
+
+    static const int brick_size = 16;
+
+    std::vector<glm::vec3> centers;
+    float radius;
+
+    // Painting raises the channels in the mask towards amount, erasing
+    // lowers them towards zero. Bit i is the channel of species i.
+    float amount;
+    unsigned int channels;
+    bool erase;
+
+    // Bricks touched by any stamp, merged into runs along x and clipped to
+    // the volume. Only these need to be read or uploaded.
+    std::vector<Box> dirty_boxes(const glm::ivec3 &volume) const;
+
+    // Strength of the edit at a voxel, from 1 at a center to 0 at radius
+    float weight(const glm::ivec3 &voxel, const glm::ivec3 &volume) const;
+
+    float apply(float value, float weight) const;
+};
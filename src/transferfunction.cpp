@@ -0,0 +1,158 @@
+#include "transferfunction.hpp"
+#include <imgui.h>
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Piecewise linear between the control points
+static float curve(const float points[], float position)
+{
+    float x = std::min(std::max(position, 0.0f), 1.0f) *
+        (TransferFunction::num_points - 1);
+    int i = std::min(static_cast<int>(x), TransferFunction::num_points - 2);
+    float t = x - i;
+    return points[i] * (1.0f - t) + points[i + 1] * t;
+}
+
+TransferFunction::TransferFunction()
+    : changed(true), max_density(2.0f), max_step(4.0f), adaptivity(4.0f)
+{
+    // Close to the emission and opacity of the raw trail
+    for (int i = 0; i < num_points; i++)
+    {
+        this->extinction[i] = this->max_density * i / (num_points - 1);
+        this->brightness[i] = 1.0f;
+    }
+
+    glCreateTextures(GL_TEXTURE_2D, 1, &this->table);
+    glTextureParameteri(this->table, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(this->table, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(this->table, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(this->table, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureStorage2D(this->table, 1, GL_RG32F, table_size, table_size);
+}
+
+TransferFunction::~TransferFunction()
+{
+    glDeleteTextures(1, &this->table);
+}
+
+void TransferFunction::update_debug_window()
+{
+    ImGui::Begin("Transfer Function");
+
+    ImGui::DragFloat("Max Density", &this->max_density, 0.01f, 0.01f,
+            100.0f);
+    ImGui::DragFloat("Max Step", &this->max_step, 0.1f, 1.0f, 16.0f);
+    ImGui::DragFloat("Adaptivity", &this->adaptivity, 0.1f, 0.0f, 64.0f);
+
+    float *curves[] = {this->extinction, this->brightness};
+    const char *labels[] = {"Extinction", "Brightness"};
+    const float limits[] = {8.0f, 4.0f};
+    for (int c = 0; c < 2; c++)
+    {
+        ImGui::Text("%s", labels[c]);
+        ImGui::PushID(c);
+        for (int i = 0; i < num_points; i++)
+        {
+            ImGui::PushID(i);
+            if (i > 0)
+            {
+                ImGui::SameLine();
+            }
+            this->changed |= ImGui::VSliderFloat("", ImVec2(16.0f, 80.0f),
+                    &curves[c][i], 0.0f, limits[c], "");
+            ImGui::PopID();
+        }
+        ImGui::PopID();
+
+        float samples[64];
+        for (int i = 0; i < 64; i++)
+        {
+            samples[i] = curve(curves[c], i / 63.0f);
+        }
+        ImGui::PlotLines("", samples, 64, 0, nullptr, 0.0f, limits[c],
+                ImVec2(0.0f, 40.0f));
+    }
+
+    ImGui::End();
+
+    this->max_density = std::max(0.01f, this->max_density);
+    this->max_step = std::max(1.0f, this->max_step);
+}
+
+void TransferFunction::bind_to_unit(unsigned int unit)
+{
+    if (this->changed)
+    {
+        bake();
+        this->changed = false;
+    }
+
+    glBindTextureUnit(unit, this->table);
+}
+
+void TransferFunction::bake()
+{
+    // Integrals of extinction and of extinction weighted brightness from
+    // zero density, in table steps
+    std::vector<double> extinction_integral(table_size, 0.0);
+    std::vector<double> emission_integral(table_size, 0.0);
+    const int substeps = 16;
+    for (int i = 1; i < table_size; i++)
+    {
+        double extinction_sum = 0.0;
+        double emission_sum = 0.0;
+        for (int j = 0; j < substeps; j++)
+        {
+            float position = (i - 1 + (j + 0.5f) / substeps) /
+                (table_size - 1);
+            float tau = curve(this->extinction, position);
+            extinction_sum += tau;
+            emission_sum += tau * curve(this->brightness, position);
+        }
+
+        extinction_integral[i] = extinction_integral[i - 1] +
+            extinction_sum / substeps;
+        emission_integral[i] = emission_integral[i - 1] +
+            emission_sum / substeps;
+    }
+
+    // The density varies linearly along a segment, so its mean extinction
+    // is the integral between the end densities over their distance. The
+    // emission is stored as the extinction weighted mean brightness. Self
+    // attenuation within a segment is neglected, which keeps the table
+    // independent of the step length.
+    std::vector<float> texels(2 * table_size * table_size);
+    for (int back = 0; back < table_size; back++)
+    {
+        for (int front = 0; front < table_size; front++)
+        {
+            double tau;
+            double emission;
+            if (front == back)
+            {
+                float position = static_cast<float>(front) /
+                    (table_size - 1);
+                tau = curve(this->extinction, position);
+                emission = tau * curve(this->brightness, position);
+            }
+            else
+            {
+                double distance = back - front;
+                tau = (extinction_integral[back] -
+                        extinction_integral[front]) / distance;
+                emission = (emission_integral[back] -
+                        emission_integral[front]) / distance;
+            }
+
+            float *texel = &texels[2 * (front + table_size * back)];
+            texel[0] = static_cast<float>(tau);
+            texel[1] = tau > 0.0 ? static_cast<float>(emission / tau) : 0.0f;
+        }
+    }
+
+    glTextureSubImage2D(this->table, 0, 0, 0, table_size, table_size, GL_RG,
+            GL_FLOAT, texels.data());
+}
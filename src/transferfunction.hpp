@@ -0,0 +1,40 @@
+#pragma once
+
+// Maps the summed trail of a voxel to extinction and brightness, while the
+// species colors give the hue. The curves are baked into a pre-integrated
+// table over the densities at both ends of a ray segment, so the volume
+// can be sampled in steps of several voxels without banding.
+class TransferFunction
+{
+public:
+    static const int num_points = 16;
+    static const int table_size = 256;
+
+private:
+    unsigned int table;
+    bool changed;
+
+public:
+    // Control points at evenly spaced densities from 0 to max_density.
+    // Extinction is per voxel.
+    float extinction[num_points];
+    float brightness[num_points];
+    float max_density;
+
+    // Longest ray step in voxels, shortened by adaptivity where the
+    // density changes fast
+    float max_step;
+    float adaptivity;
+
+public:
+    TransferFunction();
+    ~TransferFunction();
+
+    void update_debug_window();
+
+    // Bakes the table if the curves changed since the last bind
+    void bind_to_unit(unsigned int unit);
+
+private:
+    void bake();
+};
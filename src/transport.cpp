@@ -0,0 +1,225 @@
+#include "transport.hpp"
+#include <future>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <stdio.h>
+
+#ifndef _WIN32
+#    include <sys/socket.h>
+#    include <sys/un.h>
+#    include <poll.h>
+#    include <unistd.h>
+#    include <string.h>
+#endif
+
+Transport::~Transport()
+{}
+
+bool Transport::shift(int direction, const std::vector<unsigned char> &data,
+        std::vector<unsigned char> &received)
+{
+    // Sending on its own thread keeps two ranks that both send large
+    // messages from filling each other's socket buffers and stalling
+    std::future<bool> sent = std::async(std::launch::async,
+            [this, direction, &data]()
+            {
+                return this->send(direction, data);
+            });
+
+    bool success = this->receive(-direction, received);
+    return sent.get() && success;
+}
+
+#ifndef _WIN32
+
+// Both neighbours must have started listening within this time
+static const int connect_timeout_ms = 30000;
+
+static bool write_all(int socket, const void *data, size_t size)
+{
+    const char *bytes = static_cast<const char *>(data);
+    while (size > 0)
+    {
+        ssize_t written = ::send(socket, bytes, size, MSG_NOSIGNAL);
+        if (written <= 0)
+            return false;
+
+        bytes += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+static bool read_all(int socket, void *data, size_t size)
+{
+    char *bytes = static_cast<char *>(data);
+    while (size > 0)
+    {
+        ssize_t count = read(socket, bytes, size);
+        if (count <= 0)
+            return false;
+
+        bytes += count;
+        size -= count;
+    }
+
+    return true;
+}
+
+SocketTransport::SocketTransport(int rank, int size,
+        const std::string &session)
+    : rank_index(rank), num_ranks(size), session(session),
+    listen_socket(-1), up_socket(-1), down_socket(-1)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    std::string path = this->socket_path(rank);
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    unlink(path.c_str());
+
+    this->listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (bind(this->listen_socket, reinterpret_cast<sockaddr *>(&address),
+                sizeof(address)) != 0 ||
+            listen(this->listen_socket, 1) != 0)
+    {
+        printf("Failed to listen on %s\n", path.c_str());
+        return;
+    }
+
+    // Connect up, then accept from below. Connecting only needs the other
+    // rank to listen, so the ring cannot deadlock. A rank that never starts
+    // leaves its neighbours invalid once the deadline passes.
+    auto deadline = std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(connect_timeout_ms);
+
+    sockaddr_un up_address;
+    memset(&up_address, 0, sizeof(up_address));
+    up_address.sun_family = AF_UNIX;
+
+    std::string up_path = this->socket_path((rank + 1) % size);
+    strncpy(up_address.sun_path, up_path.c_str(),
+            sizeof(up_address.sun_path) - 1);
+
+    this->up_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    while (connect(this->up_socket,
+                reinterpret_cast<sockaddr *>(&up_address),
+                sizeof(up_address)) != 0)
+    {
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            printf("Timed out connecting to rank %d\n", (rank + 1) % size);
+            close(this->up_socket);
+            this->up_socket = -1;
+            return;
+        }
+
+        usleep(10000);
+    }
+
+    long long remaining =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+    pollfd pending = { this->listen_socket, POLLIN, 0 };
+    if (poll(&pending, 1, static_cast<int>(std::max(remaining, 0LL))) <= 0)
+    {
+        printf("Timed out waiting for rank %d\n", (rank + size - 1) % size);
+        return;
+    }
+
+    this->down_socket = accept(this->listen_socket, nullptr, nullptr);
+    if (this->down_socket < 0)
+    {
+        printf("Failed to accept connection from rank %d\n",
+                (rank + size - 1) % size);
+    }
+}
+
+SocketTransport::~SocketTransport()
+{
+    if (this->up_socket >= 0)
+        close(this->up_socket);
+    if (this->down_socket >= 0)
+        close(this->down_socket);
+    if (this->listen_socket >= 0)
+    {
+        close(this->listen_socket);
+        unlink(this->socket_path(this->rank_index).c_str());
+    }
+}
+
+bool SocketTransport::valid() const
+{
+    return this->up_socket >= 0 && this->down_socket >= 0;
+}
+
+bool SocketTransport::send(int direction,
+        const std::vector<unsigned char> &data)
+{
+    int socket = direction > 0 ? this->up_socket : this->down_socket;
+
+    uint64_t size = data.size();
+    return write_all(socket, &size, sizeof(size)) &&
+        write_all(socket, data.data(), data.size());
+}
+
+bool SocketTransport::receive(int direction, std::vector<unsigned char> &data)
+{
+    int socket = direction > 0 ? this->up_socket : this->down_socket;
+
+    uint64_t size;
+    if (!read_all(socket, &size, sizeof(size)))
+        return false;
+
+    data.resize(size);
+    return read_all(socket, data.data(), size);
+}
+
+#else
+
+SocketTransport::SocketTransport(int rank, int size,
+        const std::string &session)
+    : rank_index(rank), num_ranks(size), session(session),
+    listen_socket(-1), up_socket(-1), down_socket(-1)
+{
+    printf("Socket transport is not supported on this platform\n");
+}
+
+SocketTransport::~SocketTransport()
+{}
+
+bool SocketTransport::valid() const
+{
+    return false;
+}
+
+bool SocketTransport::send(int, const std::vector<unsigned char> &)
+{
+    return false;
+}
+
+bool SocketTransport::receive(int, std::vector<unsigned char> &)
+{
+    return false;
+}
+
+#endif
+
+int SocketTransport::rank() const
+{
+    return this->rank_index;
+}
+
+int SocketTransport::size() const
+{
+    return this->num_ranks;
+}
+
+std::string SocketTransport::socket_path(int rank) const
+{
+    return "/tmp/physarum-" + this->session + "-" + std::to_string(rank) +
+        ".sock";
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include <string>
+
+// Message passing between the processes of a decomposed simulation. Ranks
+// form a periodic ring, and messages only go to the neighbour one rank up
+// (direction 1) or down (direction -1).
+class Transport
+{
+public:
+    virtual ~Transport();
+
+    virtual int rank() const = 0;
+    virtual int size() const = 0;
+
+    virtual bool send(int direction,
+            const std::vector<unsigned char> &data) = 0;
+    virtual bool receive(int direction, std::vector<unsigned char> &data) = 0;
+
+    // Sends to the neighbour in direction while receiving from the opposite
+    // one. Every rank can shift at the same time without blocking.
+    bool shift(int direction, const std::vector<unsigned char> &data,
+            std::vector<unsigned char> &received);
+};
+
+// Ranks on the same machine, connected with Unix domain sockets
+class SocketTransport : public Transport
+{
+private:
+    int rank_index;
+    int num_ranks;
+    std::string session;
+
+    int listen_socket;
+    int up_socket;
+    int down_socket;
+
+public:
+    SocketTransport(int rank, int size, const std::string &session);
+    ~SocketTransport();
+
+    bool valid() const;
+
+    int rank() const override;
+    int size() const override;
+
+    bool send(int direction, const std::vector<unsigned char> &data) override;
+    bool receive(int direction, std::vector<unsigned char> &data) override;
+
+private:
+    std::string socket_path(int rank) const;
+};
@@ -0,0 +1,80 @@
+#include "workerpool.hpp"
+#include "numa.hpp"
+#include <iostream>
+
+WorkerPool::WorkerPool(const std::vector<int> &cpus)
+    : generation(0), remaining(0), stopping(false)
+{
+    for (size_t i = 0; i < cpus.size(); i++)
+    {
+        this->threads.emplace_back(&WorkerPool::work, this, i, cpus[i]);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+
+    this->start_condition.notify_all();
+
+    for (auto &thread : this->threads)
+    {
+        thread.join();
+    }
+}
+
+int WorkerPool::size() const
+{
+    return this->threads.size();
+}
+
+void WorkerPool::run(const std::function<void(int)> &task)
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    this->task = task;
+    this->remaining = this->threads.size();
+    this->generation++;
+
+    this->start_condition.notify_all();
+    this->done_condition.wait(lock, [this]() { return this->remaining == 0; });
+}
+
+void WorkerPool::work(int index, int cpu)
+{
+    if (!Numa::pin_current_thread(cpu))
+    {
+        std::cout << "Could not pin worker " << index << " to cpu " << cpu
+            << ", it may run on any cpu\n";
+    }
+
+    size_t seen = 0;
+    while (true)
+    {
+        std::function<void(int)> current;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->start_condition.wait(lock, [this, seen]()
+                    {
+                        return this->stopping || this->generation != seen;
+                    });
+
+            if (this->stopping)
+                return;
+
+            seen = this->generation;
+            current = this->task;
+        }
+
+        current(index);
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (--this->remaining == 0)
+        {
+            this->done_condition.notify_one();
+        }
+    }
+}
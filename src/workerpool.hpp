@@ -0,0 +1,34 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Persistent threads, each pinned to one cpu. run() executes a task on every
+// worker and returns once all of them are done.
+class WorkerPool
+{
+private:
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable start_condition;
+    std::condition_variable done_condition;
+
+    std::function<void(int)> task;
+    size_t generation;
+    int remaining;
+    bool stopping;
+
+public:
+    WorkerPool(const std::vector<int> &cpus);
+    ~WorkerPool();
+
+    int size() const;
+
+    void run(const std::function<void(int)> &task);
+
+private:
+    void work(int index, int cpu);
+};